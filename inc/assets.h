@@ -0,0 +1,50 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Data partition the asset pack is flashed into, see tools/pack_assets.py
+#define ASSETS_PARTITION_LABEL   "assets"
+#define ASSETS_PARTITION_SUBTYPE (0x40)
+// "IT8A", little-endian
+#define ASSETS_MAGIC   (0x41385449)
+#define ASSETS_VERSION (1)
+// Max length of an asset's name, NUL included
+#define ASSETS_NAME_LEN (24)
+
+// The pack starts with the header, followed by the entries of the assets. The
+// pixels of each asset are stored 4 byte aligned, at its entry's offset.
+typedef struct __attribute__((packed)) stAssetPackHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} stAssetPackHeader_t;
+static_assert(sizeof(stAssetPackHeader_t) == 8);
+
+typedef struct __attribute__((packed)) stAssetEntry {
+    // NUL padded
+    char name[ASSETS_NAME_LEN];
+    // The width is a multiple of 4, so every row is whole 16bit words
+    uint16_t width, height;
+    // Offset of the pixels from the start of the partition
+    uint32_t offset;
+    // Size of the pixels, width*height/2
+    uint32_t size;
+} stAssetEntry_t;
+static_assert(sizeof(stAssetEntry_t) == 36);
+
+// Asset as mapped into the address space. The pixels are packed 4bpp in the
+// IT8951's big-endian wire format, the first pixel in the high nibble, i.e.
+// the same format as display.c's shadow framebuffer.
+typedef struct stAsset {
+    const char *name;
+    uint16_t width, height;
+    const uint8_t *pixels;
+} stAsset_t;
+
+bool assets_init(void);
+bool assets_find(const char *const name, stAsset_t *const asset);
+
+#endif
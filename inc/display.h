@@ -1,11 +1,70 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
 
-#define DISPLAY_HOR_RES (1872)
-#define DISPLAY_VER_RES (1404)
+#include "assets.h"
+
+// Clockwise rotation of the UI on the panel in degrees: 0, 90, 180 or 270. 
+// LVGL renders in the rotated orientation and the IT8951 rotates the pixels 
+// while loading them, so a portrait mounting costs no software rotation.
+#ifndef DISPLAY_ROTATION_DEG
+#define DISPLAY_ROTATION_DEG (0)
+#endif
+
+// With 1, the panel shows its 16 raw gray levels instead of the UI, to 
+// calibrate the gray curve of lib/gray4 with tools/gray4_curve.py
+#ifndef DISPLAY_GRAY_WEDGE
+#define DISPLAY_GRAY_WEDGE (0)
+#endif
+
+// With 1, every flush logs the time of its stages, and every refresh the
+// updates per waveform and the bytes the diffing saved. These are debug logs,
+// so CONFIG_LOG_MAXIMUM_LEVEL must be at least debug for them to be printed.
+#ifndef DISPLAY_LOG_TIMING
+#define DISPLAY_LOG_TIMING (0)
+#endif
+
+// Dithering of the conversion to the 16 gray levels, per region of the screen
+typedef enum eDisplayDither {
+    /// @brief The level below the luminance. The fastest, bands gradients
+    DISPLAY_DITHER_NONE            = 0,
+    /// @brief Ordered 4x4 Bayer dither. A re-rendered area converts the same,
+    /// so only its changed pixels are updated
+    DISPLAY_DITHER_BAYER           = 1,
+    /// @brief Floyd-Steinberg error diffusion, for photos. The error is carried
+    /// from row to row across the flushed areas, so a re-rendered area can 
+    /// convert differently and be updated as a whole.
+    DISPLAY_DITHER_FLOYD_STEINBERG = 2,
+} eDisplayDither_t;
+#define IsEnum_DisplayDither(e) ((e) == DISPLAY_DITHER_NONE  || \
+                                 (e) == DISPLAY_DITHER_BAYER || \
+                                 (e) == DISPLAY_DITHER_FLOYD_STEINBERG)
+
+// Dither of the screen outside the regions of display_set_dither()
+#ifndef DISPLAY_DITHER
+#define DISPLAY_DITHER (DISPLAY_DITHER_NONE)
+#endif
+
+#define DISPLAY_PANEL_WIDTH  (1872)
+#define DISPLAY_PANEL_HEIGHT (1404)
+
+// Resolution of the UI, in its rotated orientation
+#if DISPLAY_ROTATION_DEG == 0 || DISPLAY_ROTATION_DEG == 180
+#define DISPLAY_HOR_RES DISPLAY_PANEL_WIDTH
+#define DISPLAY_VER_RES DISPLAY_PANEL_HEIGHT
+#elif DISPLAY_ROTATION_DEG == 90 || DISPLAY_ROTATION_DEG == 270
+#define DISPLAY_HOR_RES DISPLAY_PANEL_HEIGHT
+#define DISPLAY_VER_RES DISPLAY_PANEL_WIDTH
+#else
+#error "DISPLAY_ROTATION_DEG must be 0, 90, 180 or 270"
+#endif
 
 void display_init(void);
 void display_flush(lv_display_t *disp, const lv_area_t *area, uint8_t *px_map);
 void display_rounder(lv_event_t *e);
+void display_process(void);
+bool display_blit_asset(const stAsset_t *const asset, const uint16_t x, const uint16_t y);
+void display_show_gray_wedge(void);
+bool display_set_dither(const lv_area_t *area, const eDisplayDither_t dither);
+void display_clear_dither(void);
 
 #endif
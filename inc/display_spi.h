@@ -0,0 +1,13 @@
+#ifndef DISPLAY_SPI_H
+#define DISPLAY_SPI_H
+
+#include "it8951.h"
+
+// Max DMA transfer byte length on the ESP32-S3 is (1<<18)/8=32768. The pixel
+// uploads are split into row blocks of at most this size.
+#define DISPLAY_SPI_MAX_TRANSFER_SIZE (32768)
+#define DISPLAY_SPI_CLOCK_SPEED_HZ    (24000000)
+
+void display_spi_init(stIT8951_Handler_t *hdlr);
+
+#endif
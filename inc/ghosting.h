@@ -0,0 +1,21 @@
+#ifndef GHOSTING_H
+#define GHOSTING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "it8951.h"
+
+#define GHOSTING_TILE_SIZE (64)
+// Default number of fast (non-flashing) updates a tile may take before it is
+// cleaned up with GC16
+#define GHOSTING_DEFAULT_BUDGET (20)
+// Max number of rectangles a cleanup is consolidated into
+#define GHOSTING_MAX_CLEANUP_RECTS (32)
+
+void ghosting_init(uint16_t panel_width, uint16_t panel_height);
+void ghosting_set_budget(uint8_t budget);
+void ghosting_record_update(const stRectangle_t *const rect, eIT8951_DisplayMode_t mode);
+bool ghosting_is_cleanup_due(void);
+uint32_t ghosting_get_cleanup_rects(stRectangle_t *rects, uint32_t max_rects);
+
+#endif
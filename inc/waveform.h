@@ -0,0 +1,16 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <stdint.h>
+#include "it8951.h"
+
+#define WAVEFORM_GRAY_LEVELS (16)
+// GL16 is picked for content with at least this share of white pixels [%]
+#define WAVEFORM_GL16_WHITE_PERCENT (75)
+
+eIT8951_DisplayMode_t waveform_select(const uint32_t hist[WAVEFORM_GRAY_LEVELS]);
+void waveform_record_update(eIT8951_DisplayMode_t mode);
+uint32_t waveform_get_count(eIT8951_DisplayMode_t mode);
+void waveform_log_stats(void);
+
+#endif
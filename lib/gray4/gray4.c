@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "gray4.h"
+
+#define REPEAT_8(f, i)  f(i), f(i+1), f(i+2), f(i+3), f(i+4), f(i+5), f(i+6), f(i+7)
+#define REPEAT_32(f, i) REPEAT_8(f, i), REPEAT_8(f, i+8), REPEAT_8(f, i+16), REPEAT_8(f, i+24)
+#define REPEAT_64(f, i) REPEAT_32(f, i), REPEAT_32(f, i+32)
+#define REPEAT_256(f)   REPEAT_64(f, 0), REPEAT_64(f, 64), REPEAT_64(f, 128), REPEAT_64(f, 192)
+#define REPEAT_512(f)   REPEAT_256(f), REPEAT_64(f, 256), REPEAT_64(f, 320), REPEAT_64(f, 384), REPEAT_64(f, 448)
+
+// The luminance 18837R + 18197G + 7182B of rgb565_to_gray4.txt is separable,
+// so instead of its 64 KB LUT a table per byte of the pixel sums it: R and the
+// top 3 bits of G in the high byte, the rest of G and B in the low one. That
+// is 2 KB that stay in the cache, and no masking of the components. The curve
+// is applied by comparing the sum with the thresholds of the gray levels, 31
+// times GRAY4_THRESHOLD(). That is in the 16bit units of GRAY4_LUMA_MAX,
+// sum/31, and sum >= 31*t exactly when sum/31 >= t.
+#define LUMA_HI(i) (18837*((i) >> 3) + 18197*8*((i) & 7))
+#define LUMA_LO(i) (18197*((i) >> 5) + 7182*((i) & 0x1F))
+#define CURVE(k)   (31*GRAY4_THRESHOLD(k))
+static const uint32_t DRAM_ATTR luma_hi[256] = { REPEAT_256(LUMA_HI) };
+static const uint32_t DRAM_ATTR luma_lo[256] = { REPEAT_256(LUMA_LO) };
+enum {
+    CURVE_1 = CURVE(1), CURVE_2 = CURVE(2), CURVE_3 = CURVE(3), CURVE_4 = CURVE(4),
+    CURVE_5 = CURVE(5), CURVE_6 = CURVE(6), CURVE_7 = CURVE(7), CURVE_8 = CURVE(8),
+    CURVE_9 = CURVE(9), CURVE_10 = CURVE(10), CURVE_11 = CURVE(11), CURVE_12 = CURVE(12),
+    CURVE_13 = CURVE(13), CURVE_14 = CURVE(14), CURVE_15 = CURVE(15),
+};
+
+// Instead of searching the 15 thresholds, the sum's top bits index its 4096
+// wide step in another 512 entries, at most 16bit each. An entry holds the
+// level the step starts at, and in the upper 12 bits how far the threshold
+// inside the step is from its end. Adding that to the sum's low bits carries
+// into bit 12 from the threshold on. The curves' steps are wider than 4096,
+// which the static_assert checks, so no step holds two thresholds.
+#define LEVEL_SHIFT   (12)
+#define STEP          (1 << LEVEL_SHIFT)
+#define LEVEL(v)      (((v) >= CURVE_1) + ((v) >= CURVE_2) + ((v) >= CURVE_3) + ((v) >= CURVE_4) + \
+                       ((v) >= CURVE_5) + ((v) >= CURVE_6) + ((v) >= CURVE_7) + ((v) >= CURVE_8) + \
+                       ((v) >= CURVE_9) + ((v) >= CURVE_10) + ((v) >= CURVE_11) + ((v) >= CURVE_12) + \
+                       ((v) >= CURVE_13) + ((v) >= CURVE_14) + ((v) >= CURVE_15))
+#define TO_END(t, v)  (((t) > (v) && (t) < (v) + STEP && (t) <= 31*GRAY4_LUMA_MAX) ? (v) + STEP - (t) : 0)
+#define STEP_END(v)   (TO_END(CURVE_1, v) + TO_END(CURVE_2, v) + TO_END(CURVE_3, v) + TO_END(CURVE_4, v) + \
+                       TO_END(CURVE_5, v) + TO_END(CURVE_6, v) + TO_END(CURVE_7, v) + TO_END(CURVE_8, v) + \
+                       TO_END(CURVE_9, v) + TO_END(CURVE_10, v) + TO_END(CURVE_11, v) + TO_END(CURVE_12, v) + \
+                       TO_END(CURVE_13, v) + TO_END(CURVE_14, v) + TO_END(CURVE_15, v))
+#define LUMA_LEVEL(i) (LEVEL((i) << LEVEL_SHIFT) | (STEP_END((i) << LEVEL_SHIFT) << 4))
+// Thresholds at 0 are where the first step starts, and those above white are
+// never reached, they may be closer
+#define STEP_OK(k, n) (CURVE_##k == 0 || CURVE_##n > 31*GRAY4_LUMA_MAX || CURVE_##n - CURVE_##k >= STEP)
+static_assert(((31*GRAY4_LUMA_MAX) >> LEVEL_SHIFT) < 512, "luma_levels is too short");
+static_assert(STEP_OK(1, 2) && STEP_OK(2, 3) && STEP_OK(3, 4) && STEP_OK(4, 5) && STEP_OK(5, 6) &&
+              STEP_OK(6, 7) && STEP_OK(7, 8) && STEP_OK(8, 9) && STEP_OK(9, 10) && STEP_OK(10, 11) &&
+              STEP_OK(11, 12) && STEP_OK(12, 13) && STEP_OK(13, 14) && STEP_OK(14, 15),
+              "The gray curve is too steep for luma_levels, lower LEVEL_SHIFT");
+static const uint16_t DRAM_ATTR luma_levels[512] = { REPEAT_512(LUMA_LEVEL) };
+
+// LVGL's L8 pixels are the luminance scaled to 255, GRAY4_LUMA_MAX/255 = 
+// 4200/17 units each. Level k is reached from ceil(17*GRAY4_THRESHOLD(k)/4200),
+// which the 256 byte table of the levels is counted from.
+#define L8_THRESHOLD(k) ((17*GRAY4_THRESHOLD(k) + 4199)/4200)
+enum {
+    L8_T1 = L8_THRESHOLD(1), L8_T2 = L8_THRESHOLD(2), L8_T3 = L8_THRESHOLD(3),
+    L8_T4 = L8_THRESHOLD(4), L8_T5 = L8_THRESHOLD(5), L8_T6 = L8_THRESHOLD(6),
+    L8_T7 = L8_THRESHOLD(7), L8_T8 = L8_THRESHOLD(8), L8_T9 = L8_THRESHOLD(9),
+    L8_T10 = L8_THRESHOLD(10), L8_T11 = L8_THRESHOLD(11), L8_T12 = L8_THRESHOLD(12),
+    L8_T13 = L8_THRESHOLD(13), L8_T14 = L8_THRESHOLD(14), L8_T15 = L8_THRESHOLD(15),
+};
+#define L8_LEVEL(v) (((v) >= L8_T1) + ((v) >= L8_T2) + ((v) >= L8_T3) + ((v) >= L8_T4) + \
+                     ((v) >= L8_T5) + ((v) >= L8_T6) + ((v) >= L8_T7) + ((v) >= L8_T8) + \
+                     ((v) >= L8_T9) + ((v) >= L8_T10) + ((v) >= L8_T11) + ((v) >= L8_T12) + \
+                     ((v) >= L8_T13) + ((v) >= L8_T14) + ((v) >= L8_T15))
+static const uint8_t DRAM_ATTR l8_levels[256] = { REPEAT_256(L8_LEVEL) };
+
+// The dithering quantizes fine levels, 16 per gray level: 16*level plus where
+// the luminance lies between the level's threshold and the next one's, on the 
+// continuous curve of gray4.h. The RGB565 luminance sums are looked up by their
+// top bits, 32 steps per gray level of the default curve.
+#define CLAMP_01(v) ((v) < 0.0 ? 0.0 : (v) > 1.0 ? 1.0 : (v))
+#define CURVE_X2(x) CLAMP_01(0.5 + (CLAMP_01(((x) - GRAY4_BLACK_POINT)/  \
+                    (GRAY4_WHITE_POINT - GRAY4_BLACK_POINT)) - 0.5)*GRAY4_CONTRAST)
+#define FINE_LEVEL(x) ((uint8_t)(16*(GRAY4_LEVELS - 1)*__builtin_pow(CURVE_X2(x), 1.0/GRAY4_GAMMA) + 1e-6))
+#define FINE_SHIFT    (12)
+#define L8_FINE(v)    FINE_LEVEL((v)/255.0)
+#define LUMA_FINE(i)  FINE_LEVEL((((i) << FINE_SHIFT) + (1 << (FINE_SHIFT - 1)))/(31.0*GRAY4_LUMA_MAX))
+static_assert(((31*GRAY4_LUMA_MAX) >> FINE_SHIFT) < 512, "luma_fine is too short");
+static const uint8_t DRAM_ATTR l8_fine[256] = { REPEAT_256(L8_FINE) };
+static const uint8_t DRAM_ATTR luma_fine[512] = { REPEAT_512(LUMA_FINE) };
+
+// Thresholds of the ordered dither, which rounds a fine level up to the next 
+// gray level with the probability of its fraction
+static const uint8_t DRAM_ATTR bayer[4][4] = {
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5},
+};
+
+/// @brief Converts an RGB565 pixel to GRAY4 through the gray curve. With the
+/// default curve, this is bit-exact with the LUT in rgb565_to_gray4.txt:
+/// gray = (18837R + 18197G + 7182B)/130200.
+__attribute__((always_inline))
+static inline uint8_t rgb565_to_gray4(const uint16_t color) {
+    const uint32_t luma = luma_hi[color >> 8] + luma_lo[color & 0xFF];
+    const uint32_t step = luma_levels[luma >> LEVEL_SHIFT];
+    return (step & 0xF) + (((luma & (STEP - 1)) + (step >> 4)) >> LEVEL_SHIFT);
+}
+
+/// @brief Converts RGB565 pixels to GRAY4 and packs them as big-endian 4bpp,
+/// i.e. the first pixel lands in the high nibble
+/// @param color RGB565 pixels
+/// @param out Packed GRAY4 output. Must be at least num_pix/2 bytes
+/// @param num_pix Number of pixels to convert. Must be even
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_from_rgb565(const uint16_t *color, uint8_t *out, const uint32_t num_pix) {
+    for(uint32_t i=0; i<num_pix; i+=2) {
+        const uint8_t g0 = rgb565_to_gray4(color[0]);
+        const uint8_t g1 = rgb565_to_gray4(color[1]);
+        *out++ = (g0 << 4) | g1;
+        color += 2;
+    }
+}
+
+/// @brief Converts LVGL's L8 pixels to GRAY4 through the gray curve and packs 
+/// them as big-endian 4bpp, like gray4_from_rgb565()
+/// @param lum L8 pixels
+/// @param out Packed GRAY4 output. Must be at least num_pix/2 bytes
+/// @param num_pix Number of pixels to convert. Must be even
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_from_l8(const uint8_t *lum, uint8_t *out, const uint32_t num_pix) {
+    for(uint32_t i=0; i<num_pix; i+=2) {
+        *out++ = (l8_levels[lum[i]] << 4) | l8_levels[lum[i+1]];
+    }
+}
+
+/// @brief Fine level of pixel i of RGB565 or L8 pixels, see l8_fine
+__attribute__((always_inline))
+static inline int32_t fine_level(const void *px, const uint32_t i, const bool is_l8) {
+    if(is_l8) {
+        return l8_fine[((const uint8_t*)px)[i]];
+    }
+    const uint16_t color = ((const uint16_t*)px)[i];
+    const uint32_t luma = luma_hi[color >> 8] + luma_lo[color & 0xFF];
+    return luma_fine[luma >> FINE_SHIFT];
+}
+
+__attribute__((always_inline))
+static inline void dither_bayer(const void *px, const bool is_l8, uint8_t *out, const uint32_t num_pix, 
+                                const uint32_t x, const uint32_t y) {
+    // x is even, so the pixel pairs alternate between two pairs of the row's 
+    // thresholds. At most 240 + 15, the sums stay within the gray levels.
+    const uint8_t *const thr = bayer[y & 3];
+    uint32_t col = x & 3;
+    for(uint32_t i=0; i<num_pix; i+=2, col^=2) {
+        const uint32_t g0 = (fine_level(px, i, is_l8) + thr[col]) >> 4;
+        const uint32_t g1 = (fine_level(px, i+1, is_l8) + thr[col+1]) >> 4;
+        *out++ = (g0 << 4) | g1;
+    }
+}
+
+/// @brief Quantizes a fine level plus its diffused error to the nearest gray
+/// level, and spreads the error over the next pixel and the row below
+__attribute__((always_inline))
+static inline uint32_t diffuse(const int32_t v, int16_t *err, int32_t *right, int32_t *below_prev, int32_t *below) {
+    int32_t level = (v + 8) >> 4;
+    level = (level < 0) ? 0 : (level > GRAY4_LEVELS-1) ? GRAY4_LEVELS-1 : level;
+    const int32_t e = v - 16*level;
+    const int32_t e3 = (3*e) >> 4, e5 = (5*e) >> 4, e1 = e >> 4;
+    *right = e - e3 - e5 - e1;
+    *err = *below_prev + e3;
+    *below_prev = *below + e5;
+    *below = e1;
+    return level;
+}
+
+__attribute__((always_inline))
+static inline void dither_fs(const void *px, const bool is_l8, uint8_t *out, const uint32_t num_pix, int16_t *err) {
+    // Error [fine levels] into the next pixel, and into the pixels below the 
+    // previous and the current one. err[i+1] is read before it is replaced.
+    int32_t right = 0, below_prev = 0, below = 0;
+    const int16_t scratch = err[0];
+    for(uint32_t i=0; i<num_pix; i+=2) {
+        const uint32_t g0 = diffuse(fine_level(px, i, is_l8) + err[i+1] + right, &err[i], &right, &below_prev, &below);
+        const uint32_t g1 = diffuse(fine_level(px, i+1, is_l8) + err[i+2] + right, &err[i+1], &right, &below_prev, &below);
+        *out++ = (g0 << 4) | g1;
+    }
+    err[num_pix] = below_prev;
+    err[0] = scratch;
+}
+
+/// @brief Converts RGB565 pixels to GRAY4 with a 4x4 ordered (Bayer) dither
+/// and packs them like gray4_from_rgb565()
+/// @param color RGB565 pixels
+/// @param out Packed GRAY4 output. Must be at least num_pix/2 bytes
+/// @param num_pix Number of pixels to convert. Must be even
+/// @param x X of the first pixel on the screen. Must be even
+/// @param y Y of the pixels on the screen
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_dither_bayer_rgb565(const uint16_t *color, uint8_t *out, const uint32_t num_pix, 
+                                         const uint32_t x, const uint32_t y) {
+    dither_bayer(color, false, out, num_pix, x, y);
+}
+
+/// @brief Converts L8 pixels to GRAY4 with a 4x4 ordered (Bayer) dither, like
+/// gray4_dither_bayer_rgb565()
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_dither_bayer_l8(const uint8_t *lum, uint8_t *out, const uint32_t num_pix, 
+                                     const uint32_t x, const uint32_t y) {
+    dither_bayer(lum, true, out, num_pix, x, y);
+}
+
+/// @brief Converts a row of RGB565 pixels to GRAY4 with Floyd-Steinberg error
+/// diffusion and packs them like gray4_from_rgb565()
+/// @param color RGB565 pixels
+/// @param out Packed GRAY4 output. Must be at least num_pix/2 bytes
+/// @param num_pix Number of pixels to convert. Must be even
+/// @param err Error carried between the rows, num_pix + 1 entries. err[i+1] is
+/// the error diffused into pixel i from the row above, and is replaced with the
+/// error into the row below. err[0] is left as is. All 0 for the first row.
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_dither_fs_rgb565(const uint16_t *color, uint8_t *out, const uint32_t num_pix, int16_t *err) {
+    dither_fs(color, false, out, num_pix, err);
+}
+
+/// @brief Converts a row of L8 pixels to GRAY4 with Floyd-Steinberg error
+/// diffusion, like gray4_dither_fs_rgb565()
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_dither_fs_l8(const uint8_t *lum, uint8_t *out, const uint32_t num_pix, int16_t *err) {
+    dither_fs(lum, true, out, num_pix, err);
+}
+
+/// @brief Packs a two-level packed GRAY4 row into 1bpp, 8 pixels (4 GRAY4
+/// bytes) per byte with the first pixel in the MSB
+/// @param gray Packed GRAY4 pixels. Must be at least out_bytes*4 bytes
+/// @param out 1bpp output
+/// @param out_bytes Number of bytes to write to out
+/// @param bg Gray level the 1 bits stand for. Any other level is a 0 bit
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_to_1bpp(const uint8_t *gray, uint8_t *out, const uint32_t out_bytes, const uint8_t bg) {
+    for(uint32_t i=0; i<out_bytes; i++, gray+=4) {
+        uint8_t bits = 0;
+        for(uint32_t j=0; j<4; j++) {
+            bits = (bits << 2) | (((gray[j] >> 4) == bg) << 1) | ((gray[j] & 0xF) == bg);
+        }
+        *out++ = bits;
+    }
+}
+
+/// @brief Accumulates the gray-level histogram of packed GRAY4 pixels
+/// @param gray Packed GRAY4 pixels
+/// @param num_pix Number of pixels. Must be even
+/// @param hist [out] Gray-level histogram, accumulated over the calls
+__attribute__((optimize("Ofast")))
+void IRAM_ATTR gray4_histogram(const uint8_t *gray, const uint32_t num_pix, uint32_t hist[GRAY4_LEVELS]) {
+    for(uint32_t i=0; i<num_pix/2; i++) {
+        hist[gray[i] >> 4]++;
+        hist[gray[i] & 0xF]++;
+    }
+}
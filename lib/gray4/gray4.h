@@ -0,0 +1,70 @@
+#ifndef GRAY4_H
+#define GRAY4_H
+
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+// Conversion of LVGL's RGB565 or L8 pixels into the 4bpp gray levels of the
+// shadow framebuffer, and the packing of these into the IT8951's image formats.
+// The packed GRAY4 rows are big-endian, i.e. the first pixel is in the high
+// nibble.
+
+#define GRAY4_LEVELS (16)
+
+// The gray curve maps the luminance x = 0.299R + 0.587G + 0.114B in [0,1] to
+// the gray levels. Each parameter can be set in the build_flags, e.g. 
+// -D GRAY4_GAMMA=1.8, and tools/gray4_curve.py fits them to the panel:
+//   x'    = (x - GRAY4_BLACK_POINT)/(GRAY4_WHITE_POINT - GRAY4_BLACK_POINT)
+//   x''   = 0.5 + (x' - 0.5)*GRAY4_CONTRAST
+//   level = floor(15*x''^(1/GRAY4_GAMMA)), with x' and x'' clamped to [0,1]
+// The defaults are the identity, i.e. the LUT of rgb565_to_gray4.txt.
+#ifndef GRAY4_GAMMA
+#define GRAY4_GAMMA (1.0)
+#endif
+#ifndef GRAY4_CONTRAST
+#define GRAY4_CONTRAST (1.0)
+#endif
+#ifndef GRAY4_BLACK_POINT
+#define GRAY4_BLACK_POINT (0.0)
+#endif
+#ifndef GRAY4_WHITE_POINT
+#define GRAY4_WHITE_POINT (1.0)
+#endif
+
+// The luminance the curve is applied to, in 16bit units: 
+// (18837R + 18197G + 7182B)/31 of the 5, 6 and 5 bit components
+#define GRAY4_LUMA_MAX (63000)
+
+// The curve is generated at build time as the lowest luminance of each gray 
+// level, by inverting it. GCC folds the math builtins of constant arguments, 
+// so these are constant expressions. A level that is never reached is at 
+// GRAY4_LUMA_MAX + 1.
+#define GRAY4_CURVE_X1(k) (0.5 + (__builtin_pow((k)/15.0, GRAY4_GAMMA) - 0.5)/GRAY4_CONTRAST)
+#define GRAY4_CURVE_LUMA(k) \
+    (GRAY4_LUMA_MAX*(GRAY4_BLACK_POINT + (GRAY4_WHITE_POINT - GRAY4_BLACK_POINT)*GRAY4_CURVE_X1(k)))
+// The 1e-6 keeps the rounding errors of the identity off the integer bounds
+#define GRAY4_THRESHOLD(k) ((uint16_t)(                                        \
+    (GRAY4_CURVE_X1(k) <= 0.0 || GRAY4_CURVE_LUMA(k) <= 0.0) ? 0 :             \
+    (GRAY4_CURVE_X1(k) > 1.0 || GRAY4_CURVE_LUMA(k) > GRAY4_LUMA_MAX) ?       \
+        GRAY4_LUMA_MAX + 1 : __builtin_ceil(GRAY4_CURVE_LUMA(k) - 1e-6)))
+
+void gray4_from_rgb565(const uint16_t *color, uint8_t *out, const uint32_t num_pix);
+void gray4_from_l8(const uint8_t *lum, uint8_t *out, const uint32_t num_pix);
+void gray4_to_1bpp(const uint8_t *gray, uint8_t *out, const uint32_t out_bytes, const uint8_t bg);
+void gray4_histogram(const uint8_t *gray, const uint32_t num_pix, uint32_t hist[GRAY4_LEVELS]);
+
+// Dithered conversions, which spread the error of the 16 gray levels over the
+// neighbouring pixels instead of banding gradients and photos. The ordered
+// dither only depends on the pixels' position, so a re-rendered area converts
+// the same. Floyd-Steinberg diffuses the error along the row and into the next
+// row through err, and suits photos.
+void gray4_dither_bayer_rgb565(const uint16_t *color, uint8_t *out, const uint32_t num_pix, 
+                               const uint32_t x, const uint32_t y);
+void gray4_dither_bayer_l8(const uint8_t *lum, uint8_t *out, const uint32_t num_pix, 
+                           const uint32_t x, const uint32_t y);
+void gray4_dither_fs_rgb565(const uint16_t *color, uint8_t *out, const uint32_t num_pix, int16_t *err);
+void gray4_dither_fs_l8(const uint8_t *lum, uint8_t *out, const uint32_t num_pix, int16_t *err);
+
+#endif
@@ -1,4 +1,5 @@
 #include <limits.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,7 +56,7 @@ static void it8951_u16_arr_to_device_info(const uint16_t raw[20], stIT8951_Devic
 char *it8951_device_info_to_string(const stIT8951_DeviceInfo_t *const dev_info, char *buff) {
     sprintf(buff, "Panel width: %u\n"
                   "Panel height: %u\n"
-                  "Image buffer address: 0x%lx\n"
+                  "Image buffer address: 0x%" PRIx32 "\n"
                   "Firmware version: %s\n"
                   "LuT version: %s", 
                   dev_info->panel_width, 
@@ -86,6 +87,31 @@ bool rectangle_is_contained_within(const stRectangle_t *const rect1, const stRec
             rect1->y + rect1->height <= rect2->y + rect2->height);
 }
 
+/// @brief Checks if 2 rectangles share at least one pixel
+/// @param rect1 Pointer to the first rectangle
+/// @param rect2 Pointer to the second rectangle
+/// @return True if the rectangles intersect, false otherwise
+__attribute__((pure))
+bool rectangle_intersects(const stRectangle_t *const rect1, const stRectangle_t *const rect2) {
+    return (rect1->x < rect2->x + rect2->width  &&
+            rect2->x < rect1->x + rect1->width  &&
+            rect1->y < rect2->y + rect2->height &&
+            rect2->y < rect1->y + rect1->height);
+}
+
+/// @brief Calculates the bounding box of 2 rectangles
+/// @param rect1 Pointer to the first rectangle
+/// @param rect2 Pointer to the second rectangle
+/// @return The smallest rectangle containing both rectangles
+__attribute__((pure))
+stRectangle_t rectangle_union(const stRectangle_t *const rect1, const stRectangle_t *const rect2) {
+    const uint16_t x1 = (rect1->x < rect2->x) ? rect1->x : rect2->x;
+    const uint16_t y1 = (rect1->y < rect2->y) ? rect1->y : rect2->y;
+    const uint32_t x2 = ((rect1->x + rect1->width)  > (rect2->x + rect2->width))  ? (rect1->x + rect1->width)  : (rect2->x + rect2->width);
+    const uint32_t y2 = ((rect1->y + rect1->height) > (rect2->y + rect2->height)) ? (rect1->y + rect1->height) : (rect2->y + rect2->height);
+    return (stRectangle_t){x1, y1, x2 - x1, y2 - y1};
+}
+
 /// @brief Converts a rectangle into a string
 /// @param rect Rectangle to stringify
 /// @param buff Buffer to store the string in. Must be at least 53 bytes.
@@ -93,30 +119,159 @@ bool rectangle_is_contained_within(const stRectangle_t *const rect1, const stRec
 char *rectangle_to_string(const stRectangle_t *const rect, char *buff) {
     sprintf(buff, "(x,y): (%u,%u)\n"
                   "(w,h): (%u,%u)\n"
-                  "Area: %lu", 
+                  "Area: %" PRIu32, 
                   rect->x, rect->y, rect->width, rect->height, 
                   rectangle_get_area(rect));
     return buff;
 }
 
+#if IT8951_TRACE_LENGTH > 0
+static inline uint32_t trace_time_us(const stIT8951_Handler_t *hdlr) {
+    return hdlr->get_time_us ? hdlr->get_time_us() : 0;
+}
+
+/// @brief Gets the open transaction of the trace
+/// @return The last entry, or NULL if no command was sent since the reset
+static inline stIT8951_TraceEntry_t *trace_current(stIT8951_Handler_t *hdlr) {
+    const uint32_t total = hdlr->trace.total;
+    return total ? &hdlr->trace.entries[(total-1) % IT8951_TRACE_LENGTH] : NULL;
+}
+
+/// @brief Opens a new transaction in the trace, overwriting the oldest entry 
+/// if the ring is full
+static inline void trace_begin(stIT8951_Handler_t *hdlr, const eIT8951_Command_t cmd) {
+    hdlr->trace.entries[hdlr->trace.total % IT8951_TRACE_LENGTH] = (stIT8951_TraceEntry_t){
+        .start_us = trace_time_us(hdlr),
+        .command  = cmd,
+    };
+    hdlr->trace.total++;
+}
+
+static inline void trace_args(stIT8951_Handler_t *hdlr, const uint16_t *const data, const int32_t count) {
+    stIT8951_TraceEntry_t *const entry = trace_current(hdlr);
+    if(entry && count > 0) {
+        entry->arg0 = entry->arg_count ? entry->arg0 : data[0];
+        entry->arg_count = (entry->arg_count + count > UINT16_MAX) ? UINT16_MAX : entry->arg_count + count;
+    }
+}
+
+/// @brief Adds a transfer or an HRDY wait that started at start_us to the 
+/// open transaction
+static inline void trace_xfer(stIT8951_Handler_t *hdlr, const uint32_t start_us, const size_t bytes, 
+                              const bool is_hrdy, const bool status) {
+    stIT8951_TraceEntry_t *const entry = trace_current(hdlr);
+    if(entry) {
+        const uint32_t elapsed = trace_time_us(hdlr) - start_us;
+        entry->duration_us += elapsed;
+        entry->hrdy_wait_us += is_hrdy ? elapsed : 0;
+        entry->bytes += bytes;
+        entry->failed |= !status;
+    }
+}
+#else
+static inline uint32_t trace_time_us(const stIT8951_Handler_t *hdlr) { return 0; }
+static inline void trace_begin(stIT8951_Handler_t *hdlr, const eIT8951_Command_t cmd) {}
+static inline void trace_args(stIT8951_Handler_t *hdlr, const uint16_t *const data, const int32_t count) {}
+static inline void trace_xfer(stIT8951_Handler_t *hdlr, const uint32_t start_us, const size_t bytes, 
+                              const bool is_hrdy, const bool status) {}
+#endif
+
+// Wrappers of the handler's callbacks, recording the transfers in the trace
+static inline void wait_hrdy(stIT8951_Handler_t *hdlr) {
+    const uint32_t start = trace_time_us(hdlr);
+    hdlr->wait_hrdy();
+    trace_xfer(hdlr, start, 0, true, true);
+}
+
+static inline bool spi_transcieve(stIT8951_Handler_t *hdlr, const void *txdata, void *rxdata, const size_t len) {
+    const uint32_t start = trace_time_us(hdlr);
+    const bool status = hdlr->spi_transcieve(txdata, rxdata, len);
+    trace_xfer(hdlr, start, len, false, status);
+    return status;
+}
+
+static inline bool spi_transmit_async(stIT8951_Handler_t *hdlr, const void *txdata, const size_t len) {
+    const uint32_t start = trace_time_us(hdlr);
+    const bool status = hdlr->spi_transmit_async(txdata, len);
+    trace_xfer(hdlr, start, len, false, status);
+    return status;
+}
+
+static inline bool spi_wait_async(stIT8951_Handler_t *hdlr) {
+    const uint32_t start = trace_time_us(hdlr);
+    const bool status = hdlr->spi_wait_async();
+    trace_xfer(hdlr, start, 0, false, status);
+    return status;
+}
+
+/// @brief Sends the preamble, then all the data words in a single SPI 
+/// transaction, under one nCS assertion. Per the SPI timing of the IT8951 
+/// datasheet, the host waits for the HRDY before it starts the packet, and 
+/// again between the preamble and the first data word, while the IT8951 
+/// decodes the preamble. The burst of data words relies on the IT8951's SPI
+/// FIFO, like the pixel data of @ref write_bytes.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param preamble Preamble of the packet
+/// @param data Words to send after the preamble
+/// @param count Number of words in data. Must be < IT8951_MAX_FRAME_WORDS
+/// @return True if the SPI transaction succeeded, false otherwise
+static bool send_frame(stIT8951_Handler_t *hdlr, const eIT8951_SpiPreamble_t preamble, const uint16_t *const data, const int32_t count) {
+    assert(count < IT8951_MAX_FRAME_WORDS);
+
+    const uint16_t header = __builtin_bswap16(preamble);
+    uint16_t frame[IT8951_MAX_FRAME_WORDS];
+    for(int32_t i=0; i<count; i++) {
+        frame[i] = __builtin_bswap16(data[i]);
+    }
+
+    wait_hrdy(hdlr);
+    hdlr->set_ncs(0);
+    bool status = spi_transcieve(hdlr, &header, NULL, sizeof(header));
+    if(status) {
+        wait_hrdy(hdlr);
+        status = spi_transcieve(hdlr, frame, NULL, count*sizeof(*frame));
+    }
+    hdlr->set_ncs(1);
+    return status;
+}
+
+/// @brief Waits for the asynchronous transfer in flight (if any) to complete 
+/// and releases the nCS line it held. Must precede any new SPI packet.
+/// @param hdlr Pointer to the IT8951 handler
+/// @return True if the SPI transaction succeeded, false otherwise
+static bool finish_pending_xfer(stIT8951_Handler_t *hdlr) {
+    if(!hdlr->xfer_pending) {
+        return true;
+    }
+    hdlr->xfer_pending = false;
+    const bool status = spi_wait_async(hdlr);
+    hdlr->set_ncs(1);
+    return status;
+}
+
 static bool send_with_preamble(stIT8951_Handler_t *hdlr, const eIT8951_SpiPreamble_t preamble, const uint16_t *const data, const int32_t count) {
     assert(hdlr);
     assert(IsEnum_IT8951_SpiPreamble(preamble));
+    assert(IsEnum_IT8951_Transport(hdlr->transport));
 
-    bool status = true;
+    bool status = finish_pending_xfer(hdlr);
 
-    if(count == 0) {
-        return true;
+    if(count == 0 || !status) {
+        return status;
     }
     assert(data);
 
-    hdlr->wait_hrdy();
+    if(hdlr->transport == IT8951_TRANSPORT_FRAMED && count < IT8951_MAX_FRAME_WORDS) {
+        return send_frame(hdlr, preamble, data, count);
+    }
+
+    wait_hrdy(hdlr);
     hdlr->set_ncs(0);
     // Loop from -1 to send the preamble, without requiring new arr allocation
     for(int32_t i=-1; (i<count) && status; i++) {
         const uint16_t txdata = (i >= 0) ? data[i] : preamble;
-        status = hdlr->spi_transcieve((uint16_t[]){__builtin_bswap16(txdata)}, NULL, sizeof(uint16_t));
-        hdlr->wait_hrdy();
+        status = spi_transcieve(hdlr, (uint16_t[]){__builtin_bswap16(txdata)}, NULL, sizeof(uint16_t));
+        wait_hrdy(hdlr);
     }
     // Ensure that the nCS is set back to the inactive state, whatever happens
     hdlr->set_ncs(1);
@@ -129,6 +284,20 @@ static bool send_with_preamble(stIT8951_Handler_t *hdlr, const eIT8951_SpiPreamb
 /// @return True if the SPI transaction succeeded, false otherwise
 STATIC INLINE bool send_command(stIT8951_Handler_t *hdlr, const eIT8951_Command_t cmd) {
     assert(IsEnum_eIT8951_Command(cmd));
+    // The transfer still in flight belongs to the previous transaction
+    if(!finish_pending_xfer(hdlr))
+        return false;
+    // Any new command implicitly terminates an image load left open by an
+    // asynchronous pixel transfer
+    if(hdlr->img_load_open) {
+        hdlr->img_load_open = false;
+        if(cmd != IT8951_COMMAND_LD_IMG_END) {
+            trace_begin(hdlr, IT8951_COMMAND_LD_IMG_END);
+            if(!send_with_preamble(hdlr, IT8951_SPI_PREAMBLE_COMMAND, (uint16_t[]){IT8951_COMMAND_LD_IMG_END}, 1))
+                return false;
+        }
+    }
+    trace_begin(hdlr, cmd);
     return send_with_preamble(hdlr, IT8951_SPI_PREAMBLE_COMMAND, (uint16_t[]){cmd}, 1);
 }
 
@@ -138,6 +307,7 @@ STATIC INLINE bool send_command(stIT8951_Handler_t *hdlr, const eIT8951_Command_
 /// @param count Number of elements to write
 /// @return True if the SPI transaction succeeded, false otherwise
 STATIC INLINE bool write_data(stIT8951_Handler_t *hdlr, const uint16_t *const data, const int32_t count) {
+    trace_args(hdlr, data, count);
     return send_with_preamble(hdlr, IT8951_SPI_PREAMBLE_WRITE_DATA, data, count);
 }
 
@@ -152,20 +322,63 @@ STATIC INLINE bool write_bytes(stIT8951_Handler_t *hdlr, const uint8_t *const da
 
     const uint16_t preamble = __builtin_bswap16(IT8951_SPI_PREAMBLE_WRITE_DATA);
 
-    hdlr->wait_hrdy();
+    if(!finish_pending_xfer(hdlr))
+        return false;
+
+    wait_hrdy(hdlr);
     hdlr->set_ncs(0);
-    bool status = hdlr->spi_transcieve(&preamble, NULL, sizeof(preamble));
+    bool status = spi_transcieve(hdlr, &preamble, NULL, sizeof(preamble));
     if(!status)
         goto Terminate;
 
-    hdlr->wait_hrdy();
-    status = hdlr->spi_transcieve(data, NULL, count);
+    wait_hrdy(hdlr);
+    status = spi_transcieve(hdlr, data, NULL, count);
 
 Terminate:
     hdlr->set_ncs(1);
     return status;
 }
 
+/// @brief Non-blocking variant of @ref write_bytes. The preamble is sent 
+/// synchronously, then the data is queued and the nCS is left asserted until 
+/// the transfer is completed by the next packet or @ref it8951_wait_async.
+/// Falls back to @ref write_bytes if the handler has no asynchronous transport
+/// @param hdlr Pointer to the IT8951 handler
+/// @param data Pre-formatted data bytes. Must stay valid until the transfer is 
+/// completed
+/// @param count Number of bytes to write
+/// @return True if the SPI transaction succeeded, false otherwise
+STATIC bool write_bytes_async(stIT8951_Handler_t *hdlr, const uint8_t *const data, const int32_t count) {
+    assert(hdlr && data);
+
+    if(!hdlr->spi_transmit_async) {
+        return write_bytes(hdlr, data, count);
+    }
+    assert(hdlr->spi_wait_async);
+
+    const uint16_t preamble = __builtin_bswap16(IT8951_SPI_PREAMBLE_WRITE_DATA);
+
+    if(!finish_pending_xfer(hdlr))
+        return false;
+
+    wait_hrdy(hdlr);
+    hdlr->set_ncs(0);
+    if(!spi_transcieve(hdlr, &preamble, NULL, sizeof(preamble))) {
+        hdlr->set_ncs(1);
+        return false;
+    }
+
+    wait_hrdy(hdlr);
+    hdlr->xfer_pending = true;
+    if(!spi_transmit_async(hdlr, data, count)) {
+        // Even if the queueing failed half-way, the already queued transfers
+        // must be waited for before the nCS can be released
+        finish_pending_xfer(hdlr);
+        return false;
+    }
+    return true;
+}
+
 /// @brief Sends a command with arguments
 /// @return True if the SPI transaction succeeded, false otherwise
 /// @param hdlr Pointer to the IT8951 handler
@@ -194,17 +407,79 @@ STATIC bool read_data(stIT8951_Handler_t *hdlr, uint16_t *const data, const int3
     }
     assert(data);
 
-    hdlr->wait_hrdy();
+    if(!finish_pending_xfer(hdlr))
+        return false;
+
+    // Same timing as the words of the word transport: the HRDY is waited for
+    // before the preamble, before the dummy word and before the data, which
+    // the IT8951 only clocks out once it has it ready.
+    if(hdlr->transport == IT8951_TRANSPORT_FRAMED && count+2 <= IT8951_MAX_FRAME_WORDS) {
+        const uint16_t header[] = {__builtin_bswap16(IT8951_SPI_PREAMBLE_READ_DATA), 0};
+        const uint16_t txframe[IT8951_MAX_FRAME_WORDS] = {0};
+        uint16_t rxframe[IT8951_MAX_FRAME_WORDS];
+
+        wait_hrdy(hdlr);
+        hdlr->set_ncs(0);
+        status = spi_transcieve(hdlr, &header[0], NULL, sizeof(*header));
+        if(status) {
+            wait_hrdy(hdlr);
+            status = spi_transcieve(hdlr, &header[1], NULL, sizeof(*header));
+        }
+        if(status) {
+            wait_hrdy(hdlr);
+            status = spi_transcieve(hdlr, txframe, rxframe, count*sizeof(*txframe));
+        }
+        hdlr->set_ncs(1);
+        for(int32_t i=0; i<count && status; i++) {
+            data[i] = __builtin_bswap16(rxframe[i]);
+        }
+        return status;
+    }
+
+    wait_hrdy(hdlr);
     hdlr->set_ncs(0);
     for(int32_t i=-2; (i<count) && status; i++) {
         const uint16_t txdata = (i > -2) ? 0 : __builtin_bswap16(IT8951_SPI_PREAMBLE_READ_DATA);
         uint16_t rxdata;
-        status = hdlr->spi_transcieve(&txdata, &rxdata, sizeof(uint16_t));
+        status = spi_transcieve(hdlr, &txdata, &rxdata, sizeof(uint16_t));
         // The first 2xuint16_t words are discarded (preamble reply and dummy word)
         if(i >= 0) {
             data[i] = __builtin_bswap16(rxdata);
         }
-        hdlr->wait_hrdy();
+        wait_hrdy(hdlr);
+    }
+    hdlr->set_ncs(1);
+    return status;
+}
+
+/// @brief Bulk variant of @ref read_data for non-register data, where the
+/// monitoring of the HRDY pin between the data words is irrelevant. The 
+/// preamble and the dummy word are clocked out first, each after the HRDY, 
+/// then the data in one transfer.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param data Output buffer. Receives the words as clocked in, i.e. 
+/// big-endian
+/// @param count Number of bytes to read. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+STATIC bool read_bytes(stIT8951_Handler_t *hdlr, uint8_t *const data, const int32_t count) {
+    assert(hdlr && data);
+    assert((count % sizeof(uint16_t)) == 0);
+
+    const uint16_t header[] = {__builtin_bswap16(IT8951_SPI_PREAMBLE_READ_DATA), 0};
+
+    if(!finish_pending_xfer(hdlr))
+        return false;
+
+    wait_hrdy(hdlr);
+    hdlr->set_ncs(0);
+    bool status = spi_transcieve(hdlr, &header[0], NULL, sizeof(*header));
+    if(status) {
+        wait_hrdy(hdlr);
+        status = spi_transcieve(hdlr, &header[1], NULL, sizeof(*header));
+    }
+    if(status) {
+        wait_hrdy(hdlr);
+        status = spi_transcieve(hdlr, NULL, data, count);
     }
     hdlr->set_ncs(1);
     return status;
@@ -231,35 +506,71 @@ static inline bool read_reg(stIT8951_Handler_t *hdlr, const eIT8951_Register_t r
            read_data(hdlr, val, 1);
 }
 
-/// @brief Waits for the LuT engine to finish
+/// @brief Gets the panel area as seen by an image load with the given 
+/// rotation. The width and the height are swapped for 90 and 270 degrees.
 /// @param hdlr Pointer to the IT8951 handler
-/// @return True if the SPI transaction succeeded, false otherwise
-static bool wait_for_display_ready(stIT8951_Handler_t *hdlr) {
-    uint16_t status = USHRT_MAX;
-    bool ret = false;
-
-    do {
-        ret = read_reg(hdlr, IT8951_REGISTER_LUTAFSR, &status);
-    } while(ret && (status != 0));
+/// @param rotation Rotation of the image load
+/// @return Area the rectangles of the image loads must be contained within
+stRectangle_t it8951_get_image_area(const stIT8951_Handler_t *hdlr, const eIT8951_RotationMode_t rotation) {
+    assert(hdlr && IsEnum_IT8951_RotationMode(rotation));
+    const bool is_swapped = (rotation == IT8951_ROTATION_MODE_90 || rotation == IT8951_ROTATION_MODE_270);
+    return (stRectangle_t){
+        .x      = 0,
+        .y      = 0,
+        .width  = is_swapped ? hdlr->panel_area.height : hdlr->panel_area.width,
+        .height = is_swapped ? hdlr->panel_area.width  : hdlr->panel_area.height,
+    };
+}
 
-    return ret;
+/// @brief Maps a rectangle of an image loaded with the given rotation onto the
+/// panel, e.g. for the display update of the loaded area. The rotations are 
+/// clockwise, the image's top-left corner lands at the panel's top-right 
+/// corner at 90 degrees.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param rotation Rotation of the image load
+/// @param rect Rectangle within it8951_get_image_area()
+/// @return The rectangle in panel coordinates
+stRectangle_t it8951_rotate_rect(const stIT8951_Handler_t *hdlr, const eIT8951_RotationMode_t rotation, const stRectangle_t *const rect) {
+    assert(hdlr && rect && IsEnum_IT8951_RotationMode(rotation));
+    const uint16_t panel_w = hdlr->panel_area.width;
+    const uint16_t panel_h = hdlr->panel_area.height;
+    switch(rotation) {
+    case IT8951_ROTATION_MODE_90:
+        return (stRectangle_t){panel_w - (rect->y + rect->height), rect->x, rect->height, rect->width};
+    case IT8951_ROTATION_MODE_180:
+        return (stRectangle_t){panel_w - (rect->x + rect->width), panel_h - (rect->y + rect->height), rect->width, rect->height};
+    case IT8951_ROTATION_MODE_270:
+        return (stRectangle_t){rect->y, panel_h - (rect->x + rect->width), rect->height, rect->width};
+    default:
+        return *rect;
+    }
 }
 
 static bool load_img_area_start(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect) {
     assert(img_info && rect);
 
-    if(!rectangle_is_contained_within(rect, &hdlr->panel_area)){
-        char buff[2][53];
-        printf("Rectangle \n%s\n is not within the panel area %s\n", 
+    // The IT8951 takes the rectangle in the rotated image's coordinates
+    const stRectangle_t image_area = it8951_get_image_area(hdlr, img_info->rotation);
+    if(!rectangle_is_contained_within(rect, &image_area)){
+        char buff[2][64];
+        printf("Rectangle \n%s\n is not within the image area %s\n", 
                rectangle_to_string(rect, buff[0]), 
-               rectangle_to_string(&hdlr->panel_area, buff[1]));
+               rectangle_to_string(&image_area, buff[1]));
         return false;
     }
+    // The 2bpp loads need the IT8951 to be switched to the 2bpp mode, and the
+    // other depths need it to be switched back
+    const bool is_2bpp = img_info->bpp == IT8951_COLOR_DEPTH_BPP_2BIT;
+    if(is_2bpp != hdlr->is_2bpp_mode && !it8951_set_bpp_mode(hdlr, is_2bpp))
+        return false;
+
     const uint16_t args[] = {*(uint16_t*)img_info, rect->x, rect->y, rect->width, rect->height};
-    return send_command_args(hdlr, IT8951_COMMAND_LD_IMG_AREA, args, ARRAY_LENGTH(args));
+    hdlr->img_load_open = send_command_args(hdlr, IT8951_COMMAND_LD_IMG_AREA, args, ARRAY_LENGTH(args));
+    return hdlr->img_load_open;
 }
 
 static inline bool load_img_end(stIT8951_Handler_t *hdlr) {
+    // send_command clears the img_load_open flag
     return send_command(hdlr, IT8951_COMMAND_LD_IMG_END);
 }
 
@@ -316,10 +627,13 @@ bool it8951_get_device_info(stIT8951_Handler_t *hdlr, stIT8951_DeviceInfo_t *con
     return status;
 }
 
-bool it8951_display_area(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode) {
-    const uint16_t args[] = {rect->x, rect->y, rect->width, rect->height, display_mode};
-    return wait_for_display_ready(hdlr) && 
-           send_command_args(hdlr, IT8951_COMMAND_DPY_AREA, args, ARRAY_LENGTH(args));
+/// @brief Sends FILL_RECT, which writes the colour into the default image 
+/// buffer and refreshes the area
+static bool send_fill_rect(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t mode, const uint8_t colour) {
+    // Refresh EPD and change image buffer content with the assigned colour
+    const uint16_t arg4 = 0x1100 | mode;
+    const uint16_t args[] = {rect->x, rect->y, rect->width, rect->height, arg4, colour};
+    return send_command_args(hdlr, IT8951_COMMAND_FILL_RECT, args, ARRAY_LENGTH(args));
 }
 
 /// @brief Fills the specified rectangle with a uniform color. 
@@ -334,14 +648,11 @@ bool it8951_fill_rect(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect,
 
     if(!rectangle_is_contained_within(rect, &hdlr->panel_area)){
         printf("Rectangle \n%s\n is not within the panel area %s\n", 
-               rectangle_to_string(rect, (char[53]){0}), 
-               rectangle_to_string(&hdlr->panel_area, (char[53]){0}));
+               rectangle_to_string(rect, (char[64]){0}), 
+               rectangle_to_string(&hdlr->panel_area, (char[64]){0}));
         return false;
     }
-    // Refresh EPD and change image buffer content with the assigned colour
-    const uint16_t arg4 = 0x1100 | mode;
-    const uint16_t args[] = {rect->x, rect->y, rect->width, rect->height, arg4, colour};
-    return send_command_args(hdlr, IT8951_COMMAND_FILL_RECT, args, ARRAY_LENGTH(args));
+    return send_fill_rect(hdlr, rect, mode, colour);
 }
 
 /// @brief Fixes the IT8951's temperature sensor reading to the specified value
@@ -376,7 +687,474 @@ bool it8951_cancel_force_temperature(stIT8951_Handler_t *hdlr) {
 /// @param is_2bpp True for 2bpp, false for all other
 /// @return True if the SPI transaction succeeded, false otherwise
 bool it8951_set_bpp_mode(stIT8951_Handler_t *hdlr, bool is_2bpp) {
-    return send_command_args(hdlr, IT8951_COMMAND_BPP_SETTINGS, (uint16_t[]){is_2bpp}, 1);
+    if(!send_command_args(hdlr, IT8951_COMMAND_BPP_SETTINGS, (uint16_t[]){is_2bpp}, 1))
+        return false;
+    hdlr->is_2bpp_mode = is_2bpp;
+    return true;
+}
+
+static inline uint32_t get_time_ms(const stIT8951_Handler_t *hdlr) {
+    return hdlr->get_time_ms ? hdlr->get_time_ms() : 0;
+}
+
+/// @brief Wrap-around safe check whether time a is at or after time b [ms]
+static inline bool time_reached(const uint32_t a, const uint32_t b) {
+    return (int32_t)(a - b) >= 0;
+}
+
+/// @brief Estimates how long the waveform of the given display mode runs for
+/// at the current panel temperature. The temperature is re-read from the 
+/// IT8951 every IT8951_TEMPERATURE_REFRESH_MS.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param mode Display mode of the update
+/// @return Estimated duration of the update in ms
+uint32_t it8951_update_estimate_duration(stIT8951_Handler_t *hdlr, eIT8951_DisplayMode_t mode) {
+    assert(IsEnum_IT8951_DisplayMode(mode));
+    stIT8951_UpdateScheduler_t *const sched = &hdlr->scheduler;
+
+    const uint32_t now = get_time_ms(hdlr);
+    if(!sched->temperature_valid || 
+       time_reached(now, sched->temperature_ms + IT8951_TEMPERATURE_REFRESH_MS)) {
+        uint16_t temp[2];
+        if(it8951_get_temperature(hdlr, temp)) {
+            sched->temperature = (int16_t)temp[0];
+            sched->temperature_ms = now;
+            sched->temperature_valid = true;
+        }
+    }
+
+    uint32_t duration = IT8951_DISPLAY_MODE_DURATION_MS_MAP[mode];
+    if(sched->temperature_valid && sched->temperature < IT8951_NOMINAL_TEMPERATURE_C) {
+        const uint32_t extra = (IT8951_NOMINAL_TEMPERATURE_C - sched->temperature)*IT8951_DURATION_PERCENT_PER_C;
+        duration += (duration*extra)/100;
+    }
+    return duration;
+}
+
+/// @brief Checks if a queued update may be launched on the LUT engines
+/// @param sched Pointer to the update scheduler
+/// @param upd Update to launch
+/// @return True if DPY_AREA can be sent for the update
+static bool can_launch_update(const stIT8951_UpdateScheduler_t *const sched, const stIT8951_Update_t *const upd) {
+    // All the LUT engines are driving a waveform
+    if(__builtin_popcount(sched->busy_luts) >= IT8951_LUT_ENGINE_COUNT) {
+        return false;
+    }
+    // The 1bpp mode is global, so a 1bpp update runs alone
+    for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+        const stIT8951_Update_t *const other = &sched->updates[i];
+        if(other->state == IT8951_UPDATE_STATE_RUNNING && (upd->is_1bpp || other->is_1bpp)) {
+            return false;
+        }
+    }
+    // Non-overlapping areas run on independent LUT engines. An update only 
+    // waits for the running updates it intersects, and must not overtake an 
+    // older queued update of the same area
+    for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+        const stIT8951_Update_t *const other = &sched->updates[i];
+        const bool is_older_queued = other->state == IT8951_UPDATE_STATE_QUEUED && 
+                                     (int32_t)(other->id - upd->id) < 0;
+        if((other->state == IT8951_UPDATE_STATE_RUNNING || is_older_queued) &&
+           rectangle_intersects(&other->rect, &upd->rect)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Picks the waveform that renders the content of both merged updates
+/// @param mode1 Display mode of the first update
+/// @param mode2 Display mode of the second update
+/// @return Display mode of the merged update
+static eIT8951_DisplayMode_t merge_display_modes(const eIT8951_DisplayMode_t mode1, const eIT8951_DisplayMode_t mode2) {
+    const uint32_t rank1 = IT8951_DISPLAY_MODE_RANK_MAP[mode1];
+    const uint32_t rank2 = IT8951_DISPLAY_MODE_RANK_MAP[mode2];
+    if(rank1 == rank2 && mode1 != mode2) {
+        // E.g. GL16 vs GLR16: only GC16 is a superset of both
+        return IT8951_DISPLAY_MODE_GC16;
+    }
+    return (rank1 >= rank2) ? mode1 : mode2;
+}
+
+/// @brief Enables or disables the 1bpp mode of the display updates
+/// @param hdlr Pointer to the IT8951 handler
+/// @param enable True to enable the 1bpp mode
+/// @return True if the SPI transactions succeeded, false otherwise
+static bool set_1bpp_mode(stIT8951_Handler_t *hdlr, const bool enable) {
+    uint16_t val;
+    if(!read_reg(hdlr, IT8951_REGISTER_UP1SR_H, &val))
+        return false;
+    val = enable ? (val | IT8951_UP1SR_H_1BPP_ENABLE) : (val & ~IT8951_UP1SR_H_1BPP_ENABLE);
+    return write_reg(hdlr, IT8951_REGISTER_UP1SR_H, val);
+}
+
+/// @brief Sends DPY_AREA (or FILL_RECT) for the update and records the LUT 
+/// engines it got
+/// @param hdlr Pointer to the IT8951 handler
+/// @param upd Update to launch
+/// @return True if the SPI transaction succeeded, false otherwise
+static bool launch_update(stIT8951_Handler_t *hdlr, stIT8951_Update_t *const upd) {
+    stIT8951_UpdateScheduler_t *const sched = &hdlr->scheduler;
+
+    upd->duration_ms = it8951_update_estimate_duration(hdlr, upd->mode);
+    // DPY_BUF_AREA takes the frame buffer's address as 2 additional arguments
+    const uint32_t addr = hdlr->frame_buffers.addr[upd->buff];
+    const uint16_t args[] = {upd->rect.x, upd->rect.y, upd->rect.width, upd->rect.height, upd->mode,
+                             (uint16_t)addr, (uint16_t)(addr >> 16)};
+    const bool is_default_buff = upd->buff == IT8951_FRAME_BUFFER_DEFAULT;
+    if(upd->is_1bpp) {
+        // can_launch_update() ensures that no other update is running
+        if(!write_reg(hdlr, IT8951_REGISTER_BGVR, upd->bgvr) || !set_1bpp_mode(hdlr, true))
+            return false;
+        sched->is_1bpp_running = true;
+    }
+    if(upd->is_fill) {
+        if(!send_fill_rect(hdlr, &upd->rect, upd->mode, upd->colour))
+            return false;
+    } else if(!send_command_args(hdlr, is_default_buff ? IT8951_COMMAND_DPY_AREA : IT8951_COMMAND_DPY_BUF_AREA, 
+                                 args, is_default_buff ? 5 : ARRAY_LENGTH(args))) {
+        return false;
+    }
+
+    upd->state = IT8951_UPDATE_STATE_RUNNING;
+    upd->start_ms = get_time_ms(hdlr);
+
+    // The engines that became busy are the ones the IT8951 allocated
+    const uint16_t busy_before = sched->busy_luts;
+    if(!read_reg(hdlr, IT8951_REGISTER_LUTAFSR, &sched->busy_luts))
+        return false;
+    upd->lut_mask = sched->busy_luts & ~busy_before;
+    return true;
+}
+
+/// @brief Non-blocking step of the display update scheduler. Retires the 
+/// updates whose LUT engines went idle and launches the queued ones that can 
+/// run. The LUTAFSR register is not read before the running updates are 
+/// expected to finish, then only every IT8951_UPDATE_POLL_INTERVAL_MS.
+/// @param hdlr Pointer to the IT8951 handler
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_update_poll(stIT8951_Handler_t *hdlr) {
+    assert(hdlr);
+    stIT8951_UpdateScheduler_t *const sched = &hdlr->scheduler;
+
+    bool has_running = false, has_queued = false;
+    for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+        has_running |= sched->updates[i].state == IT8951_UPDATE_STATE_RUNNING;
+        has_queued  |= sched->updates[i].state == IT8951_UPDATE_STATE_QUEUED;
+    }
+    const uint32_t now = get_time_ms(hdlr);
+    if(!(has_running || has_queued) ||
+       (has_running && hdlr->get_time_ms && !time_reached(now, sched->next_poll_ms))) {
+        return true;
+    }
+
+    if(!read_reg(hdlr, IT8951_REGISTER_LUTAFSR, &sched->busy_luts))
+        return false;
+
+    // Retire the finished updates. If the engines of an update could not be 
+    // told apart, it is done once no engine of unknown owner is busy
+    uint16_t known_luts = 0;
+    for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+        if(sched->updates[i].state == IT8951_UPDATE_STATE_RUNNING) {
+            known_luts |= sched->updates[i].lut_mask;
+        }
+    }
+    for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+        stIT8951_Update_t *const upd = &sched->updates[i];
+        if(upd->state != IT8951_UPDATE_STATE_RUNNING) 
+            continue;
+        const uint16_t mask = upd->lut_mask ? upd->lut_mask : (uint16_t)~known_luts;
+        if((sched->busy_luts & mask) == 0) {
+            upd->state = IT8951_UPDATE_STATE_FREE;
+            // The old front buffer is on the panel until the flip is done
+            if(upd->is_flip)
+                hdlr->frame_buffers.front = upd->buff;
+        }
+    }
+
+    // The 1bpp mode must not leak into the next updates
+    if(sched->is_1bpp_running) {
+        bool is_1bpp_running = false;
+        for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+            is_1bpp_running |= sched->updates[i].state == IT8951_UPDATE_STATE_RUNNING && 
+                               sched->updates[i].is_1bpp;
+        }
+        if(!is_1bpp_running) {
+            if(!set_1bpp_mode(hdlr, false))
+                return false;
+            sched->is_1bpp_running = false;
+        }
+    }
+
+    // Launch the queued updates in submission order
+    while(true) {
+        stIT8951_Update_t *oldest = NULL;
+        for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+            stIT8951_Update_t *const upd = &sched->updates[i];
+            if(upd->state == IT8951_UPDATE_STATE_QUEUED && 
+               (!oldest || (int32_t)(upd->id - oldest->id) < 0)) {
+                oldest = upd;
+            }
+        }
+        if(!oldest || !can_launch_update(sched, oldest))
+            break;
+        if(!launch_update(hdlr, oldest))
+            return false;
+    }
+
+    // Sleep until the first running waveform is expected to end, then poll at
+    // a steady rate
+    const uint32_t min_next_poll = now + IT8951_UPDATE_POLL_INTERVAL_MS;
+    bool first = true;
+    for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+        const stIT8951_Update_t *const upd = &sched->updates[i];
+        if(upd->state == IT8951_UPDATE_STATE_RUNNING) {
+            const uint32_t expected_end = upd->start_ms + upd->duration_ms;
+            if(first || !time_reached(expected_end, sched->next_poll_ms))
+                sched->next_poll_ms = expected_end;
+            first = false;
+        }
+    }
+    if(first || !time_reached(sched->next_poll_ms, min_next_poll))
+        sched->next_poll_ms = min_next_poll;
+    return true;
+}
+
+/// @brief Checks whether the display update with the given id is complete
+/// @param hdlr Pointer to the IT8951 handler
+/// @param id Id returned by @ref it8951_display_area_async
+/// @return True if the update is no longer queued or running
+bool it8951_update_is_done(const stIT8951_Handler_t *hdlr, const uint32_t id) {
+    assert(hdlr);
+    for(uint32_t i=0; i<ARRAY_LENGTH(hdlr->scheduler.updates); i++) {
+        const stIT8951_Update_t *const upd = &hdlr->scheduler.updates[i];
+        if(upd->state != IT8951_UPDATE_STATE_FREE && upd->id == id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Blocks until the display update with the given id is complete. The
+/// CPU is yielded through the handler's sleep_ms between the polls.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param id Id returned by @ref it8951_display_area_async
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_update_wait(stIT8951_Handler_t *hdlr, const uint32_t id) {
+    assert(hdlr);
+    while(!it8951_update_is_done(hdlr, id)) {
+        if(!it8951_update_poll(hdlr))
+            return false;
+        if(it8951_update_is_done(hdlr, id))
+            break;
+        if(hdlr->sleep_ms && hdlr->get_time_ms) {
+            const int32_t remaining = (int32_t)(hdlr->scheduler.next_poll_ms - hdlr->get_time_ms());
+            hdlr->sleep_ms(remaining > 0 ? remaining : 1);
+        }
+    }
+    return true;
+}
+
+/// @brief Checks whether the display update with the given id was launched 
+/// on the LUT engines
+/// @param hdlr Pointer to the IT8951 handler
+/// @param id Id returned by @ref it8951_display_area_async
+/// @return True if the update is no longer queued
+bool it8951_update_is_launched(const stIT8951_Handler_t *hdlr, const uint32_t id) {
+    assert(hdlr);
+    for(uint32_t i=0; i<ARRAY_LENGTH(hdlr->scheduler.updates); i++) {
+        const stIT8951_Update_t *const upd = &hdlr->scheduler.updates[i];
+        if(upd->state == IT8951_UPDATE_STATE_QUEUED && upd->id == id) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Blocks until the display update with the given id is launched. See
+/// @ref it8951_fill_rect_async
+/// @param hdlr Pointer to the IT8951 handler
+/// @param id Id returned by @ref it8951_display_area_async
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_update_wait_launched(stIT8951_Handler_t *hdlr, const uint32_t id) {
+    assert(hdlr);
+    while(!it8951_update_is_launched(hdlr, id)) {
+        if(!it8951_update_poll(hdlr))
+            return false;
+        if(it8951_update_is_launched(hdlr, id))
+            break;
+        if(hdlr->sleep_ms && hdlr->get_time_ms) {
+            const int32_t remaining = (int32_t)(hdlr->scheduler.next_poll_ms - hdlr->get_time_ms());
+            hdlr->sleep_ms(remaining > 0 ? remaining : 1);
+        }
+    }
+    return true;
+}
+
+/// @brief Checks whether a queued display update of the frame buffer would be 
+/// merged with a new one of the area, see queue_update()
+static inline bool is_mergeable(const stIT8951_Update_t *const upd, const uint32_t buff, const stRectangle_t *const area) {
+    return upd->state == IT8951_UPDATE_STATE_QUEUED && upd->buff == buff && !upd->is_1bpp && 
+           !upd->is_fill && rectangle_intersects(&upd->rect, area);
+}
+
+/// @brief Gets the area a new display update of the frame buffer would 
+/// refresh, once merged with the queued updates it overlaps. All of this area
+/// of the frame buffer is displayed, not just the update's own
+/// @param hdlr Pointer to the IT8951 handler
+/// @param buff Index of the frame buffer
+/// @param rect Area of the update
+/// @return The merged area, rect if it overlaps no queued update
+stRectangle_t it8951_update_merged_area(const stIT8951_Handler_t *hdlr, const uint32_t buff, const stRectangle_t *const rect) {
+    assert(hdlr && rect);
+    const stIT8951_UpdateScheduler_t *const sched = &hdlr->scheduler;
+    stRectangle_t area = *rect;
+    // Each merge grows the area, which may then overlap updates it did not
+    for(bool merged=true; merged;) {
+        merged = false;
+        for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+            const stIT8951_Update_t *const upd = &sched->updates[i];
+            if(is_mergeable(upd, buff, &area) && !rectangle_is_contained_within(&upd->rect, &area)) {
+                area = rectangle_union(&upd->rect, &area);
+                merged = true;
+            }
+        }
+    }
+    return area;
+}
+
+/// @brief Queues a display update of the area of the given frame buffer. See
+/// @ref it8951_display_area_async
+/// @param hdlr Pointer to the IT8951 handler
+/// @param req Update to queue. Its rect, mode, buff, is_1bpp, bgvr, is_fill
+/// and colour are used, the rest is filled in by the scheduler
+/// @param id [out] Optional. Completion handle of the update
+/// @return True if the SPI transactions succeeded, false otherwise
+static bool queue_update(stIT8951_Handler_t *hdlr, const stIT8951_Update_t *const req, uint32_t *const id) {
+    assert(hdlr && req);
+    assert(IsEnum_IT8951_DisplayMode(req->mode));
+    stIT8951_UpdateScheduler_t *const sched = &hdlr->scheduler;
+
+    // Overlapping updates that have not been launched yet are merged into one,
+    // as the image buffer already holds the content of both of them. The 
+    // merged update keeps the queue position of the oldest one. The 1bpp 
+    // areas hold different data than the rest of the buffer, and the fills 
+    // only write the buffer when launched, so these are never merged
+    stRectangle_t area = req->rect;
+    eIT8951_DisplayMode_t display_mode = req->mode;
+    uint32_t merged_id = IT8951_UPDATE_ID_INVALID;
+    bool is_flip = req->is_flip;
+    for(bool merged=!req->is_1bpp && !req->is_fill; merged;) {
+        merged = false;
+        for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates); i++) {
+            stIT8951_Update_t *const upd = &sched->updates[i];
+            if(is_mergeable(upd, req->buff, &area)) {
+                area = rectangle_union(&upd->rect, &area);
+                display_mode = merge_display_modes(upd->mode, display_mode);
+                is_flip |= upd->is_flip;
+                if(merged_id == IT8951_UPDATE_ID_INVALID || (int32_t)(upd->id - merged_id) < 0) {
+                    merged_id = upd->id;
+                }
+                upd->state = IT8951_UPDATE_STATE_FREE;
+                merged = true;
+            }
+        }
+    }
+
+    stIT8951_Update_t *slot = NULL;
+    while(!slot) {
+        stIT8951_Update_t *oldest = NULL;
+        for(uint32_t i=0; i<ARRAY_LENGTH(sched->updates) && !slot; i++) {
+            stIT8951_Update_t *const upd = &sched->updates[i];
+            if(upd->state == IT8951_UPDATE_STATE_FREE) {
+                slot = upd;
+            } else if(!oldest || (int32_t)(upd->id - oldest->id) < 0) {
+                oldest = upd;
+            }
+        }
+        if(!slot && !it8951_update_wait(hdlr, oldest->id))
+            return false;
+    }
+
+    if(merged_id == IT8951_UPDATE_ID_INVALID) {
+        if(++sched->next_id == IT8951_UPDATE_ID_INVALID)
+            ++sched->next_id;
+        merged_id = sched->next_id;
+    }
+    *slot = (stIT8951_Update_t){
+        .state   = IT8951_UPDATE_STATE_QUEUED,
+        .id      = merged_id,
+        .rect    = area,
+        .mode    = display_mode,
+        .buff    = req->buff,
+        .is_1bpp = req->is_1bpp,
+        .bgvr    = req->bgvr,
+        .is_fill = req->is_fill,
+        .colour  = req->colour,
+        .is_flip = is_flip,
+    };
+    if(id)
+        *id = slot->id;
+
+    // Launch straight away if the LUT engines allow
+    sched->next_poll_ms = get_time_ms(hdlr);
+    return it8951_update_poll(hdlr);
+}
+
+/// @brief Queues a display update of the area and returns without waiting for
+/// its waveform. The update is launched as soon as no running update overlaps
+/// it and a LUT engine is free, possibly from within this call. If it overlaps
+/// updates that are still queued, they are merged and share the same id.
+/// @ref it8951_update_poll must be called periodically to progress the queue.
+/// If the queue is full, this blocks until the oldest update is complete.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param rect Area to refresh. It must be within the display's area
+/// @param display_mode Waveform to use for the update
+/// @param id [out] Optional. Completion handle of the update
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_display_area_async(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode, uint32_t *const id) {
+    assert(rect);
+    return queue_update(hdlr, &(stIT8951_Update_t){
+        .rect = *rect, 
+        .mode = display_mode, 
+        .buff = IT8951_FRAME_BUFFER_DEFAULT
+    }, id);
+}
+
+/// @brief Displays the area and blocks until the waveform is complete
+/// @param hdlr Pointer to the IT8951 handler
+/// @param rect Area to refresh. It must be within the display's area
+/// @param display_mode Waveform to use for the update
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_display_area(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode) {
+    uint32_t id;
+    return it8951_display_area_async(hdlr, rect, display_mode, &id) &&
+           it8951_update_wait(hdlr, id);
+}
+
+/// @brief Queues a FILL_RECT through the update scheduler, so it shares the 
+/// LUT engines with the display updates like @ref it8951_display_area_async.
+/// The colour is written into the default image buffer only when the fill is
+/// launched, so an image load into an overlapping area must wait for that 
+/// with @ref it8951_update_wait_launched, or it would be overwritten.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param rect Area to fill and refresh. It must be within the display's area
+/// @param mode Waveform to use for the update
+/// @param colour 8bit gray level to fill the area with
+/// @param id [out] Optional. Completion handle of the update
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_fill_rect_async(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t mode, const uint8_t colour, uint32_t *const id) {
+    assert(hdlr && rect);
+    if(!rectangle_is_contained_within(rect, &hdlr->panel_area)) {
+        return false;
+    }
+    return queue_update(hdlr, &(stIT8951_Update_t){
+        .rect    = *rect,
+        .mode    = mode,
+        .buff    = IT8951_FRAME_BUFFER_DEFAULT,
+        .is_fill = true,
+        .colour  = colour,
+    }, id);
 }
 
 bool it8951_set_img_buff_base_address(stIT8951_Handler_t *hdlr, const uint32_t addr) {
@@ -388,6 +1166,214 @@ bool it8951_set_img_buff_base_address(stIT8951_Handler_t *hdlr, const uint32_t a
            write_reg(hdlr, IT8951_REGISTER_LISAR_H, addr_h);
 }
 
+/// @brief Allocates a frame buffer in the IT8951's SDRAM, after the ones 
+/// already allocated. The image can be loaded into it while another buffer is
+/// shown, then displayed with a single @ref it8951_frame_buffer_flip
+/// @param hdlr Pointer to the IT8951 handler. Must be initialised
+/// @param index [out] Index of the allocated frame buffer
+/// @return True if the buffer fits in the SDRAM, false otherwise
+bool it8951_frame_buffer_alloc(stIT8951_Handler_t *hdlr, uint32_t *const index) {
+    assert(hdlr && index);
+    stIT8951_FrameBuffers_t *const fb = &hdlr->frame_buffers;
+    assert(fb->count > 0);
+
+    // One byte per pixel, rounded up to whole 16bit words. The new buffer 
+    // starts after the last one and must end within the SDRAM
+    const uint32_t sdram_size = hdlr->sdram_size ? hdlr->sdram_size : IT8951_SDRAM_SIZE;
+    const uint32_t size = ((uint32_t)hdlr->panel_area.width*hdlr->panel_area.height + 1) & ~1ul;
+    const uint32_t last = fb->addr[fb->count-1];
+    if(fb->count >= IT8951_MAX_FRAME_BUFFERS || size == 0 || 
+       last >= sdram_size || sdram_size - last < 2*size) {
+        printf("No room for another %lu byte frame buffer in the %lu byte SDRAM\n", 
+               (unsigned long)size, (unsigned long)sdram_size);
+        return false;
+    }
+    const uint32_t addr = last + size;
+    fb->addr[fb->count] = addr;
+    *index = fb->count++;
+    return true;
+}
+
+/// @brief Selects the frame buffer the subsequent image loads are written to
+/// @param hdlr Pointer to the IT8951 handler
+/// @param index Index of the frame buffer
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_frame_buffer_set_target(stIT8951_Handler_t *hdlr, const uint32_t index) {
+    assert(hdlr);
+    stIT8951_FrameBuffers_t *const fb = &hdlr->frame_buffers;
+    assert(index < fb->count);
+    if(fb->target == index) {
+        return true;
+    }
+    if(!it8951_set_img_buff_base_address(hdlr, fb->addr[index]))
+        return false;
+    fb->target = index;
+    return true;
+}
+
+/// @brief Queues a display update of the area from the given frame buffer 
+/// (DPY_BUF_AREA). See @ref it8951_display_area_async
+/// @param hdlr Pointer to the IT8951 handler
+/// @param index Index of the frame buffer
+/// @param rect Area to refresh. It must be within the display's area
+/// @param display_mode Waveform to use for the update
+/// @param id [out] Optional. Completion handle of the update
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_frame_buffer_display_async(stIT8951_Handler_t *hdlr, const uint32_t index, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode, uint32_t *const id) {
+    assert(hdlr && index < hdlr->frame_buffers.count);
+    assert(rect);
+    return queue_update(hdlr, &(stIT8951_Update_t){.rect = *rect, .mode = display_mode, .buff = index}, id);
+}
+
+/// @brief Queues a display update of a 1bpp area loaded with 
+/// @ref it8951_load_img_area_1bpp_begin into the given frame buffer. The 1bpp
+/// mode is global, so the update runs alone on the LUT engines. The 1bpp data
+/// overwrites the 8bpp image at x/8 of the buffer's rows, so it should be 
+/// loaded into a buffer that is not displayed otherwise.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param index Index of the frame buffer the 1bpp area is loaded into
+/// @param rect Area to refresh. x and width must be multiples of 
+/// IT8951_1BPP_ALIGN_PX
+/// @param display_mode Waveform to use for the update
+/// @param fg_gray 8bit gray level of the 0 bits
+/// @param bg_gray 8bit gray level of the 1 bits
+/// @param id [out] Optional. Completion handle of the update
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_frame_buffer_display_1bpp_async(stIT8951_Handler_t *hdlr, const uint32_t index, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode, const uint8_t fg_gray, const uint8_t bg_gray, uint32_t *const id) {
+    assert(hdlr && rect && index < hdlr->frame_buffers.count);
+    assert((rect->x % IT8951_1BPP_ALIGN_PX) == 0 && (rect->width % IT8951_1BPP_ALIGN_PX) == 0);
+    return queue_update(hdlr, &(stIT8951_Update_t){
+        .rect    = *rect,
+        .mode    = display_mode,
+        .buff    = index,
+        .is_1bpp = true,
+        .bgvr    = (fg_gray << 8) | bg_gray,
+    }, id);
+}
+
+/// @brief Shows the whole frame buffer on the panel with a single waveform.
+/// Returns without waiting for the waveform.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param index Index of the frame buffer to show
+/// @param display_mode Waveform to use for the update
+/// @param id [out] Optional. Completion handle of the update
+/// @return True if the SPI transactions succeeded, false otherwise
+bool it8951_frame_buffer_flip(stIT8951_Handler_t *hdlr, const uint32_t index, eIT8951_DisplayMode_t display_mode, uint32_t *const id) {
+    assert(hdlr && index < hdlr->frame_buffers.count);
+    return queue_update(hdlr, &(stIT8951_Update_t){
+        .rect    = hdlr->panel_area, 
+        .mode    = display_mode, 
+        .buff    = index,
+        .is_flip = true,
+    }, id);
+}
+
+/// @brief Calculates the SDRAM address of a pixel in a frame buffer
+/// @param hdlr Pointer to the IT8951 handler
+/// @param index Index of the frame buffer
+/// @param x Column of the pixel
+/// @param y Row of the pixel
+/// @return Address of the pixel's byte
+uint32_t it8951_frame_buffer_pixel_addr(const stIT8951_Handler_t *hdlr, const uint32_t index, const uint16_t x, const uint16_t y) {
+    assert(hdlr && index < hdlr->frame_buffers.count);
+    return hdlr->frame_buffers.addr[index] + (uint32_t)y*hdlr->panel_area.width + x;
+}
+
+/// @brief Sends the address and the length of a memory burst
+static bool mem_burst_args(stIT8951_Handler_t *hdlr, const eIT8951_Command_t cmd, const uint32_t addr, const uint32_t bytes) {
+    // The address and the word count must be <26bits
+    assert(addr < (1UL << 26) && (addr % sizeof(uint16_t)) == 0);
+    assert((bytes % sizeof(uint16_t)) == 0 && (bytes/sizeof(uint16_t)) < (1UL << 26));
+    const uint32_t words = bytes/sizeof(uint16_t);
+    const uint16_t args[] = {(uint16_t)addr, (uint16_t)(addr >> 16), (uint16_t)words, (uint16_t)(words >> 16)};
+    return send_command_args(hdlr, cmd, args, ARRAY_LENGTH(args));
+}
+
+/// @brief Starts a burst write into the IT8951's SDRAM. The data is then 
+/// streamed with @ref it8951_mem_burst_write_chunk and the burst is closed 
+/// with @ref it8951_mem_burst_end
+/// @param hdlr Pointer to the IT8951 handler
+/// @param addr SDRAM address to write to. Must be even
+/// @param bytes Total number of bytes the burst writes. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_write_begin(stIT8951_Handler_t *hdlr, const uint32_t addr, const uint32_t bytes) {
+    assert(hdlr);
+    return mem_burst_args(hdlr, IT8951_COMMAND_MEM_BST_WR, addr, bytes);
+}
+
+/// @brief Streams the next chunk of a burst write. Returns while the chunk is
+/// in flight if the handler has an asynchronous transport, so the next chunk 
+/// can be prepared in another buffer meanwhile.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param data Bytes to write, in the IT8951's (big-endian) word order. Must 
+/// stay valid until the next SPI packet or @ref it8951_mem_burst_end
+/// @param bytes Number of bytes in data. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_write_chunk(stIT8951_Handler_t *hdlr, const void *const data, const uint32_t bytes) {
+    assert(hdlr && data);
+    assert((bytes % sizeof(uint16_t)) == 0);
+    return write_bytes_async(hdlr, data, bytes);
+}
+
+/// @brief Starts a burst read from the IT8951's SDRAM. The data is then read
+/// with @ref it8951_mem_burst_read_chunk and the burst is closed with 
+/// @ref it8951_mem_burst_end
+/// @param hdlr Pointer to the IT8951 handler
+/// @param addr SDRAM address to read from. Must be even
+/// @param bytes Total number of bytes the burst reads. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_read_begin(stIT8951_Handler_t *hdlr, const uint32_t addr, const uint32_t bytes) {
+    assert(hdlr);
+    return mem_burst_args(hdlr, IT8951_COMMAND_MEM_BST_RD_T, addr, bytes) &&
+           send_command(hdlr, IT8951_COMMAND_MEM_BST_RD_S);
+}
+
+/// @brief Reads the next chunk of a burst read
+/// @param hdlr Pointer to the IT8951 handler
+/// @param data Output buffer. Receives the bytes in the IT8951's (big-endian)
+/// word order
+/// @param bytes Number of bytes to read. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_read_chunk(stIT8951_Handler_t *hdlr, void *const data, const uint32_t bytes) {
+    assert(hdlr && data);
+    return read_bytes(hdlr, data, bytes);
+}
+
+/// @brief Closes the burst read or write in progress
+/// @param hdlr Pointer to the IT8951 handler
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_end(stIT8951_Handler_t *hdlr) {
+    assert(hdlr);
+    return send_command(hdlr, IT8951_COMMAND_MEM_BST_END);
+}
+
+/// @brief Writes a block of memory into the IT8951's SDRAM and blocks until
+/// the transfer is complete
+/// @param hdlr Pointer to the IT8951 handler
+/// @param addr SDRAM address to write to. Must be even
+/// @param data Bytes to write, in the IT8951's (big-endian) word order
+/// @param bytes Number of bytes to write. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_write(stIT8951_Handler_t *hdlr, const uint32_t addr, const void *const data, const uint32_t bytes) {
+    return it8951_mem_burst_write_begin(hdlr, addr, bytes) &&
+           write_bytes(hdlr, data, bytes) &&
+           it8951_mem_burst_end(hdlr);
+}
+
+/// @brief Reads a block of memory from the IT8951's SDRAM, e.g. to read back
+/// a frame buffer (one byte per pixel)
+/// @param hdlr Pointer to the IT8951 handler
+/// @param addr SDRAM address to read from. Must be even
+/// @param data Output buffer. Receives the bytes in the IT8951's (big-endian)
+/// word order
+/// @param bytes Number of bytes to read. Must be even
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_mem_burst_read(stIT8951_Handler_t *hdlr, const uint32_t addr, void *const data, const uint32_t bytes) {
+    return it8951_mem_burst_read_begin(hdlr, addr, bytes) &&
+           read_bytes(hdlr, data, bytes) &&
+           it8951_mem_burst_end(hdlr);
+}
+
 /// @brief Writes the specified pixels to the IT8951's internal frame buffer but
 /// does not render the image on the screen. Call @ref it8951_display_area after
 /// writing the pixels to display on the EPD
@@ -399,139 +1385,519 @@ bool it8951_set_img_buff_base_address(stIT8951_Handler_t *hdlr, const uint32_t a
 // TODO: Clarify that count is the number of pixels to write (padded)
 bool it8951_write_packed_pixels(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, const void *const ppixels, const uint32_t count) {
     assert(hdlr && img_info && rect && ppixels);
-    // TODO: Other bpps are not yet supported
-    assert(img_info->bpp == IT8951_COLOR_DEPTH_BPP_4BIT);
+    // The 1bpp pixels are loaded with it8951_load_img_area_1bpp_begin
+    assert(img_info->bpp != IT8951_COLOR_DEPTH_BPP_1BIT);
 
     return load_img_area_start(hdlr, img_info, rect) && 
-           write_bytes(hdlr, (uint8_t*)ppixels, count/2) && 
+           write_bytes(hdlr, (uint8_t*)ppixels, count/it8951_get_pixel_per_byte(img_info->bpp)) && 
            load_img_end(hdlr);
 }
 
-// TODO: Although BMP files naturally have padding and are already packed, these
-// images could be uploaded to an offset x, y coordinate on the IT8951's screen, 
-// which would require different padding.
-/// @brief Loads a 4bpp BMP file onto the IT8951's screen at the specified location
+/// @brief Non-blocking variant of @ref it8951_write_packed_pixels. Returns as
+/// soon as the pixel data is queued on the SPI bus. The image load is finished
+/// by @ref it8951_wait_async, or implicitly by the next driver call.
+/// @param hdlr Pointer to the IT8951 handler 
+/// @param img_info Pointer to the Image Info struct
+/// @param rect Pointer to the rectangle on the screen to write the pixels to
+/// @param ppixels Pointer to the packed pixels to write. Must stay valid until
+/// the transfer is completed
+/// @return True if the SPI transactions were queued, false otherwise
+bool it8951_write_packed_pixels_async(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, const void *const ppixels, const uint32_t count) {
+    assert(hdlr && img_info && rect && ppixels);
+    assert(img_info->bpp != IT8951_COLOR_DEPTH_BPP_1BIT);
+
+    return load_img_area_start(hdlr, img_info, rect) && 
+           write_bytes_async(hdlr, (uint8_t*)ppixels, count/it8951_get_pixel_per_byte(img_info->bpp));
+}
+
+/// @brief Blocks until the asynchronous transfer in flight is complete and 
+/// terminates the image load it belongs to.
+/// @param hdlr Pointer to the IT8951 handler 
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_wait_async(stIT8951_Handler_t *hdlr) {
+    assert(hdlr);
+    return finish_pending_xfer(hdlr) &&
+           (!hdlr->img_load_open || load_img_end(hdlr));
+}
+
+/// @brief Starts a chunked image load into the specified rectangle. The packed
+/// pixels are then streamed with @ref it8951_load_img_area_write_async in 
+/// row order and the load is terminated with @ref it8951_wait_async
+/// @param hdlr Pointer to the IT8951 handler 
+/// @param img_info Pointer to the Image Info struct
+/// @param rect Pointer to the rectangle on the screen to write the pixels to
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_load_img_area_begin(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect) {
+    assert(hdlr && img_info && rect);
+    return load_img_area_start(hdlr, img_info, rect);
+}
+
+/// @brief Starts an image load of 1bpp pixels. The IT8951 takes these as an 
+/// 8bpp load of 1/8th of the width, so 8 pixels are packed in each byte, the
+/// first pixel in the MSB. The pixels are then written with 
+/// @ref it8951_load_img_area_write_async, the same way as with 
+/// @ref it8951_load_img_area_begin
+/// @param hdlr Pointer to the IT8951 handler
+/// @param rect Area of the panel the pixels are for. x and width must be 
+/// multiples of IT8951_1BPP_ALIGN_PX
+/// @return True if the SPI transaction succeeded, false otherwise
+bool it8951_load_img_area_1bpp_begin(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect) {
+    static const stIT8951_ImageInfo_t img_info = {
+        .rotation = IT8951_ROTATION_MODE_0,
+        .bpp = IT8951_COLOR_DEPTH_BPP_8BIT,
+        .endianness = IT8951_ENDIANNESS_BIG,
+    };
+    assert(hdlr && rect);
+    assert((rect->x % IT8951_1BPP_ALIGN_PX) == 0 && (rect->width % IT8951_1BPP_ALIGN_PX) == 0);
+    const stRectangle_t area = {rect->x/8, rect->y, rect->width/8, rect->height};
+    return it8951_load_img_area_begin(hdlr, &img_info, &area);
+}
+
+/// @brief Queues the next chunk of packed pixels of the image load started by
+/// @ref it8951_load_img_area_begin. Blocks only until the previous chunk is 
+/// transferred, so the caller can prepare the next chunk while this one is 
+/// streamed out by the DMA (ping-pong buffering).
+/// @param hdlr Pointer to the IT8951 handler 
+/// @param ppixels Pointer to the packed pixels. Must stay valid until the next
+/// call of a driver function
+/// @param bytes Number of bytes to write. Must be a multiple of 2
+/// @return True if the SPI transactions were queued, false otherwise
+bool it8951_load_img_area_write_async(stIT8951_Handler_t *hdlr, const void *const ppixels, const uint32_t bytes) {
+    assert(hdlr && ppixels);
+    assert((bytes & 0b1) == 0);
+    assert(hdlr->img_load_open);
+    return write_bytes_async(hdlr, (uint8_t*)ppixels, bytes);
+}
+
+/// @brief Reads a little-endian field of the BMP header
+static bool bmp_read_field(FILE *img, const long offset, void *const out, const size_t size) {
+    return fseek(img, offset, SEEK_SET) == 0 && fread(out, size, 1, img) == 1;
+}
+
+/// @brief Converts an 8bit RGB colour to GRAY4 with the ITU-R BT.601 luma
+static inline uint8_t bmp_rgb_to_gray4(const uint8_t r, const uint8_t g, const uint8_t b) {
+    return (77*r + 150*g + 29*b) >> 12;
+}
+
+/// @brief Converts a row of BMP pixels to GRAY4, one pixel per byte
+/// @param src Row of the BMP's pixel array
+/// @param gray [out] GRAY4 pixels
+/// @param width Number of pixels to convert
+/// @param bpp Bits per pixel of the BMP: 1, 4, 8 or 24
+/// @param palette GRAY4 levels of the palette entries of the indexed formats
+static void bmp_row_to_gray4(const uint8_t *src, uint8_t *gray, const uint32_t width, const uint16_t bpp, 
+                             const uint8_t palette[256]) {
+    switch(bpp) {
+    case 1:
+        for(uint32_t i=0; i<width; i++) {
+            gray[i] = palette[(src[i/8] >> (7 - i%8)) & 0b1];
+        }
+        break;
+    case 4:
+        for(uint32_t i=0; i<width; i++) {
+            gray[i] = palette[(src[i/2] >> ((i & 1) ? 0 : 4)) & 0xF];
+        }
+        break;
+    case 8:
+        for(uint32_t i=0; i<width; i++) {
+            gray[i] = palette[src[i]];
+        }
+        break;
+    default:
+        // Stored as BGR
+        for(uint32_t i=0; i<width; i++, src+=3) {
+            gray[i] = bmp_rgb_to_gray4(src[2], src[1], src[0]);
+        }
+        break;
+    }
+}
+
+/// @brief Loads an uncompressed 1, 4, 8 or 24bpp BMP image onto the IT8951's
+/// screen at the specified location. The image is streamed from the file in 
+/// blocks of rows, converted to GRAY4 and uploaded, so it does not need to fit
+/// in RAM. The part of the image beyond the panel is clipped.
+/// @param hdlr Pointer to the IT8951 handler
+/// @param img Opened BMP file, positioned anywhere. It is left open.
+/// @param x X coordinate to load the BMP at. Needs no alignment
+/// @param y Y coordinate to load the BMP at
+/// @return True if the image was loaded, false otherwise
+bool it8951_load_bmp_stream(stIT8951_Handler_t *hdlr, FILE *img, const uint16_t x, const uint16_t y) {
+    static const stIT8951_ImageInfo_t img_info = {
+        .rotation   = IT8951_ROTATION_MODE_0,
+        .bpp        = IT8951_COLOR_DEPTH_BPP_4BIT,
+        .endianness = IT8951_ENDIANNESS_BIG,
+    };
+    assert(hdlr && img);
+
+    // Read the header. See https://en.wikipedia.org/wiki/BMP_file_format
+    // byte [10:13] encodes the bitmap byte array offset in the image
+    // byte [14:17] encodes the size of the DIB header, the palette follows it
+    // byte [18:21] encodes the bitmap width in pixels
+    // byte [22:25] encodes the bitmap height in pixels, negative if top-down
+    // byte [28:29] encodes the bitmap bpp
+    // byte [30:33] encodes the compression method
+    // byte [46:49] encodes the number of palette entries, 0 for 2^bpp
+    char magic[2];
+    uint32_t pix_arr_offset, dib_size, compression, palette_cnt;
+    int32_t width, height;
+    uint16_t bpp;
+    if(!bmp_read_field(img, 0, magic, sizeof(magic)) || magic[0] != 'B' || magic[1] != 'M' ||
+       !bmp_read_field(img, 10, &pix_arr_offset, sizeof(pix_arr_offset)) ||
+       !bmp_read_field(img, 14, &dib_size, sizeof(dib_size)) || dib_size < 40 ||
+       !bmp_read_field(img, 18, &width, sizeof(width)) ||
+       !bmp_read_field(img, 22, &height, sizeof(height)) ||
+       !bmp_read_field(img, 28, &bpp, sizeof(bpp)) ||
+       !bmp_read_field(img, 30, &compression, sizeof(compression)) ||
+       !bmp_read_field(img, 46, &palette_cnt, sizeof(palette_cnt))) {
+        printf("Invalid BMP file\n");
+        return false;
+    }
+    if(compression != 0 || width <= 0 || height == 0 || height == INT32_MIN ||
+       (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24)) {
+        printf("Unsupported BMP: %dbpp, compression %lu\n", bpp, (unsigned long)compression);
+        return false;
+    }
+    if(x >= hdlr->panel_area.width || y >= hdlr->panel_area.height) {
+        printf("BMP is placed outside of the panel\n");
+        return false;
+    }
+
+    uint8_t palette[256] = {0};
+    if(bpp <= 8) {
+        palette_cnt = (palette_cnt == 0 || palette_cnt > (1u << bpp)) ? (1u << bpp) : palette_cnt;
+        for(uint32_t i=0; i<palette_cnt; i++) {
+            // Stored as BGR0
+            uint8_t bgr0[4];
+            if(!bmp_read_field(img, 14 + dib_size + i*sizeof(bgr0), bgr0, sizeof(bgr0))) {
+                printf("Invalid BMP palette\n");
+                return false;
+            }
+            palette[i] = bmp_rgb_to_gray4(bgr0[2], bgr0[1], bgr0[0]);
+        }
+    }
+
+    // The rows are stored bottom-up, unless the height is negative. Each row
+    // is padded to 4 bytes.
+    const bool is_bottom_up = height > 0;
+    const uint32_t img_height = is_bottom_up ? height : -height;
+    const uint32_t stride = ((width*bpp + 31)/32)*4;
+    const uint16_t vis_width = (width < hdlr->panel_area.width - x) ? width : (hdlr->panel_area.width - x);
+    const uint16_t vis_height = (img_height < hdlr->panel_area.height - y) ? img_height : (hdlr->panel_area.height - y);
+    const uint32_t src_bytes = (vis_width*bpp + 7)/8;
+    // Each row is re-padded to the words of the screen position
+    const uint32_t row_bytes = (((x % 4) + vis_width + 3)/4)*sizeof(uint16_t);
+    const uint32_t rows_per_block = (row_bytes < IT8951_BMP_BLOCK_BYTES) ? (IT8951_BMP_BLOCK_BYTES/row_bytes) : 1;
+    const uint32_t block_bytes = rows_per_block*row_bytes;
+
+    // Two blocks, one is packed while the other one is transferred, and a row
+    // of the BMP before and after the conversion. Bounded by the panel width.
+    uint8_t *const buff = malloc(2*block_bytes + src_bytes + vis_width);
+    if(!buff) {
+        printf("Insufficient memory!\n");
+        return false;
+    }
+    uint8_t *const src = buff + 2*block_bytes;
+    uint8_t *const gray = src + src_bytes;
+
+    // The blocks are read in the file's row order. With a bottom-up file, 
+    // each block is filled from its last row and the blocks go up the screen.
+    // Every block is loaded with its own LD_IMG_AREA.
+    bool status = true;
+    for(uint32_t done=0, blk=0, rows; done<vis_height && status; done+=rows, blk^=1) {
+        rows = (rows_per_block < vis_height - done) ? rows_per_block : (vis_height - done);
+        // First row of the block, relative to y
+        const uint32_t top = is_bottom_up ? (vis_height - done - rows) : done;
+        const uint32_t file_row = is_bottom_up ? (img_height - (top + rows)) : top;
+        status = fseek(img, pix_arr_offset + file_row*stride, SEEK_SET) == 0;
+
+        uint8_t *const block = buff + blk*block_bytes;
+        for(uint32_t i=0; i<rows && status; i++) {
+            // Skipping the padding and the clipped pixels of the previous row
+            status = (i == 0 || fseek(img, stride - src_bytes, SEEK_CUR) == 0) &&
+                     fread(src, 1, src_bytes, img) == src_bytes;
+            bmp_row_to_gray4(src, gray, vis_width, bpp, palette);
+
+            const uint32_t slot = is_bottom_up ? (rows - 1 - i) : i;
+            uint32_t word_cnt;
+            it8951_pack_pixels(&img_info, &(stRectangle_t){x, 0, vis_width, 1}, gray, 
+                               (uint16_t*)(block + slot*row_bytes), &word_cnt);
+        }
+        if(!status) {
+            printf("Failed to read the BMP pixels\n");
+            break;
+        }
+
+        // Blocks until the previous block is out, which the packing overlapped
+        status = it8951_load_img_area_begin(hdlr, &img_info, &(stRectangle_t){x, y + top, vis_width, rows}) &&
+                 it8951_load_img_area_write_async(hdlr, block, rows*row_bytes);
+    }
+    status &= it8951_wait_async(hdlr);
+    free(buff);
+    return status;
+}
+
+/// @brief Loads a BMP file onto the IT8951's screen at the specified location,
+/// see @ref it8951_load_bmp_stream
 /// @param hdlr Pointer to the IT8951 handler
 /// @param bmp Path to the BMP file
 /// @param x X coordinate to load the BMP at
 /// @param y Y coordinate to load the BMP at
-/// @return 
+/// @return True if the image was loaded, false otherwise
 bool it8951_load_bmp(stIT8951_Handler_t *hdlr, const char *const bmp, const uint16_t x, const uint16_t y) {
     FILE *img = fopen(bmp, "rb");
     if(img == NULL){
         printf("Failed to open the BMP file\n");
         return false;
+    }
+    const bool status = it8951_load_bmp_stream(hdlr, img, x, y);
+    fclose(img);
+    return status;
+}
+
+/// @brief Gets the number of transactions held by the trace. The last one is 
+/// still open, its duration grows until the next command is sent.
+/// @param hdlr Pointer to the IT8951 handler
+/// @return Number of entries, 0 if the tracer is compiled out
+uint32_t it8951_trace_count(const stIT8951_Handler_t *hdlr) {
+#if IT8951_TRACE_LENGTH > 0
+    return (hdlr->trace.total < IT8951_TRACE_LENGTH) ? hdlr->trace.total : IT8951_TRACE_LENGTH;
+#else
+    return 0;
+#endif
+}
+
+/// @brief Empties the trace
+/// @param hdlr Pointer to the IT8951 handler
+void it8951_trace_reset(stIT8951_Handler_t *hdlr) {
+#if IT8951_TRACE_LENGTH > 0
+    hdlr->trace.total = 0;
+#endif
+}
+
+#if IT8951_TRACE_LENGTH > 0
+/// @brief Gets the i-th oldest entry of the trace
+static inline const stIT8951_TraceEntry_t *trace_entry(const stIT8951_Handler_t *hdlr, const uint32_t i) {
+    const uint32_t oldest = hdlr->trace.total - it8951_trace_count(hdlr);
+    return &hdlr->trace.entries[(oldest + i) % IT8951_TRACE_LENGTH];
+}
+#endif
+
+/// @brief Writes the trace as an stIT8951_TraceHeader_t followed by the 
+/// stIT8951_TraceEntry_t entries, oldest first
+/// @param hdlr Pointer to the IT8951 handler
+/// @param out Stream to write to, opened in binary mode
+/// @return True on success. False if the write failed or the tracer is 
+/// compiled out
+bool it8951_trace_dump_binary(const stIT8951_Handler_t *hdlr, FILE *out) {
+#if IT8951_TRACE_LENGTH > 0
+    assert(hdlr && out);
+    const uint32_t count = it8951_trace_count(hdlr);
+    const stIT8951_TraceHeader_t header = {
+        .magic      = IT8951_TRACE_MAGIC,
+        .version    = IT8951_TRACE_VERSION,
+        .entry_size = sizeof(stIT8951_TraceEntry_t),
+        .count      = count,
+        .dropped    = hdlr->trace.total - count,
+    };
+    bool status = fwrite(&header, sizeof(header), 1, out) == 1;
+    for(uint32_t i=0; i<count && status; i++) {
+        status = fwrite(trace_entry(hdlr, i), sizeof(stIT8951_TraceEntry_t), 1, out) == 1;
+    }
+    return status;
+#else
+    return false;
+#endif
+}
+
+/// @brief Writes the trace as CSV, one transaction per line, oldest first
+/// @param hdlr Pointer to the IT8951 handler
+/// @param out Stream to write to, e.g. stdout
+/// @return True on success. False if the write failed or the tracer is 
+/// compiled out
+bool it8951_trace_dump_csv(const stIT8951_Handler_t *hdlr, FILE *out) {
+#if IT8951_TRACE_LENGTH > 0
+    assert(hdlr && out);
+    const uint32_t count = it8951_trace_count(hdlr);
+    bool status = fprintf(out, "start_us,command,arg0,args,bytes,hrdy_us,duration_us,failed\n") > 0;
+    for(uint32_t i=0; i<count && status; i++) {
+        const stIT8951_TraceEntry_t *const entry = trace_entry(hdlr, i);
+        status = fprintf(out, "%lu,0x%04x,0x%04x,%u,%lu,%lu,%lu,%u\n", 
+                         (unsigned long)entry->start_us, entry->command, entry->arg0, entry->arg_count, 
+                         (unsigned long)entry->bytes, (unsigned long)entry->hrdy_wait_us, 
+                         (unsigned long)entry->duration_us, entry->failed) > 0;
+    }
+    return status;
+#else
+    return false;
+#endif
+}
+
+// The interior word packers load the pixels as little-endian 32bit words and
+// write the packed words in the host's byte order
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The row packers expect a little-endian host");
+
+/// @brief Packs up to one word of pixels, shifting in one pixel at a time.
+/// Used for the partial words at the start and the end of a row.
+/// @param in Pixels, one per byte
+/// @param slot First slot to fill
+/// @param count Number of pixels, so that slot+count <= slots per word
+/// @param slot_bits Bits a pixel takes in the word
+/// @param val_bits Bits of the pixel value. It is stored in the top bits of
+/// its slot
+/// @param big_endian Fill the slots from the MSB and store the word 
+/// big-endian, instead of filling from the LSB
+/// @return Packed word, the unused slots are zero
+__attribute__((always_inline))
+static inline uint16_t pack_partial_word(const uint8_t *in, uint32_t slot, const uint32_t count,
+                                         const uint32_t slot_bits, const uint32_t val_bits, const bool big_endian) {
+    const uint32_t mask = (1u << val_bits) - 1;
+    uint16_t word = 0;
+    for(uint32_t i=0; i<count; i++, slot++) {
+        const uint32_t shift = big_endian ? (16 - (slot+1)*slot_bits) : (slot*slot_bits);
+        word |= (uint16_t)(((in[i] & mask) << (slot_bits - val_bits)) << shift);
+    }
+    return big_endian ? __builtin_bswap16(word) : word;
+}
+
+/// @brief Loads 4 pixels, pixel 0 in the low byte
+static inline uint32_t load_pixels_32(const uint8_t *in) {
+    uint32_t v;
+    memcpy(&v, in, sizeof(v));
+    return v;
+}
+
+/// @brief Packs 8 2bpp pixels into one word
+__attribute__((always_inline))
+static inline uint16_t pack_word_2bpp(const uint8_t *in, const bool big_endian) {
+    uint32_t lo = load_pixels_32(in) & 0x03030303;
+    uint32_t hi = load_pixels_32(in+4) & 0x03030303;
+    if(big_endian) {
+        // Pixel 0 goes to the top of the byte
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+    }
+    // Pixels in bytes 0..3 -> 2 bit fields at 0,2 and 16,18 -> 0,2,4,6
+    lo |= lo >> 6;
+    lo |= lo >> 12;
+    hi |= hi >> 6;
+    hi |= hi >> 12;
+    return (uint16_t)((lo & 0xFF) | ((hi & 0xFF) << 8));
+}
+
+/// @brief Packs 4 3bpp/4bpp pixels into one word
+__attribute__((always_inline))
+static inline uint16_t pack_word_4bpp(const uint8_t *in, const uint32_t val_bits, const bool big_endian) {
+    const uint32_t mask = ((1u << val_bits) - 1)*0x01010101u;
+    uint32_t v = (load_pixels_32(in) & mask) << (4 - val_bits);
+    // Pixels in bytes 0..3 -> nibble pairs in bytes 0 and 2. Big-endian puts
+    // the first pixel of each pair in the high nibble
+    v = big_endian ? ((v << 4) | (v >> 8)) : (v | (v >> 4));
+    return (uint16_t)((v & 0xFF) | ((v >> 8) & 0xFF00));
+}
+
+/// @brief Packs a row of pixels into 16bit words. The partial words at the 
+/// start and the end are packed a pixel at a time, the full words in between
+/// from 32bit loads of the pixels. Only instantiated through PACK_ROW_FN, so
+/// the slot layout and the byte order are compile-time constants of each 
+/// instance.
+/// @param in Pixels of the row, one per byte
+/// @param out [out] Packed words
+/// @param start_pad Number of padding slots before the first pixel
+/// @param width Number of pixels in the row
+/// @param slot_bits Bits a pixel takes in the word
+/// @param val_bits Bits of the pixel value. It is stored in the top bits of
+/// its slot
+/// @param big_endian Fill the slots from the MSB and store the words 
+/// big-endian, instead of filling from the LSB
+/// @return Pointer past the last word written
+__attribute__((always_inline))
+static inline uint16_t *pack_row(const uint8_t *in, uint16_t *out, const uint32_t start_pad, uint32_t width,
+                                 const uint32_t slot_bits, const uint32_t val_bits, const bool big_endian) {
+    const uint32_t slots = 16/slot_bits;
+    if(start_pad) {
+        const uint32_t count = (width < slots - start_pad) ? width : (slots - start_pad);
+        *out++ = pack_partial_word(in, start_pad, count, slot_bits, val_bits, big_endian);
+        in += count;
+        width -= count;
+    }
+
+    const uint32_t full_words = width/slots;
+    if(slot_bits == 8) {
+        // Already in the pixel stream order for both endiannesses
+        memcpy(out, in, full_words*sizeof(uint16_t));
+        out += full_words;
+        in += full_words*slots;
     } else {
-        // Read the header. See https://en.wikipedia.org/wiki/BMP_file_format)
-        char header[2];
-        fread(header, sizeof(char), 2, img);
-        if(header[0] != 'B' || header[1] != 'M'){
-            printf("Invalid BMP file\n");
-            fclose(img);
-            return false;
+        for(uint32_t i=0; i<full_words; i++, in+=slots) {
+            *out++ = (slot_bits == 2) ? pack_word_2bpp(in, big_endian) : pack_word_4bpp(in, val_bits, big_endian);
         }
+    }
 
-        uint32_t pix_arr_offset, width, height;
-        uint16_t bpp;
-        // byte [10:13] encodes the bitmap byte array offset in the image
-        // byte [18:21] encodes the bitmap width in pixels
-        // byte [22:25] encodes the bitmap height in pixels
-        // byte [28:29] encodes the bitmap bpp
-        fseek(img, 10, SEEK_SET);
-        fread(&pix_arr_offset, sizeof(pix_arr_offset), 1, img);
-
-        fseek(img, 18, SEEK_SET);
-        fread(&width, sizeof(width), 1, img);
-        fread(&height, sizeof(height), 1, img);
-        
-        fseek(img, 28, SEEK_SET);
-        fread(&bpp, sizeof(bpp), 1, img);
-        // TODO: Other bpps are not yet supported
-        assert(bpp == 4);
-
-        const size_t img_size = (width*height*bpp)/8;
-        uint8_t *buff = malloc(img_size);
-        if(!buff){
-            printf("Insufficient memory!");
-            return false;
-        }
-        fseek(img, pix_arr_offset, SEEK_SET);
-        fread(buff, sizeof(*buff), img_size, img);
-        fclose(img);
-
-        stRectangle_t rect = {x, y, width, height};
-        stIT8951_ImageInfo_t img_info = {
-            .rotation   = IT8951_ROTATION_MODE_0,
-            .bpp        = IT8951_COLOR_DEPTH_BPP_4BIT,
-            .endianness = IT8951_ENDIANNESS_LITTLE,
-        };
-        // If the BMP's width/height cannot fit on the screen, this will fail.
-        const bool status = it8951_write_packed_pixels(hdlr, &img_info, &rect, (uint16_t*)buff, img_size/2);
-        free(buff);
-        return status;
+    // The end padding slots are left zero
+    if(width % slots) {
+        *out++ = pack_partial_word(in, 0, width % slots, slot_bits, val_bits, big_endian);
     }
+    return out;
 }
 
+typedef uint16_t *(*pack_row_fn_t)(const uint8_t *in, uint16_t *out, const uint32_t start_pad, const uint32_t width);
+#define PACK_ROW_FN(name, slot_bits, val_bits, big_endian)                                              \
+    static uint16_t *name(const uint8_t *in, uint16_t *out, const uint32_t start_pad, const uint32_t width) { \
+        return pack_row(in, out, start_pad, width, slot_bits, val_bits, big_endian);                    \
+    }
+PACK_ROW_FN(pack_row_2bpp_le, 2, 2, false)
+PACK_ROW_FN(pack_row_2bpp_be, 2, 2, true)
+PACK_ROW_FN(pack_row_3bpp_le, 4, 3, false)
+PACK_ROW_FN(pack_row_3bpp_be, 4, 3, true)
+PACK_ROW_FN(pack_row_4bpp_le, 4, 4, false)
+PACK_ROW_FN(pack_row_4bpp_be, 4, 4, true)
+PACK_ROW_FN(pack_row_8bpp_le, 8, 8, false)
+PACK_ROW_FN(pack_row_8bpp_be, 8, 8, true)
+
+/// @brief Row packers indexed by [eIT8951_ColorDepth_t][eIT8951_Endianness_t]
+static const pack_row_fn_t pack_row_fns[][2] = {
+    [IT8951_COLOR_DEPTH_BPP_2BIT] = {pack_row_2bpp_le, pack_row_2bpp_be},
+    [IT8951_COLOR_DEPTH_BPP_3BIT] = {pack_row_3bpp_le, pack_row_3bpp_be},
+    [IT8951_COLOR_DEPTH_BPP_4BIT] = {pack_row_4bpp_le, pack_row_4bpp_be},
+    [IT8951_COLOR_DEPTH_BPP_8BIT] = {pack_row_8bpp_le, pack_row_8bpp_be},
+};
+
 /// @brief Packs the pixels contained in a uint8_t array into 16bit words, that can
-/// directly be transferred to the IT8951
-/// @param img_info Pointer to the Image Info struct
+/// directly be transferred to the IT8951. Each row starts on a new word. With
+/// IT8951_ENDIANNESS_LITTLE the first pixel of a word is in its lowest slot.
+/// With IT8951_ENDIANNESS_BIG it is in the highest slot and the word is stored
+/// big-endian, so at 4bpp the first pixel is the high nibble of the first 
+/// byte. The slots before x and after x+width that share a word with the 
+/// rectangle's pixels are zero padding, so x and width need no alignment:
+/// 2bpp -> 8 pixels per word
+/// 3bpp -> 4 pixels per word, in the top 3 bits of each nibble
+/// 4bpp -> 4 pixels per word
+/// 8bpp -> 2 pixels per word
+/// @param img_info Pointer to the Image Info struct. 1bpp is not supported
 /// @param rect Rectangle to pack the pixels into.
-/// @param in_pix Must be at least rect->width*rect->height long. Pixels outside
-/// the rectangle are ignored
-/// @param out_words [out] Must be at least (x+start_pad+end_pad)/4*y long and
-/// can be left uninitialized by the caller
+/// @param in_pix Must be at least rect->width*rect->height long, one pixel per
+/// byte. Only the low bpp bits of each pixel are used.
+/// @param out_words [out] Must be at least 
+/// ceil(((x % pixels per word) + width)/pixels per word)*height long and can be
+/// left uninitialized by the caller
+/// @param word_cnt [out] Number of words written
 void it8951_pack_pixels(const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, const uint8_t *const in_pix, uint16_t *const out_words, /*out*/ uint32_t *word_cnt) {
-    // TODO: Generalise it to other bpps
-    // The following alignment rules must be met:
-    // 2bpp -> start_x % 8 = 0, end_x % 8 = 0
-    // 4bpp -> start_x % 4 = 0, end_x % 4 = 0
-    // 8bpp -> start_x % 2 = 0, end_x % 2 = 0
     assert(img_info && rect && in_pix && out_words && word_cnt);
-    // TODO: Other bpps are not yet supported
-    assert(img_info->bpp == IT8951_COLOR_DEPTH_BPP_4BIT);
-
-    const uint32_t pix_per_byte  = it8951_get_pixel_per_byte(img_info->bpp);
-
-    // TODO: Finish this with pading
-    if(img_info->bpp == IT8951_COLOR_DEPTH_BPP_4BIT && img_info->endianness == IT8951_ENDIANNESS_LITTLE) {
-        const uint32_t mod_mask  = pix_per_byte*2-1; // x%4 = x & 0b11
-        const uint32_t end_mod   = (rect->x + rect->width) & mod_mask;
-
-        const uint32_t start_pad = rect->x & mod_mask;
-        const uint32_t end_pad   = (end_mod == 0) ? 0 : (pix_per_byte - end_mod);
-        // [(floor(width/pix_per_word) + (start_pad>0) + (end_pad>0)) * height]
-        // is the number of uint16_t words the rectangle is encoded on, taking
-        // the alignment rules into account
-        const uint32_t word_per_row = rect->width/(pix_per_byte*2)+(start_pad>0)+(end_pad>0);
-        *word_cnt = word_per_row*rect->height;
-
-        // Ensure that the padding is zeroed out
-        memset(out_words, 0, *word_cnt*sizeof(*out_words));
-
-        // Note: in_pix will naturally be only accessed in the valid range due 
-        // to the padding
-        uint32_t idx = 0;
-        for(uint32_t w=0; w<*word_cnt; w++) {
-            // If this is the first word in the row, pad the beginning
-            const uint32_t mod = w % word_per_row;
-            uint32_t low_bound, high_bound;
-            if(mod == 0){
-                low_bound  = start_pad;
-                high_bound = pix_per_byte;
-            // If this is the last word in the row, pad the end
-            } else if(mod == word_per_row-1) {
-                low_bound  = 0;
-                high_bound = end_pad;
-            // Else just copy as usual
-            } else {
-                low_bound  = 0;
-                high_bound = pix_per_byte;
-            }
-            for(uint32_t p=low_bound; p<high_bound; p++) {
-                out_words[w] |= ((uint16_t)in_pix[idx++] << (4*p));
-            }
-        }
+    assert(img_info->bpp < ARRAY_LENGTH(pack_row_fns));
+    assert(img_info->endianness <= IT8951_ENDIANNESS_BIG);
+
+    const pack_row_fn_t pack = pack_row_fns[img_info->bpp][img_info->endianness];
+    const uint32_t pix_per_word = it8951_get_pixel_per_byte(img_info->bpp)*2;
+    const uint32_t start_pad = rect->x % pix_per_word;
+    const uint32_t word_per_row = (start_pad + rect->width + pix_per_word-1)/pix_per_word;
+
+    const uint8_t *in = in_pix;
+    uint16_t *out = out_words;
+    for(uint32_t y=0; y<rect->height; y++, in+=rect->width) {
+        out = pack(in, out, start_pad, rect->width);
     }
+    *word_cnt = word_per_row*rect->height;
+    assert(out == out_words + *word_cnt);
 }
 
 // For the SPI protocol description, refer to 
@@ -552,6 +1918,10 @@ bool it8951_init(stIT8951_Handler_t *hdlr) {
     char dev_info_str[256];
     printf("%s\n", it8951_device_info_to_string(&hdlr->device_info, dev_info_str));
     
+    hdlr->frame_buffers = (stIT8951_FrameBuffers_t){
+        .addr = {hdlr->device_info.img_buff_addr},
+        .count = 1,
+    };
     if(!it8951_set_img_buff_base_address(hdlr, hdlr->device_info.img_buff_addr))
         goto Terminate;
     if(!it8951_set_i80_packed_mode(hdlr, true))
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdbool.h>
 
 #define IS_WITHIN_RANGE(x, low, high) ((x) >= (low) && (x) <= (high))
@@ -44,6 +45,8 @@ typedef enum eIT8951_Register {
     IT8951_REGISTER_UP0SR     = IT8951_REGISTER_BASE_DISP_CTRL + 0x134,
     /// @brief Update parameter1 setting reg
     IT8951_REGISTER_UP1SR     = IT8951_REGISTER_BASE_DISP_CTRL + 0x138,
+    /// @brief Update parameter1 setting reg, high word. Bit 2: 1bpp mode
+    IT8951_REGISTER_UP1SR_H   = IT8951_REGISTER_BASE_DISP_CTRL + 0x13A,
     /// @brief LUT0 Alpha blend and fill rectangle value
     IT8951_REGISTER_LUT0ABFRV = IT8951_REGISTER_BASE_DISP_CTRL + 0x13C,
     /// @brief Update buffer base address
@@ -68,6 +71,7 @@ typedef enum eIT8951_Register {
                                    (e) == IT8951_REGISTER_LUT01AF   || \
                                    (e) == IT8951_REGISTER_UP0SR     || \
                                    (e) == IT8951_REGISTER_UP1SR     || \
+                                   (e) == IT8951_REGISTER_UP1SR_H   || \
                                    (e) == IT8951_REGISTER_LUT0ABFRV || \
                                    (e) == IT8951_REGISTER_UPBBADDR  || \
                                    (e) == IT8951_REGISTER_LUT0IMXY  || \
@@ -172,13 +176,32 @@ typedef enum eIT8951_ColorDepth {
                                      -1, -1, -1,                  \
                                      IT8951_COLOR_DEPTH_BPP_8BIT})
 
-/// @brief Rotational angle of the displayed image
+/// @brief Rotational angle of the displayed image, clockwise. See 
+/// it8951_rotate_rect()
 typedef enum eIT8951_RotationMode {
     IT8951_ROTATION_MODE_0   = 0,
     IT8951_ROTATION_MODE_90  = 1,
     IT8951_ROTATION_MODE_180 = 2,
     IT8951_ROTATION_MODE_270 = 3
 } eIT8951_RotationMode_t;
+#define IsEnum_IT8951_RotationMode(e) ((e) <= IT8951_ROTATION_MODE_270)
+
+/// @brief Framing of the command, argument and register words on the SPI bus
+typedef enum eIT8951_Transport {
+    /// @brief Every 16bit word is sent in its own SPI transaction and HRDY is
+    /// polled after each of them. Slow, but tolerates any host SPI driver.
+    IT8951_TRANSPORT_WORD   = 0,
+    /// @brief Under one nCS assertion, the preamble is sent, the HRDY polled,
+    /// then all the words of a command or write packet are sent in a single 
+    /// SPI transaction. A read polls the HRDY again after its dummy word and
+    /// then reads all the data in a single transaction.
+    IT8951_TRANSPORT_FRAMED = 1
+} eIT8951_Transport_t;
+#define IsEnum_IT8951_Transport(e) ((e) <= IT8951_TRANSPORT_FRAMED)
+/// @brief Max number of 16bit words (preamble included) that fit in a single
+/// framed transaction. Longer packets fall back to the word-by-word transport.
+/// Sized to fit a GET_DEV_INFO read (preamble + dummy + 20 words).
+#define IT8951_MAX_FRAME_WORDS (24)
 
 typedef enum eIT8951_Endianness {
     IT8951_ENDIANNESS_LITTLE = 0,
@@ -199,6 +222,17 @@ typedef enum eIT8951_DisplayMode {
 } eIT8951_DisplayMode_t;
 #define IsEnum_IT8951_DisplayMode(e) ((e) <= IT8951_DISPLAY_MODE_DU4)
 
+/// @brief Nominal waveform duration of each display mode at 
+/// IT8951_NOMINAL_TEMPERATURE_C in ms, indexed by @ref eIT8951_DisplayMode_t
+#define IT8951_DISPLAY_MODE_DURATION_MS_MAP ((uint32_t[]){2000, 260, 450, 450, 450, 450, 120, 290})
+/// @brief Relative fidelity of each display mode, indexed by 
+/// @ref eIT8951_DisplayMode_t. When 2 updates are merged, the higher one wins.
+#define IT8951_DISPLAY_MODE_RANK_MAP ((uint32_t[]){7, 2, 6, 5, 5, 5, 1, 3})
+/// @brief Waveforms get longer below this temperature [C]
+#define IT8951_NOMINAL_TEMPERATURE_C (20)
+/// @brief Extra waveform duration per degree C below the nominal temperature [%]
+#define IT8951_DURATION_PERCENT_PER_C (5)
+
 typedef struct __attribute__((packed, aligned(2))) stIT8951_DeviceInfo {
     uint16_t panel_width;
     uint16_t panel_height;
@@ -225,6 +259,157 @@ typedef struct __attribute__((packed)) stIT8951_ImageInfo {
 } stIT8951_ImageInfo_t;
 static_assert(sizeof(stIT8951_ImageInfo_t) == 2);
 
+/// @brief Max number of display updates the scheduler holds (queued+running)
+#define IT8951_UPDATE_QUEUE_LENGTH (8)
+/// @brief Number of LUT engines reported in the LUTAFSR register
+#define IT8951_LUT_ENGINE_COUNT (16)
+/// @brief Period of the LUTAFSR polling once an update is expected to be done
+#define IT8951_UPDATE_POLL_INTERVAL_MS (10)
+/// @brief Period of the temperature re-reading for the duration estimates
+#define IT8951_TEMPERATURE_REFRESH_MS (60*1000)
+/// @brief Update id that never belongs to a scheduled update
+#define IT8951_UPDATE_ID_INVALID (0)
+
+/// @brief 1bpp mode enable bit of the UP1SR_H register. While set, the 
+/// display updates read the image buffer as 1 bit per pixel, mapped to the 
+/// gray levels of the BGVR register
+#define IT8951_UP1SR_H_1BPP_ENABLE (1 << 2)
+/// @brief Alignment of the x coordinate and the width of 1bpp areas [px]
+#define IT8951_1BPP_ALIGN_PX (32)
+/// @brief Size of the blocks of packed rows it8951_load_bmp uploads a BMP in.
+/// Two of these are allocated, one is packed while the other one is sent.
+#define IT8951_BMP_BLOCK_BYTES (4096)
+
+/// @brief Size of the IT8951's embedded SDRAM (64Mbit) the frame buffers are
+/// allocated in
+#define IT8951_SDRAM_SIZE (8ul*1024*1024)
+/// @brief Max number of frame buffers, the default image buffer included
+#define IT8951_MAX_FRAME_BUFFERS (4)
+/// @brief Index of the IT8951's default image buffer
+#define IT8951_FRAME_BUFFER_DEFAULT (0)
+
+/// @brief Image buffers in the IT8951's SDRAM. The IT8951 keeps the image at
+/// 8bpp internally, regardless of the bpp it was loaded with
+typedef struct stIT8951_FrameBuffers {
+    /// @brief SDRAM addresses of the allocated buffers
+    uint32_t addr[IT8951_MAX_FRAME_BUFFERS];
+    uint32_t count;
+    /// @brief Buffer the image loads are written to (LISAR)
+    uint32_t target;
+    /// @brief Buffer on the panel. Set by @ref it8951_frame_buffer_flip once
+    /// the flip's waveform is done, not when it is queued
+    uint32_t front;
+} stIT8951_FrameBuffers_t;
+
+typedef enum eIT8951_UpdateState {
+    IT8951_UPDATE_STATE_FREE    = 0,
+    /// @brief Waiting for the LUT engines to be available
+    IT8951_UPDATE_STATE_QUEUED  = 1,
+    /// @brief DPY_AREA is sent, the waveform is being driven
+    IT8951_UPDATE_STATE_RUNNING = 2
+} eIT8951_UpdateState_t;
+
+/// @brief A display (DPY_AREA) request tracked by the update scheduler
+typedef struct stIT8951_Update {
+    eIT8951_UpdateState_t state;
+    /// @brief Completion handle returned to the caller
+    uint32_t id;
+    stRectangle_t rect;
+    eIT8951_DisplayMode_t mode;
+    /// @brief Frame buffer the area is displayed from
+    uint32_t buff;
+    /// @brief The area is loaded at 1bpp and displayed in the 1bpp mode
+    bool is_1bpp;
+    /// @brief BGVR value of a 1bpp update: the foreground gray in the high 
+    /// byte (0 bits), the background gray in the low byte (1 bits)
+    uint16_t bgvr;
+    /// @brief The update is a FILL_RECT. It writes colour into the image 
+    /// buffer when it is launched, not when it is queued
+    bool is_fill;
+    /// @brief 8bit gray level of a fill
+    uint8_t colour;
+    /// @brief The update is a page flip. Its buffer becomes the front buffer 
+    /// once it is done
+    bool is_flip;
+    /// @brief LUT engines the update was observed to run on
+    uint16_t lut_mask;
+    /// @brief Time the update was launched at [ms]
+    uint32_t start_ms;
+    /// @brief Temperature-compensated estimate of the waveform's length [ms]
+    uint32_t duration_ms;
+} stIT8951_Update_t;
+
+typedef struct stIT8951_UpdateScheduler {
+    stIT8951_Update_t updates[IT8951_UPDATE_QUEUE_LENGTH];
+    /// @brief Id of the next update. Ids are never IT8951_UPDATE_ID_INVALID
+    uint32_t next_id;
+    /// @brief Last value read from the LUTAFSR register
+    uint16_t busy_luts;
+    /// @brief A 1bpp update is running, so the 1bpp mode is enabled
+    bool is_1bpp_running;
+    /// @brief The LUTAFSR register is not polled before this time [ms]
+    uint32_t next_poll_ms;
+    /// @brief Panel temperature used for the duration estimates [C]
+    int32_t temperature;
+    /// @brief Time of the last temperature reading [ms]
+    uint32_t temperature_ms;
+    bool temperature_valid;
+} stIT8951_UpdateScheduler_t;
+
+/// @brief Number of transactions kept by the tracer, see it8951_trace_dump_csv.
+/// 0 compiles the tracer out. Enabled for the unit tests.
+#ifndef IT8951_TRACE_LENGTH
+#ifdef PIO_UNIT_TESTING
+#define IT8951_TRACE_LENGTH (32)
+#else
+#define IT8951_TRACE_LENGTH (0)
+#endif
+#endif
+/// @brief Magic of a binary trace dump: "IT8T"
+#define IT8951_TRACE_MAGIC (0x54385449)
+#define IT8951_TRACE_VERSION (1)
+
+/// @brief A command and everything transferred until the next command: its 
+/// arguments, the data of an image load or a register read, etc. The times 
+/// are in us and only count the time the driver spent blocked in the SPI and
+/// HRDY callbacks.
+typedef struct __attribute__((packed, aligned(4))) stIT8951_TraceEntry {
+    uint32_t start_us;
+    uint32_t duration_us;
+    // Part of duration_us spent waiting for the HRDY
+    uint32_t hrdy_wait_us;
+    // Bytes clocked over the SPI, including the preambles and the arguments
+    uint32_t bytes;
+    uint16_t command;
+    // First argument, e.g. the register of a REG_RD/REG_WR
+    uint16_t arg0;
+    uint16_t arg_count;
+    // An SPI transfer of the transaction failed
+    uint16_t failed;
+} stIT8951_TraceEntry_t;
+static_assert(sizeof(stIT8951_TraceEntry_t) == 24);
+
+/// @brief Header of a binary trace dump, followed by count entries, oldest 
+/// first. Little-endian.
+typedef struct __attribute__((packed)) stIT8951_TraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t count;
+    // Transactions lost to the wrap-around of the ring
+    uint32_t dropped;
+} stIT8951_TraceHeader_t;
+static_assert(sizeof(stIT8951_TraceHeader_t) == 16);
+
+#if IT8951_TRACE_LENGTH > 0
+typedef struct stIT8951_Trace {
+    stIT8951_TraceEntry_t entries[IT8951_TRACE_LENGTH];
+    // Number of transactions recorded since the reset. The last one is at 
+    // entries[(total-1) % IT8951_TRACE_LENGTH] and is still open
+    uint32_t total;
+} stIT8951_Trace_t;
+#endif
+
 typedef struct stIT8951_Handler {
     /// @brief Pointer to the SPI transcieve function. The SPI peripheral must
     /// be initialised to <24MHz clock before initing the IT8951. TODO: Get the
@@ -236,6 +421,45 @@ typedef struct stIT8951_Handler {
     void (*set_ncs)(bool state);
     /// @brief Pointer to the function that waits for the HRDY GPIO to be high
     void (*wait_hrdy)(void);
+    /// @brief Framing of the command/argument/register transfers. Defaults to
+    /// IT8951_TRANSPORT_WORD if left zero-initialised.
+    eIT8951_Transport_t transport;
+    /// @brief Optional pointer to a function that queues a transmit-only SPI 
+    /// transfer and returns without waiting for its completion. txdata must 
+    /// stay valid until spi_wait_async returns. If NULL, the asynchronous API
+    /// falls back to the blocking spi_transcieve.
+    bool (*spi_transmit_async)(const void *txdata, size_t len);
+    /// @brief Pointer to the function that blocks until all the transfers 
+    /// queued by spi_transmit_async are complete. Required if 
+    /// spi_transmit_async is set.
+    bool (*spi_wait_async)(void);
+    /// @brief Optional pointer to a function returning a monotonic time in ms.
+    /// If NULL, the update scheduler polls the LUT engines at every call.
+    uint32_t (*get_time_ms)(void);
+    /// @brief Optional pointer to a function that yields the CPU for the given
+    /// ms while waiting for a display update. If NULL, the wait busy-polls.
+    void (*sleep_ms)(uint32_t ms);
+    /// @brief Optional pointer to a function returning a monotonic time in us.
+    /// Only used by the tracer. If NULL, the trace has no timings.
+    uint32_t (*get_time_us)(void);
+    /// @brief Size of the IT8951's SDRAM [bytes] the frame buffers must fit 
+    /// in. Defaults to IT8951_SDRAM_SIZE if left zero-initialised.
+    uint32_t sdram_size;
+    /// @brief Driver state. Display updates queued and in progress
+    stIT8951_UpdateScheduler_t scheduler;
+    /// @brief Driver state. Frame buffers allocated in the IT8951's SDRAM
+    stIT8951_FrameBuffers_t frame_buffers;
+    /// @brief Driver state. An asynchronous transfer holds the nCS low
+    bool xfer_pending;
+    /// @brief Driver state. LD_IMG_AREA was sent without its LD_IMG_END
+    bool img_load_open;
+    /// @brief Driver state. The IT8951 is set to the 2bpp mode, see 
+    /// it8951_set_bpp_mode
+    bool is_2bpp_mode;
+#if IT8951_TRACE_LENGTH > 0
+    /// @brief Driver state. Ring buffer of the last transactions
+    stIT8951_Trace_t trace;
+#endif
     /// @brief VCOM voltage level in mV. Usually its a negative value. Set to 
     /// INT_MAX if the default VCOM voltage is to be kept. Note that the IT8951
     /// development boards ship with waveforms that are tuned to a specific vcom
@@ -248,9 +472,48 @@ typedef struct stIT8951_Handler {
 bool it8951_init(stIT8951_Handler_t *hdlr);
 void it8951_pack_pixels(const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, const uint8_t *const in_pix, uint16_t *const out_words, /*out*/ uint32_t *word_cnt);
 bool it8951_write_packed_pixels(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, const void *const ppixels, const uint32_t count);
+bool it8951_write_packed_pixels_async(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, const void *const ppixels, const uint32_t count);
+bool it8951_wait_async(stIT8951_Handler_t *hdlr);
+bool it8951_set_bpp_mode(stIT8951_Handler_t *hdlr, bool is_2bpp);
+stRectangle_t it8951_get_image_area(const stIT8951_Handler_t *hdlr, const eIT8951_RotationMode_t rotation);
+stRectangle_t it8951_rotate_rect(const stIT8951_Handler_t *hdlr, const eIT8951_RotationMode_t rotation, const stRectangle_t *const rect);
+bool it8951_load_img_area_begin(stIT8951_Handler_t *hdlr, const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect);
+bool it8951_load_img_area_write_async(stIT8951_Handler_t *hdlr, const void *const ppixels, const uint32_t bytes);
+bool it8951_load_bmp_stream(stIT8951_Handler_t *hdlr, FILE *img, const uint16_t x, const uint16_t y);
+bool it8951_load_bmp(stIT8951_Handler_t *hdlr, const char *const bmp, const uint16_t x, const uint16_t y);
 bool it8951_display_area(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode);
+bool it8951_display_area_async(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode, uint32_t *const id);
+bool it8951_update_poll(stIT8951_Handler_t *hdlr);
+bool it8951_update_is_done(const stIT8951_Handler_t *hdlr, const uint32_t id);
+bool it8951_update_wait(stIT8951_Handler_t *hdlr, const uint32_t id);
+bool it8951_update_is_launched(const stIT8951_Handler_t *hdlr, const uint32_t id);
+bool it8951_update_wait_launched(stIT8951_Handler_t *hdlr, const uint32_t id);
+stRectangle_t it8951_update_merged_area(const stIT8951_Handler_t *hdlr, const uint32_t buff, const stRectangle_t *const rect);
+bool it8951_frame_buffer_alloc(stIT8951_Handler_t *hdlr, uint32_t *const index);
+bool it8951_frame_buffer_set_target(stIT8951_Handler_t *hdlr, const uint32_t index);
+bool it8951_frame_buffer_display_async(stIT8951_Handler_t *hdlr, const uint32_t index, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode, uint32_t *const id);
+bool it8951_frame_buffer_display_1bpp_async(stIT8951_Handler_t *hdlr, const uint32_t index, const stRectangle_t *const rect, eIT8951_DisplayMode_t display_mode, const uint8_t fg_gray, const uint8_t bg_gray, uint32_t *const id);
+bool it8951_load_img_area_1bpp_begin(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect);
+bool it8951_frame_buffer_flip(stIT8951_Handler_t *hdlr, const uint32_t index, eIT8951_DisplayMode_t display_mode, uint32_t *const id);
+uint32_t it8951_frame_buffer_pixel_addr(const stIT8951_Handler_t *hdlr, const uint32_t index, const uint16_t x, const uint16_t y);
+bool it8951_mem_burst_write_begin(stIT8951_Handler_t *hdlr, const uint32_t addr, const uint32_t bytes);
+bool it8951_mem_burst_write_chunk(stIT8951_Handler_t *hdlr, const void *const data, const uint32_t bytes);
+bool it8951_mem_burst_read_begin(stIT8951_Handler_t *hdlr, const uint32_t addr, const uint32_t bytes);
+bool it8951_mem_burst_read_chunk(stIT8951_Handler_t *hdlr, void *const data, const uint32_t bytes);
+bool it8951_mem_burst_end(stIT8951_Handler_t *hdlr);
+bool it8951_mem_burst_write(stIT8951_Handler_t *hdlr, const uint32_t addr, const void *const data, const uint32_t bytes);
+bool it8951_mem_burst_read(stIT8951_Handler_t *hdlr, const uint32_t addr, void *const data, const uint32_t bytes);
+uint32_t it8951_update_estimate_duration(stIT8951_Handler_t *hdlr, eIT8951_DisplayMode_t mode);
 bool it8951_fill_rect(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t mode, uint8_t colour);
+bool it8951_fill_rect_async(stIT8951_Handler_t *hdlr, const stRectangle_t *const rect, eIT8951_DisplayMode_t mode, const uint8_t colour, uint32_t *const id);
+uint32_t it8951_trace_count(const stIT8951_Handler_t *hdlr);
+void it8951_trace_reset(stIT8951_Handler_t *hdlr);
+bool it8951_trace_dump_binary(const stIT8951_Handler_t *hdlr, FILE *out);
+bool it8951_trace_dump_csv(const stIT8951_Handler_t *hdlr, FILE *out);
 uint32_t rectangle_get_area(const stRectangle_t *const rect);
+bool rectangle_is_contained_within(const stRectangle_t *const rect1, const stRectangle_t *const rect2);
+bool rectangle_intersects(const stRectangle_t *const rect1, const stRectangle_t *const rect2);
+stRectangle_t rectangle_union(const stRectangle_t *const rect1, const stRectangle_t *const rect2);
 char *rectangle_to_string(const stRectangle_t *const rect, char *buff);
 
 #endif
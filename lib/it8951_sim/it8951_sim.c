@@ -0,0 +1,773 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "it8951_sim.h"
+
+/// @brief Registers the model keeps. LUTAFSR is computed from the LUT engines
+#define SIM_REGISTER_COUNT (16)
+/// @brief Max number of arguments of a command
+#define SIM_MAX_ARGS (8)
+/// @brief Words of the GET_DEV_INFO reply
+#define SIM_DEV_INFO_WORDS (sizeof(stIT8951_DeviceInfo_t)/sizeof(uint16_t))
+
+typedef struct stSimLutEngine {
+    uint64_t end_ns;
+    stRectangle_t rect;
+    bool is_1bpp;
+} stSimLutEngine_t;
+
+static struct {
+    stIT8951_SimConfig_t cfg;
+    uint8_t *sdram;
+    // Gray level of every panel pixel, 8bpp
+    uint8_t *panel;
+    uint64_t now_ns;
+    // The HRDY is low until then
+    uint64_t hrdy_ready_ns;
+    stSimLutEngine_t luts[IT8951_LUT_ENGINE_COUNT];
+    struct {
+        uint16_t addr, val;
+    } regs[SIM_REGISTER_COUNT];
+    uint32_t reg_count;
+    bool is_2bpp_mode;
+    bool temperature_forced;
+    int16_t forced_temperature;
+
+    // Packet in progress, i.e. bytes clocked since the nCS went low
+    bool ncs_low;
+    uint32_t pkt_bytes;
+    uint16_t preamble;
+    uint8_t hi_byte;
+    uint16_t read_word;
+
+    // Last command and its arguments
+    uint16_t cmd;
+    uint16_t args[SIM_MAX_ARGS];
+    uint32_t arg_count;
+    uint32_t arg_need;
+
+    // Reply of the last command, clocked out by the READ_DATA packets
+    uint16_t reply[SIM_DEV_INFO_WORDS];
+    uint32_t reply_count;
+    uint32_t reply_idx;
+
+    // Pixel data of LD_IMG/LD_IMG_AREA
+    struct {
+        bool active;
+        eIT8951_RotationMode_t rotation;
+        eIT8951_ColorDepth_t bpp;
+        bool big_endian;
+        stRectangle_t rect;
+        uint32_t base;
+        uint32_t slot_bits;
+        uint32_t pix_per_word;
+        uint32_t pad;
+        uint32_t words_per_row;
+        uint32_t words;
+    } load;
+
+    // MEM_BST_WR data and MEM_BST_RD_S reply
+    struct {
+        bool write, read;
+        uint32_t addr;
+        uint32_t remaining;
+    } burst;
+
+    stIT8951_SimStats_t stats;
+    char last_error[96];
+} sim;
+
+static void sim_error(const char *const msg, const uint32_t val) {
+    sim.stats.protocol_errors++;
+    snprintf(sim.last_error, sizeof(sim.last_error), "%s (cmd 0x%04x, 0x%lx)", msg, sim.cmd, (unsigned long)val);
+}
+
+static uint16_t sim_read_reg(const uint16_t addr) {
+    if(addr == IT8951_REGISTER_LUTAFSR) {
+        uint16_t busy = 0;
+        for(uint32_t i=0; i<IT8951_LUT_ENGINE_COUNT; i++) {
+            busy |= (sim.luts[i].end_ns > sim.now_ns) << i;
+        }
+        return busy;
+    }
+    for(uint32_t i=0; i<sim.reg_count; i++) {
+        if(sim.regs[i].addr == addr) {
+            return sim.regs[i].val;
+        }
+    }
+    return 0;
+}
+
+static void sim_write_reg(const uint16_t addr, const uint16_t val) {
+    uint32_t i = 0;
+    while(i < sim.reg_count && sim.regs[i].addr != addr) {
+        i++;
+    }
+    if(i == SIM_REGISTER_COUNT) {
+        sim_error("Too many registers written", addr);
+        return;
+    }
+    sim.regs[i].addr = addr;
+    sim.regs[i].val = val;
+    sim.reg_count += (i == sim.reg_count);
+}
+
+static uint32_t sim_img_buff_addr(void) {
+    return ((uint32_t)sim_read_reg(IT8951_REGISTER_LISAR_H) << 16) | sim_read_reg(IT8951_REGISTER_LISAR_L);
+}
+
+static bool sim_rect_in_panel(const stRectangle_t *const rect) {
+    return rect->width && rect->height &&
+           (uint32_t)rect->x + rect->width <= sim.cfg.panel_width &&
+           (uint32_t)rect->y + rect->height <= sim.cfg.panel_height;
+}
+
+/// @brief Checks that a buffer of the panel's size at addr fits the SDRAM
+static bool sim_buff_in_sdram(const uint32_t addr) {
+    return (uint64_t)addr + (uint32_t)sim.cfg.panel_width*sim.cfg.panel_height <= sim.cfg.sdram_size;
+}
+
+/// @brief Maps an image pixel of a rotated load to the panel, the reverse of
+/// it8951_rotate_rect()
+static void sim_rotate_point(const eIT8951_RotationMode_t rotation, const uint32_t u, const uint32_t v,
+                             uint32_t *const x, uint32_t *const y) {
+    const uint32_t pw = sim.cfg.panel_width, ph = sim.cfg.panel_height;
+    switch(rotation) {
+    case IT8951_ROTATION_MODE_90:  *x = pw-1-v; *y = u;       break;
+    case IT8951_ROTATION_MODE_180: *x = pw-1-u; *y = ph-1-v;  break;
+    case IT8951_ROTATION_MODE_270: *x = v;      *y = ph-1-u;  break;
+    default:                       *x = u;      *y = v;       break;
+    }
+}
+
+static void sim_load_begin(const uint16_t info, const stRectangle_t *const rect) {
+    const uint32_t rotation = info & 0xF;
+    const uint32_t bpp = (info >> 4) & 0xF;
+    if(rotation > IT8951_ROTATION_MODE_270 || bpp > IT8951_COLOR_DEPTH_BPP_8BIT) {
+        sim_error("Invalid image info", info);
+        return;
+    }
+    const bool swap = rotation == IT8951_ROTATION_MODE_90 || rotation == IT8951_ROTATION_MODE_270;
+    const uint32_t image_w = swap ? sim.cfg.panel_height : sim.cfg.panel_width;
+    const uint32_t image_h = swap ? sim.cfg.panel_width : sim.cfg.panel_height;
+    if(!rect->width || !rect->height || (uint32_t)rect->x + rect->width > image_w ||
+       (uint32_t)rect->y + rect->height > image_h) {
+        sim_error("Load area outside of the image", (rect->x << 16) | rect->y);
+        return;
+    }
+    const uint32_t base = sim_img_buff_addr();
+    if(!sim_buff_in_sdram(base)) {
+        sim_error("Image buffer outside of the SDRAM", base);
+        return;
+    }
+
+    // The 3bpp pixels take 4bit slots, see eIT8951_ColorDepth_t
+    static const uint32_t slot_bits[] = {2, 4, 4, 8};
+    sim.load.active = true;
+    sim.load.rotation = rotation;
+    sim.load.bpp = bpp;
+    sim.load.big_endian = ((info >> 8) & 0xFF) == IT8951_ENDIANNESS_BIG;
+    sim.load.rect = *rect;
+    sim.load.base = base;
+    sim.load.slot_bits = slot_bits[bpp];
+    sim.load.pix_per_word = 16/sim.load.slot_bits;
+    // Every row starts with the word of its first pixel and is padded to whole
+    // words, like the driver packs it
+    sim.load.pad = rect->x % sim.load.pix_per_word;
+    sim.load.words_per_row = (sim.load.pad + rect->width + sim.load.pix_per_word-1)/sim.load.pix_per_word;
+    sim.load.words = 0;
+}
+
+/// @brief Converts a pixel slot of a load to the 8bpp the IT8951 stores
+static uint8_t sim_slot_to_gray(const uint32_t slot) {
+    switch(sim.load.bpp) {
+    case IT8951_COLOR_DEPTH_BPP_2BIT:
+        // Without the BPP_SETTINGS the 2bpp white is not white
+        return sim.is_2bpp_mode ? slot*0x55 : slot << 6;
+    case IT8951_COLOR_DEPTH_BPP_3BIT:
+        return (slot & 0xE) << 4;
+    case IT8951_COLOR_DEPTH_BPP_4BIT:
+        return slot << 4;
+    default:
+        return slot;
+    }
+}
+
+static void sim_load_word(const uint8_t b0, const uint8_t b1) {
+    const uint32_t row = sim.load.words/sim.load.words_per_row;
+    const uint32_t first = (sim.load.words % sim.load.words_per_row)*sim.load.pix_per_word;
+    sim.load.words++;
+    if(row >= sim.load.rect.height) {
+        if(row == sim.load.rect.height && first == 0) {
+            sim_error("Image data past the load area", sim.load.words);
+        }
+        return;
+    }
+
+    // The big-endian words are filled from the MSB, the little-endian ones
+    // from the LSB
+    const uint32_t word = sim.load.big_endian ? ((b0 << 8) | b1) : ((b1 << 8) | b0);
+    const uint32_t bits = sim.load.slot_bits;
+    for(uint32_t s=0; s<sim.load.pix_per_word; s++) {
+        const int32_t col = (int32_t)(first + s) - (int32_t)sim.load.pad;
+        if(col < 0 || col >= sim.load.rect.width) {
+            continue;
+        }
+        const uint32_t shift = sim.load.big_endian ? (16 - (s+1)*bits) : (s*bits);
+        const uint32_t slot = (word >> shift) & ((1u << bits) - 1);
+        uint32_t x, y;
+        sim_rotate_point(sim.load.rotation, sim.load.rect.x + col, sim.load.rect.y + row, &x, &y);
+        sim.sdram[sim.load.base + y*sim.cfg.panel_width + x] = sim_slot_to_gray(slot);
+        sim.stats.pixels_loaded++;
+    }
+}
+
+/// @brief Gray level the panel ends up with after the waveform. DU and A2
+/// only drive black and white, DU4 4 levels and the others 16 levels.
+static uint8_t sim_waveform_gray(const eIT8951_DisplayMode_t mode, const uint8_t gray) {
+    const uint32_t level = gray >> 4;
+    switch(mode) {
+    case IT8951_DISPLAY_MODE_INIT:
+        return 0xFF;
+    case IT8951_DISPLAY_MODE_DU:
+    case IT8951_DISPLAY_MODE_A2:
+        return (level >= 8) ? 0xFF : 0x00;
+    case IT8951_DISPLAY_MODE_DU4:
+        return ((level + 2)/5)*5*0x11;
+    default:
+        return level*0x11;
+    }
+}
+
+/// @brief Waveform duration, with the same temperature model as
+/// it8951_update_estimate_duration()
+static uint64_t sim_waveform_ns(const eIT8951_DisplayMode_t mode) {
+    const int16_t temp = sim.temperature_forced ? sim.forced_temperature : sim.cfg.temperature;
+    uint64_t ms = IT8951_DISPLAY_MODE_DURATION_MS_MAP[mode];
+    if(temp < IT8951_NOMINAL_TEMPERATURE_C) {
+        ms += (ms*(IT8951_NOMINAL_TEMPERATURE_C - temp)*IT8951_DURATION_PERCENT_PER_C)/100;
+    }
+    return ms*1000000ull;
+}
+
+/// @brief Starts a display update of the panel area from the image buffer at
+/// addr on a free LUT engine. If all the engines are busy, the IT8951 holds
+/// the HRDY low until one finishes.
+static void sim_display(const stRectangle_t *const rect, const uint32_t mode, const uint32_t addr) {
+    if(!sim_rect_in_panel(rect) || mode > IT8951_DISPLAY_MODE_DU4) {
+        sim_error("Invalid display area or mode", mode);
+        return;
+    }
+    if(!sim_buff_in_sdram(addr)) {
+        sim_error("Display buffer outside of the SDRAM", addr);
+        return;
+    }
+
+    uint32_t free_lut = IT8951_LUT_ENGINE_COUNT;
+    uint64_t first_end = UINT64_MAX;
+    for(uint32_t i=0; i<IT8951_LUT_ENGINE_COUNT; i++) {
+        if(sim.luts[i].end_ns <= sim.now_ns) {
+            free_lut = (free_lut == IT8951_LUT_ENGINE_COUNT) ? i : free_lut;
+        } else if(sim.luts[i].end_ns < first_end) {
+            first_end = sim.luts[i].end_ns;
+        }
+    }
+    if(free_lut == IT8951_LUT_ENGINE_COUNT) {
+        sim.stats.lut_stalls++;
+        sim.stats.lut_stall_ns += first_end - sim.now_ns;
+        sim.now_ns = first_end;
+        sim.hrdy_ready_ns = first_end;
+        for(free_lut=0; sim.luts[free_lut].end_ns > sim.now_ns; free_lut++);
+    }
+
+    const bool is_1bpp = (sim_read_reg(IT8951_REGISTER_UP1SR_H) & IT8951_UP1SR_H_1BPP_ENABLE) != 0;
+    for(uint32_t i=0; i<IT8951_LUT_ENGINE_COUNT; i++) {
+        const stSimLutEngine_t *const lut = &sim.luts[i];
+        if(lut->end_ns > sim.now_ns &&
+           (is_1bpp || lut->is_1bpp || rectangle_intersects(&lut->rect, rect))) {
+            sim.stats.conflicts++;
+            break;
+        }
+    }
+
+    // The panel shows the result as soon as the waveform starts
+    const uint16_t bgvr = sim_read_reg(IT8951_REGISTER_BGVR);
+    for(uint32_t y=rect->y; y<(uint32_t)rect->y + rect->height; y++) {
+        const uint8_t *const row = &sim.sdram[addr + y*sim.cfg.panel_width];
+        for(uint32_t x=rect->x; x<(uint32_t)rect->x + rect->width; x++) {
+            uint8_t gray = row[x];
+            if(is_1bpp) {
+                // The 1 bits are shown with the low byte of BGVR
+                gray = ((row[x/8] >> (7 - x%8)) & 1) ? (bgvr & 0xFF) : (bgvr >> 8);
+            }
+            sim.panel[y*sim.cfg.panel_width + x] = sim_waveform_gray(mode, gray);
+        }
+    }
+    sim.luts[free_lut] = (stSimLutEngine_t){
+        .end_ns  = sim.now_ns + sim_waveform_ns(mode),
+        .rect    = *rect,
+        .is_1bpp = is_1bpp,
+    };
+    sim.stats.updates++;
+    sim.stats.pixels_updated += (uint32_t)rect->width*rect->height;
+}
+
+static void sim_fill_rect(const stRectangle_t *const rect, const uint16_t mode, const uint8_t colour) {
+    if(!sim_rect_in_panel(rect)) {
+        sim_error("Fill area outside of the panel", (rect->x << 16) | rect->y);
+        return;
+    }
+    for(uint32_t y=rect->y; y<(uint32_t)rect->y + rect->height; y++) {
+        memset(&sim.sdram[sim.cfg.img_buff_addr + y*sim.cfg.panel_width + rect->x], colour, rect->width);
+    }
+    sim.stats.fills++;
+    sim_display(rect, mode & 0xFF, sim.cfg.img_buff_addr);
+}
+
+static void sim_set_reply(const uint16_t *const words, const uint32_t count) {
+    memcpy(sim.reply, words, count*sizeof(*words));
+    sim.reply_count = count;
+    sim.reply_idx = 0;
+}
+
+/// @brief Executes the command once all its arguments arrived
+static void sim_execute(void) {
+    const uint16_t *const a = sim.args;
+    sim.hrdy_ready_ns = sim.now_ns + sim.cfg.command_us*1000ull;
+
+    switch(sim.cmd) {
+    case IT8951_COMMAND_REG_RD:
+        sim_set_reply((uint16_t[]){sim_read_reg(a[0])}, 1);
+        break;
+    case IT8951_COMMAND_REG_WR:
+        sim_write_reg(a[0], a[1]);
+        break;
+    case IT8951_COMMAND_MEM_BST_WR:
+    case IT8951_COMMAND_MEM_BST_RD_T: {
+        const uint32_t addr = ((uint32_t)a[1] << 16) | a[0];
+        const uint32_t bytes = (((uint32_t)a[3] << 16) | a[2])*sizeof(uint16_t);
+        if((uint64_t)addr + bytes > sim.cfg.sdram_size) {
+            sim_error("Burst outside of the SDRAM", addr);
+            break;
+        }
+        sim.burst.write = sim.cmd == IT8951_COMMAND_MEM_BST_WR;
+        sim.burst.addr = addr;
+        sim.burst.remaining = bytes;
+        break;
+    }
+    case IT8951_COMMAND_MEM_BST_RD_S:
+        sim.burst.read = sim.burst.remaining > 0;
+        break;
+    case IT8951_COMMAND_LD_IMG: {
+        // The full image of a 90/270 degree load is the rotated panel
+        const bool swap = (a[0] & 0xF) == IT8951_ROTATION_MODE_90 || (a[0] & 0xF) == IT8951_ROTATION_MODE_270;
+        sim_load_begin(a[0], &(stRectangle_t){0, 0, swap ? sim.cfg.panel_height : sim.cfg.panel_width,
+                                                    swap ? sim.cfg.panel_width : sim.cfg.panel_height});
+        break;
+    }
+    case IT8951_COMMAND_LD_IMG_AREA:
+        sim_load_begin(a[0], &(stRectangle_t){a[1], a[2], a[3], a[4]});
+        break;
+    case IT8951_COMMAND_DPY_AREA:
+        sim_display(&(stRectangle_t){a[0], a[1], a[2], a[3]}, a[4], sim.cfg.img_buff_addr);
+        break;
+    case IT8951_COMMAND_DPY_BUF_AREA:
+        sim_display(&(stRectangle_t){a[0], a[1], a[2], a[3]}, a[4], ((uint32_t)a[6] << 16) | a[5]);
+        break;
+    case IT8951_COMMAND_FILL_RECT:
+        sim_fill_rect(&(stRectangle_t){a[0], a[1], a[2], a[3]}, a[4], a[5]);
+        break;
+    case IT8951_COMMAND_CMD_VCOM:
+        if(a[0] == 0) {
+            sim_set_reply((uint16_t[]){(uint16_t)(-sim.cfg.vcom_mv)}, 1);
+        } else {
+            sim.cfg.vcom_mv = -(int32_t)a[1];
+        }
+        break;
+    case IT8951_COMMAND_CMD_TEMPERATURE:
+        if(a[0] == 0) {
+            sim_set_reply((uint16_t[]){sim.cfg.temperature, sim.forced_temperature}, 2);
+        }
+        sim.temperature_forced = (a[0] == 1) || (sim.temperature_forced && a[0] == 0);
+        sim.forced_temperature = (a[0] == 1) ? a[1] : sim.forced_temperature;
+        break;
+    case IT8951_COMMAND_BPP_SETTINGS:
+        sim.is_2bpp_mode = a[0] != 0;
+        break;
+    case IT8951_COMMAND_GET_DEV_INFO: {
+        uint16_t info[SIM_DEV_INFO_WORDS] = {sim.cfg.panel_width, sim.cfg.panel_height,
+                                             (uint16_t)sim.cfg.img_buff_addr, (uint16_t)(sim.cfg.img_buff_addr >> 16)};
+        // Strings are sent with the first character in the high byte
+        static const char version[] = "SIM_0.1";
+        for(uint32_t i=0; i<sizeof(version); i+=2) {
+            info[4 + i/2] = info[12 + i/2] = (version[i] << 8) | ((i+1 < sizeof(version)) ? version[i+1] : 0);
+        }
+        sim_set_reply(info, SIM_DEV_INFO_WORDS);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/// @brief Number of arguments of the command, given the ones received so far
+static uint32_t sim_arg_count(const uint16_t cmd) {
+    switch(cmd) {
+    case IT8951_COMMAND_REG_RD:
+    case IT8951_COMMAND_LD_IMG:
+    case IT8951_COMMAND_POWER_SEQUENCE:
+    case IT8951_COMMAND_BPP_SETTINGS:
+        return 1;
+    case IT8951_COMMAND_REG_WR:
+        return 2;
+    case IT8951_COMMAND_MEM_BST_RD_T:
+    case IT8951_COMMAND_MEM_BST_WR:
+        return 4;
+    case IT8951_COMMAND_LD_IMG_AREA:
+    case IT8951_COMMAND_DPY_AREA:
+        return 5;
+    case IT8951_COMMAND_FILL_RECT:
+        return 6;
+    case IT8951_COMMAND_DPY_BUF_AREA:
+        return 7;
+    case IT8951_COMMAND_CMD_VCOM:
+        // Get: 0, set: 1/2 and the value
+        return (sim.arg_count == 0 || sim.args[0] == 0) ? 1 : 2;
+    case IT8951_COMMAND_CMD_TEMPERATURE:
+        // Get: 0, force: 1 and the value, cancel: 2
+        return (sim.arg_count == 0 || sim.args[0] != 1) ? 1 : 2;
+    default:
+        return 0;
+    }
+}
+
+static void sim_command(const uint16_t cmd) {
+    sim.stats.commands++;
+    if(sim.load.active && cmd != IT8951_COMMAND_LD_IMG_END) {
+        sim_error("Image load not terminated", cmd);
+    }
+    if((sim.burst.write || sim.burst.read) && cmd != IT8951_COMMAND_MEM_BST_END &&
+       cmd != IT8951_COMMAND_MEM_BST_RD_S) {
+        sim_error("Memory burst not terminated", cmd);
+    }
+    sim.load.active = false;
+    sim.burst.write = sim.burst.read = false;
+    sim.reply_count = sim.reply_idx = 0;
+    sim.cmd = cmd;
+    sim.arg_count = 0;
+    if(!IsEnum_eIT8951_Command(cmd) || cmd == IT8951_COMMAND_LD_IMG_1BPP) {
+        sim_error("Unknown command", cmd);
+        sim.arg_need = 0;
+        return;
+    }
+    sim.arg_need = sim_arg_count(cmd);
+    if(sim.arg_need == 0) {
+        sim_execute();
+    }
+}
+
+/// @brief Processes a word of a WRITE_DATA packet: an argument of the last
+/// command, or the data of an image load or of a burst write
+static void sim_write_word(const uint8_t b0, const uint8_t b1) {
+    if(sim.arg_count < sim.arg_need) {
+        sim.args[sim.arg_count++] = (b0 << 8) | b1;
+        sim.arg_need = sim_arg_count(sim.cmd);
+        if(sim.arg_count == sim.arg_need) {
+            sim_execute();
+        }
+    } else if(sim.load.active) {
+        sim_load_word(b0, b1);
+    } else if(sim.burst.write && sim.burst.remaining) {
+        sim.sdram[sim.burst.addr++] = b0;
+        sim.sdram[sim.burst.addr++] = b1;
+        sim.burst.remaining -= 2;
+    } else {
+        sim_error("Unexpected data", (b0 << 8) | b1);
+    }
+}
+
+/// @brief Gets the next word a READ_DATA packet clocks out
+static uint16_t sim_read_word(void) {
+    if(sim.burst.read && sim.burst.remaining) {
+        const uint16_t word = (sim.sdram[sim.burst.addr] << 8) | sim.sdram[sim.burst.addr+1];
+        sim.burst.addr += 2;
+        sim.burst.remaining -= 2;
+        return word;
+    }
+    if(sim.reply_idx < sim.reply_count) {
+        return sim.reply[sim.reply_idx++];
+    }
+    sim_error("Read without data", sim.reply_idx);
+    return 0;
+}
+
+/// @brief Clocks a byte of the packet in progress
+/// @return The byte the IT8951 clocks out meanwhile
+static uint8_t sim_clock_byte(const uint8_t tx) {
+    const uint32_t idx = sim.pkt_bytes++;
+    if(!sim.ncs_low) {
+        if(idx == 0) {
+            sim_error("Transfer with nCS high", 0);
+        }
+        return 0;
+    }
+    if(idx < 2) {
+        sim.preamble = (idx == 0) ? (tx << 8) : (sim.preamble | tx);
+        return 0;
+    }
+
+    switch(sim.preamble) {
+    case IT8951_SPI_PREAMBLE_COMMAND:
+        if(idx == 3) {
+            sim_command((sim.hi_byte << 8) | tx);
+        } else if(idx > 3) {
+            sim_error("Command packet too long", idx);
+        }
+        break;
+    case IT8951_SPI_PREAMBLE_WRITE_DATA:
+        if(idx & 1) {
+            sim_write_word(sim.hi_byte, tx);
+        }
+        break;
+    case IT8951_SPI_PREAMBLE_READ_DATA:
+        // The word after the preamble is a dummy
+        if(idx >= 4) {
+            if((idx & 1) == 0) {
+                sim.read_word = sim_read_word();
+                return sim.read_word >> 8;
+            }
+            return sim.read_word & 0xFF;
+        }
+        break;
+    default:
+        if(idx == 2) {
+            sim_error("Invalid preamble", sim.preamble);
+        }
+        break;
+    }
+    sim.hi_byte = tx;
+    return 0;
+}
+
+static bool sim_spi_transcieve(const void *txdata, void *rxdata, size_t len) {
+    const uint8_t *const tx = txdata;
+    uint8_t *const rx = rxdata;
+    for(size_t i=0; i<len; i++) {
+        const uint8_t byte = sim_clock_byte(tx ? tx[i] : 0);
+        if(rx) {
+            rx[i] = byte;
+        }
+    }
+    sim.now_ns += (len*8ull*1000000000ull)/sim.cfg.spi_clock_hz;
+    sim.stats.spi_transfers++;
+    sim.stats.spi_bytes += len;
+    return true;
+}
+
+// The transfers are modelled when queued, there is nothing left to wait for
+static bool sim_spi_transmit_async(const void *txdata, size_t len) {
+    return sim_spi_transcieve(txdata, NULL, len);
+}
+
+static bool sim_spi_wait_async(void) {
+    return true;
+}
+
+static void sim_set_ncs(bool state) {
+    sim.ncs_low = !state;
+    sim.pkt_bytes = 0;
+}
+
+static void sim_wait_hrdy(void) {
+    if(sim.hrdy_ready_ns > sim.now_ns) {
+        sim.stats.hrdy_wait_ns += sim.hrdy_ready_ns - sim.now_ns;
+        sim.now_ns = sim.hrdy_ready_ns;
+    }
+}
+
+static uint32_t sim_get_time_ms(void) {
+    return (uint32_t)(sim.now_ns/1000000);
+}
+
+static uint32_t sim_get_time_us(void) {
+    return (uint32_t)(sim.now_ns/1000);
+}
+
+static void sim_sleep_ms(uint32_t ms) {
+    sim.now_ns += ms*1000000ull;
+}
+
+/// @brief Creates the simulated IT8951. The image buffers and the panel start
+/// white.
+/// @param cfg Configuration, e.g. IT8951_SIM_CONFIG_DEFAULT
+/// @return False if the memory could not be allocated
+bool it8951_sim_init(const stIT8951_SimConfig_t *const cfg) {
+    it8951_sim_deinit();
+    if(!cfg->spi_clock_hz || cfg->img_buff_addr + (uint64_t)cfg->panel_width*cfg->panel_height > cfg->sdram_size) {
+        return false;
+    }
+    sim.cfg = *cfg;
+    sim.sdram = malloc(cfg->sdram_size);
+    sim.panel = malloc((size_t)cfg->panel_width*cfg->panel_height);
+    if(!sim.sdram || !sim.panel) {
+        it8951_sim_deinit();
+        return false;
+    }
+    memset(sim.sdram, 0xFF, cfg->sdram_size);
+    memset(sim.panel, 0xFF, (size_t)cfg->panel_width*cfg->panel_height);
+    sim_write_reg(IT8951_REGISTER_LISAR_L, (uint16_t)cfg->img_buff_addr);
+    sim_write_reg(IT8951_REGISTER_LISAR_H, (uint16_t)(cfg->img_buff_addr >> 16));
+    return true;
+}
+
+void it8951_sim_deinit(void) {
+    free(sim.sdram);
+    free(sim.panel);
+    memset(&sim, 0, sizeof(sim));
+}
+
+/// @brief Points the transport, timing and HRDY callbacks of the handler to
+/// the simulator. The asynchronous transport is set too, so that the DMA
+/// paths of the driver are exercised.
+/// @param hdlr Pointer to the IT8951 handler
+void it8951_sim_attach(stIT8951_Handler_t *hdlr) {
+    hdlr->spi_transcieve     = sim_spi_transcieve;
+    hdlr->set_ncs            = sim_set_ncs;
+    hdlr->wait_hrdy          = sim_wait_hrdy;
+    hdlr->spi_transmit_async = sim_spi_transmit_async;
+    hdlr->spi_wait_async     = sim_spi_wait_async;
+    hdlr->get_time_ms        = sim_get_time_ms;
+    hdlr->get_time_us        = sim_get_time_us;
+    hdlr->sleep_ms           = sim_sleep_ms;
+}
+
+/// @brief Gets the virtual time [ns]
+uint64_t it8951_sim_time_ns(void) {
+    return sim.now_ns;
+}
+
+/// @brief Advances the virtual time, e.g. by the host's processing time
+void it8951_sim_advance_ns(const uint64_t ns) {
+    sim.now_ns += ns;
+}
+
+const stIT8951_SimStats_t *it8951_sim_stats(void) {
+    return &sim.stats;
+}
+
+void it8951_sim_reset_stats(void) {
+    sim.stats = (stIT8951_SimStats_t){0};
+    sim.last_error[0] = '\0';
+}
+
+/// @brief Gets the description of the last protocol error, empty if none
+const char *it8951_sim_last_error(void) {
+    return sim.last_error;
+}
+
+/// @brief Gets the 8bit gray level a panel pixel shows
+uint8_t it8951_sim_get_pixel(const uint16_t x, const uint16_t y) {
+    assert(x < sim.cfg.panel_width && y < sim.cfg.panel_height);
+    return sim.panel[(uint32_t)y*sim.cfg.panel_width + x];
+}
+
+/// @brief Gets the modelled SDRAM, e.g. to check an image buffer
+const uint8_t *it8951_sim_sdram(void) {
+    return sim.sdram;
+}
+
+static uint32_t png_crc(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    while(len--) {
+        crc ^= *data++;
+        for(uint32_t k=0; k<8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static bool png_write(FILE *out, const void *data, const size_t len, uint32_t *const crc) {
+    *crc = png_crc(*crc, data, len);
+    return fwrite(data, 1, len, out) == len;
+}
+
+static bool png_write_u32(FILE *out, const uint32_t val, uint32_t *const crc) {
+    const uint8_t be[4] = {val >> 24, val >> 16, val >> 8, val};
+    return png_write(out, be, sizeof(be), crc);
+}
+
+/// @brief Writes what the panel shows as an 8bit grayscale PNG. The image
+/// data is stored uncompressed, so that no zlib is needed.
+/// @param out Stream to write to, opened in binary mode
+/// @return True on success
+bool it8951_sim_dump_png(FILE *out) {
+    assert(out && sim.panel);
+    const uint32_t width = sim.cfg.panel_width, height = sim.cfg.panel_height;
+    // Each row is prefixed with its filter type (none), and the zlib stream is
+    // made of stored deflate blocks of at most 65535 bytes
+    const uint64_t raw = (uint64_t)height*(width + 1);
+    const uint64_t blocks = (raw + 0xFFFE)/0xFFFF;
+    const uint64_t idat = 2 + raw + 5*blocks + 4;
+    if(idat > UINT32_MAX) {
+        return false;
+    }
+
+    uint32_t crc = 0;
+    bool status = fwrite("\x89PNG\r\n\x1a\n", 1, 8, out) == 8;
+    status = status && png_write_u32(out, 13, &crc);
+    crc = 0;
+    status = status && png_write(out, "IHDR", 4, &crc) && png_write_u32(out, width, &crc) &&
+             png_write_u32(out, height, &crc) && png_write(out, (uint8_t[]){8, 0, 0, 0, 0}, 5, &crc);
+    status = status && png_write_u32(out, crc, &(uint32_t){0});
+
+    status = status && png_write_u32(out, (uint32_t)idat, &(uint32_t){0});
+    crc = 0;
+    status = status && png_write(out, "IDAT", 4, &crc) && png_write(out, (uint8_t[]){0x78, 0x01}, 2, &crc);
+    uint32_t adler_a = 1, adler_b = 0;
+    uint64_t pos = 0;
+    while(status && pos < raw) {
+        const uint32_t len = (raw - pos > 0xFFFF) ? 0xFFFF : (uint32_t)(raw - pos);
+        const uint8_t header[5] = {pos + len == raw, len, len >> 8, ~len, (~len) >> 8};
+        status = png_write(out, header, sizeof(header), &crc);
+        for(uint32_t i=0; i<len && status; ) {
+            // Runs of the block within a single row
+            const uint32_t row = (pos + i)/(width + 1);
+            const uint32_t col = (pos + i)%(width + 1);
+            const uint8_t *const src = (col == 0) ? (const uint8_t[]){0} : &sim.panel[row*width + col-1];
+            const uint32_t run = (col == 0) ? 1 : ((width + 1 - col < len - i) ? width + 1 - col : len - i);
+            for(uint32_t k=0; k<run; k++) {
+                adler_a = (adler_a + src[k]) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+            status = png_write(out, src, run, &crc);
+            i += run;
+        }
+        pos += len;
+    }
+    status = status && png_write_u32(out, (adler_b << 16) | adler_a, &crc);
+    status = status && png_write_u32(out, crc, &(uint32_t){0});
+
+    crc = 0;
+    status = status && png_write_u32(out, 0, &(uint32_t){0}) && png_write(out, "IEND", 4, &crc);
+    status = status && png_write_u32(out, crc, &(uint32_t){0});
+    return status;
+}
+
+/// @brief Prints the statistics and the throughput in the virtual time
+/// @param out Stream to print to, e.g. stdout
+void it8951_sim_print_stats(FILE *out) {
+    const stIT8951_SimStats_t *const s = &sim.stats;
+    const double sec = sim.now_ns/1e9;
+    fprintf(out, "IT8951 sim: %.3f s, %lu commands, %lu transfers, %llu bytes (%.2f MB/s), "
+                 "%llu px loaded (%.2f Mpx/s), HRDY wait %.3f ms\n",
+            sec, (unsigned long)s->commands, (unsigned long)s->spi_transfers, (unsigned long long)s->spi_bytes,
+            sec > 0 ? s->spi_bytes/sec/1e6 : 0, (unsigned long long)s->pixels_loaded,
+            sec > 0 ? s->pixels_loaded/sec/1e6 : 0, s->hrdy_wait_ns/1e6);
+    fprintf(out, "IT8951 sim: %lu updates (%lu fills, %llu px, %.1f/s), %lu LUT stalls (%.3f ms), "
+                 "%lu conflicts, %lu protocol errors%s%s\n",
+            (unsigned long)s->updates, (unsigned long)s->fills, (unsigned long long)s->pixels_updated,
+            sec > 0 ? s->updates/sec : 0, (unsigned long)s->lut_stalls, s->lut_stall_ns/1e6,
+            (unsigned long)s->conflicts, (unsigned long)s->protocol_errors,
+            s->protocol_errors ? ", last: " : "", sim.last_error);
+}
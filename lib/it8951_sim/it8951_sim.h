@@ -0,0 +1,84 @@
+#ifndef __IT8951_SIM_H__
+#define __IT8951_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "it8951.h"
+
+// Host-side model of the IT8951 behind the stIT8951_Handler_t callbacks. It
+// parses the SPI packets the driver sends, keeps the image buffers in a model
+// of the SDRAM and the panel's gray levels, and runs a virtual clock: the SPI
+// transfers, the HRDY waits and the waveforms of the LUT engines advance it,
+// so the driver's scheduler sees realistic LUT-busy timings without sleeping.
+// The handler callbacks take no context, so there is a single simulator.
+
+/// @brief Image buffer address reported by the VB3300-KCA's IT8951
+#define IT8951_SIM_IMG_BUFF_ADDR (0x001236E0)
+
+typedef struct stIT8951_SimConfig {
+    uint16_t panel_width;
+    uint16_t panel_height;
+    /// @brief Default image buffer address, reported in the device info
+    uint32_t img_buff_addr;
+    /// @brief Size of the modelled SDRAM [bytes]
+    uint32_t sdram_size;
+    /// @brief SPI clock the transfer times are modelled with [Hz]
+    uint32_t spi_clock_hz;
+    /// @brief Time the HRDY stays low after each command [us]
+    uint32_t command_us;
+    /// @brief Temperature the IT8951 reports [C]
+    int16_t temperature;
+    /// @brief VCOM the IT8951 reports [mV]
+    int32_t vcom_mv;
+} stIT8951_SimConfig_t;
+
+/// @brief The 10.3" panel the firmware drives, on a 24MHz SPI
+#define IT8951_SIM_CONFIG_DEFAULT ((stIT8951_SimConfig_t){ \
+    .panel_width   = 1872,                                 \
+    .panel_height  = 1404,                                 \
+    .img_buff_addr = IT8951_SIM_IMG_BUFF_ADDR,             \
+    .sdram_size    = IT8951_SDRAM_SIZE,                    \
+    .spi_clock_hz  = 24000000,                             \
+    .command_us    = 10,                                   \
+    .temperature   = 25,                                   \
+    .vcom_mv       = -1500,                                \
+})
+
+typedef struct stIT8951_SimStats {
+    uint32_t commands;
+    uint32_t spi_transfers;
+    uint64_t spi_bytes;
+    /// @brief Pixels written into the image buffers by image loads
+    uint64_t pixels_loaded;
+    /// @brief Display updates, FILL_RECT included
+    uint32_t updates;
+    uint32_t fills;
+    uint64_t pixels_updated;
+    /// @brief Time the driver waited for the HRDY [ns]
+    uint64_t hrdy_wait_ns;
+    /// @brief Display commands that found all the LUT engines busy, and the
+    /// time they held the HRDY low for [ns]
+    uint32_t lut_stalls;
+    uint64_t lut_stall_ns;
+    /// @brief Display updates started over a running one, or mixing 1bpp and
+    /// other updates. The real IT8951 garbles these.
+    uint32_t conflicts;
+    /// @brief Malformed packets, unknown commands, out of bounds accesses...
+    uint32_t protocol_errors;
+} stIT8951_SimStats_t;
+
+bool it8951_sim_init(const stIT8951_SimConfig_t *const cfg);
+void it8951_sim_deinit(void);
+void it8951_sim_attach(stIT8951_Handler_t *hdlr);
+uint64_t it8951_sim_time_ns(void);
+void it8951_sim_advance_ns(const uint64_t ns);
+const stIT8951_SimStats_t *it8951_sim_stats(void);
+void it8951_sim_reset_stats(void);
+const char *it8951_sim_last_error(void);
+uint8_t it8951_sim_get_pixel(const uint16_t x, const uint16_t y);
+const uint8_t *it8951_sim_sdram(void);
+bool it8951_sim_dump_png(FILE *out);
+void it8951_sim_print_stats(FILE *out);
+
+#endif
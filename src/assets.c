@@ -0,0 +1,74 @@
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "assets.h"
+
+static const char *tag = "ASSETS";
+
+// The whole partition stays mapped, so the assets are read straight from the
+// flash through the cache
+static esp_partition_mmap_handle_t mmap_handle;
+static const uint8_t *pack = NULL;
+static const stAssetEntry_t *entries = NULL;
+static uint32_t entry_cnt = 0;
+
+/// @brief Maps the asset partition and validates the pack's index
+/// @return True if the assets are available
+bool assets_init(void) {
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ASSETS_PARTITION_SUBTYPE, 
+                                                           ASSETS_PARTITION_LABEL);
+    if(!part) {
+        ESP_LOGW(tag, "No \"%s\" partition", ASSETS_PARTITION_LABEL);
+        return false;
+    }
+    const void *ptr;
+    if(esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr, &mmap_handle) != ESP_OK) {
+        ESP_LOGE(tag, "Failed to map the asset partition");
+        return false;
+    }
+
+    const stAssetPackHeader_t *header = ptr;
+    const uint32_t index_size = sizeof(*header) + header->count*sizeof(stAssetEntry_t);
+    if(header->magic != ASSETS_MAGIC || header->version != ASSETS_VERSION || index_size > part->size) {
+        ESP_LOGW(tag, "No valid asset pack is flashed");
+        esp_partition_munmap(mmap_handle);
+        return false;
+    }
+    const stAssetEntry_t *index = (const stAssetEntry_t*)(header + 1);
+    for(uint32_t i=0; i<header->count; i++) {
+        const stAssetEntry_t *e = &index[i];
+        if((e->width % 4) != 0 || e->size != e->width*e->height/2u || (e->offset % 4) != 0 ||
+           e->offset < index_size || e->offset + e->size > part->size) {
+            ESP_LOGE(tag, "Corrupt asset entry %" PRIu32, i);
+            esp_partition_munmap(mmap_handle);
+            return false;
+        }
+    }
+
+    pack = ptr;
+    entries = index;
+    entry_cnt = header->count;
+    ESP_LOGI(tag, "%" PRIu32 " assets mapped", entry_cnt);
+    return true;
+}
+
+/// @brief Looks up an asset by its name
+/// @param name Name of the asset, its file name without the extension
+/// @param asset [out] The asset
+/// @return True if the asset was found
+bool assets_find(const char *const name, stAsset_t *const asset) {
+    assert(name && asset);
+    for(uint32_t i=0; i<entry_cnt; i++) {
+        if(strncmp(entries[i].name, name, ASSETS_NAME_LEN) == 0) {
+            *asset = (stAsset_t){
+                .name   = entries[i].name,
+                .width  = entries[i].width,
+                .height = entries[i].height,
+                .pixels = pack + entries[i].offset,
+            };
+            return true;
+        }
+    }
+    return false;
+}
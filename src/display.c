@@ -1,19 +1,23 @@
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
 #include "it8951.h"
+#include "esp_attr.h"
 #include "esp_log.h"
-#include "driver/gpio.h"
-#include "driver/spi_master.h"
-#include "hal/spi_ll.h"
+#include "esp_timer.h"
 #include "lvgl.h"
 #include "display.h"
+#include "waveform.h"
+#include "ghosting.h"
+#include "gray4.h"
+#include "display_spi.h"
 
+static const char *tag = "DISPLAY";
 static stIT8951_Handler_t it8951_hdlr;
-static spi_device_handle_t spi;
 
-static const gpio_num_t ncs = 34;
-static const gpio_num_t hrdy = 9;
-static const gpio_num_t spi_mosi = 35;
-static const gpio_num_t spi_miso = 37;
-static const gpio_num_t spi_clk = 36;
+// The shadow framebuffer, the flushed areas and the uploads are all in the 
+// rotated UI's coordinates. Only the display updates are in panel coordinates.
+#define DISPLAY_ROTATION ((eIT8951_RotationMode_t)(DISPLAY_ROTATION_DEG/90))
 
 #define min(a,b)             \
 ({                           \
@@ -22,103 +26,768 @@ static const gpio_num_t spi_clk = 36;
     _a < _b ? _a : _b;       \
 })
 
-// Max DMA transfer byte length on the ESP32-S3 is (1<<18)/8=32768. In a single 
-// transaction, the maximum amount of bytes we may want to tx is a full image at
-// 4bpp: 1872*1404/2. Therefore an SPI queue size of 
-// ceil((1872*1404/2)/32768)=41 can utilize the SPI+DMA fully.
-#define SPI_MAX_TRANSFER_SIZE (SPI_LL_DMA_MAX_BIT_LEN/8)
-// TODO: This needs a generic ROUND_UP macro
-#define SPI_QUEUE_SIZE (((DISPLAY_HOR_RES*DISPLAY_VER_RES)/(SPI_MAX_TRANSFER_SIZE*2ull))+1)
-static_assert(SPI_MAX_TRANSFER_SIZE <= SPI_MAX_TRANSFER_SIZE, "Adjust SPI transfer size");
-
-static inline bool it8951_transcieve(const void *txdata, void *rxdata, size_t len) {
-    // TODO: Could keep the CS active between transmissions! Would allow lower 
-    // power consumption .flags = SPI_TRANS_CS_KEEP_ACTIVE
-    // TODO: Is there a speed/power gain by using the .tx_data, .rx_data and 
-    // .flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA for len <= 4?
-    // TODO: Implement queues to speed things up!
-
-    int32_t bit_size = len*8;
-    uint32_t ptr_off = 0;
-    bool status = true;
-    while(bit_size > 0 && status) {
-        const int32_t bit_to_tx = min(SPI_LL_DMA_MAX_BIT_LEN, bit_size);
-        status = spi_device_polling_transmit(spi, &(spi_transaction_t) {
-            .length = bit_to_tx,
-            .tx_buffer = txdata ? (txdata + ptr_off) : NULL,
-            .rx_buffer = rxdata ? (rxdata + ptr_off) : NULL,
-        }) == ESP_OK;
-        bit_size -= bit_to_tx;
-        ptr_off += bit_to_tx/8;
+#define max(a,b)             \
+({                           \
+    __typeof__ (a) _a = (a); \
+    __typeof__ (b) _b = (b); \
+    _a > _b ? _a : _b;       \
+})
+
+// Packed 4bpp copy of the IT8951's image buffer. Each flushed area is diffed
+// against it, so only the rows and words that actually changed are sent
+EXT_RAM_BSS_ATTR static uint8_t shadow_fb[DISPLAY_VER_RES][DISPLAY_HOR_RES/2];
+// A row of the flushed area, converted before being diffed with the shadow
+WORD_ALIGNED_ATTR static uint8_t row_buff[DISPLAY_HOR_RES/2];
+
+// Regions of the screen converted with a dither, see display_set_dither(). 
+// The first one is the whole screen, and each later one takes precedence over
+// the ones before it.
+#define MAX_DITHER_REGIONS (8)
+static struct {
+    stRectangle_t rect;
+    eDisplayDither_t dither;
+    // Row the region's error in dither_err is for
+    uint32_t err_y;
+} dither_regions[MAX_DITHER_REGIONS] = {
+    {{0, 0, DISPLAY_HOR_RES, DISPLAY_VER_RES}, DISPLAY_DITHER, UINT32_MAX},
+};
+static uint32_t dither_cnt = 1;
+// Floyd-Steinberg error carried into the next row. Entry x+1 is column x's, 
+// see gray4_dither_fs_rgb565().
+static int16_t dither_err[DISPLAY_HOR_RES + 1];
+// Internal SRAM bounce buffers the changed area is copied into from the shadow,
+// one row block at a time. While the DMA streams one of them out, the next row
+// block is copied into the other one.
+WORD_ALIGNED_ATTR static uint8_t bounce_buff[2][DISPLAY_SPI_MAX_TRANSFER_SIZE];
+
+// The changed rows of an area are split into separate boxes where at least
+// this many unchanged rows are between them. Sending the gap would cost more
+// than the additional LD_IMG_AREA and display update.
+#define DIRTY_BOX_ROW_GAP (32)
+#define MAX_DIRTY_BOXES   (8)
+
+// Screen update waiting for its asynchronous pixel transfer to complete
+static struct {
+    bool active;
+    stRectangle_t rect;
+    eIT8951_DisplayMode_t mode;
+    uint32_t buff;
+    bool is_1bpp;
+    // The area is uniform fg, filled by the IT8951 rather than uploaded
+    bool is_fill;
+    // Gray levels of the 0 and 1 bits of a 1bpp update
+    uint8_t fg, bg;
+} pending_update;
+
+// Last FILL_RECT queued. It writes the image buffer only once it is launched,
+// so the image loads wait for that
+static uint32_t last_fill_id = IT8951_UPDATE_ID_INVALID;
+
+// Frame buffer in the IT8951's SDRAM that whole screens are uploaded into, 
+// while the front buffer stays on the panel. The partial updates go straight
+// to the front buffer, which is the one last flipped in. The driver's front
+// buffer only follows once the flip's waveform is done.
+static uint32_t front_buff = IT8951_FRAME_BUFFER_DEFAULT;
+static uint32_t back_buff;
+static bool has_back_buff = false;
+// Last update that reads the back buffer. It must be done before the back 
+// buffer is written again.
+static uint32_t back_buff_update_id = IT8951_UPDATE_ID_INVALID;
+
+// Two-level boxes are uploaded at 1bpp into the back buffer, which is only
+// scratch space between the page flips, and displayed from there. The front
+// buffer does not get these pixels, so it is stale in these areas until they
+// are re-uploaded from the shadow.
+#define MAX_STALE_RECTS (8)
+static stRectangle_t stale_rects[MAX_STALE_RECTS];
+static uint32_t stale_cnt = 0;
+
+// Area that failed to be uploaded or displayed. The shadow framebuffer already
+// holds its pixels, so the diffing would not find it changed again. It is sent
+// again with the next flush, or once the display is quiet.
+static stRectangle_t failed_rect;
+static bool has_failed_rect = false;
+
+// Time of the last flush [us]. The ghosting is only cleaned up once no flush
+// happened for GHOSTING_CLEANUP_QUIET_PERIOD_US, so it does not interfere with
+// the UI's updates
+static int64_t last_flush_us = 0;
+#define GHOSTING_CLEANUP_QUIET_PERIOD_US (30*1000000ll)
+
+// Per-stage timing of the last flush [us]
+static struct {
+    int64_t start;
+    int64_t convert;
+    int64_t copy;
+    int64_t stall;
+    int64_t flush;
+    // Wait for the last row block, once the next flush or display_process()
+    // completes the update
+    int64_t tail;
+    uint32_t bytes;
+} flush_timing;
+
+// Statistics of the shadow framebuffer diffing
+static struct {
+    uint32_t flushes;
+    uint32_t skipped;
+    uint32_t boxes;
+    uint32_t boxes_1bpp;
+    uint32_t fills;
+    uint64_t pixels_filled;
+    uint64_t bytes_flushed;
+    uint64_t bytes_sent;
+} diff_stats;
+
+// LVGL renders L8 with LV_COLOR_DEPTH 8 and RGB565 otherwise. L8 halves the
+// draw buffers and the bytes read back from the PSRAM for the conversion.
+#if LV_COLOR_DEPTH == 8
+#define convert_plain(px, out, num_pix)        gray4_from_l8((px), (out), (num_pix))
+#define convert_bayer(px, out, num_pix, x, y)  gray4_dither_bayer_l8((px), (out), (num_pix), (x), (y))
+#define convert_fs(px, out, num_pix, err)      gray4_dither_fs_l8((px), (out), (num_pix), (err))
+#elif LV_COLOR_DEPTH == 16
+#define convert_plain(px, out, num_pix)        gray4_from_rgb565((const uint16_t*)(px), (out), (num_pix))
+#define convert_bayer(px, out, num_pix, x, y)  gray4_dither_bayer_rgb565((const uint16_t*)(px), (out), (num_pix), (x), (y))
+#define convert_fs(px, out, num_pix, err)      gray4_dither_fs_rgb565((const uint16_t*)(px), (out), (num_pix), (err))
+#else
+#error "The display takes LV_COLOR_DEPTH 16 (RGB565) or 8 (L8)"
+#endif
+
+/// @brief Whether row y of a dither region covers column x
+static inline bool dither_region_has(const uint32_t i, const uint32_t x, const uint32_t y) {
+    const stRectangle_t *const r = &dither_regions[i].rect;
+    return y >= r->y && y < r->y + r->height && x >= r->x && x < r->x + r->width;
+}
+
+/// @brief Converts a row of the flushed area into row_buff, each span of it 
+/// with the dither of the region it is in
+/// @param rect Flushed area
+/// @param y Y of the row
+/// @param px_map The row's pixels in LVGL's color format
+/// @return row_buff
+__attribute__((optimize("Ofast")))
+static const uint8_t *IRAM_ATTR convert_row(const stRectangle_t *rect, const uint32_t y, const uint8_t *px_map) {
+    const uint32_t end = rect->x + rect->width;
+    for(uint32_t x=rect->x; x<end;) {
+        // The last region with the pixel, up to where a later one starts
+        uint32_t i = dither_cnt - 1;
+        while(i > 0 && !dither_region_has(i, x, y)) {
+            i--;
+        }
+        const stRectangle_t *const r = &dither_regions[i].rect;
+        uint32_t span_end = min(end, (uint32_t)(r->x + r->width));
+        for(uint32_t j=i+1; j<dither_cnt; j++) {
+            const stRectangle_t *const next = &dither_regions[j].rect;
+            if(y >= next->y && y < next->y + next->height && next->x > x && next->x < span_end) {
+                span_end = next->x;
+            }
+        }
+
+        const uint32_t num_pix = span_end - x;
+        const uint8_t *const px = px_map + (x - rect->x)*LV_COLOR_DEPTH/8;
+        uint8_t *const out = &row_buff[(x - rect->x)/2];
+        switch(dither_regions[i].dither) {
+            case DISPLAY_DITHER_BAYER:
+                convert_bayer(px, out, num_pix, x, y);
+                break;
+            case DISPLAY_DITHER_FLOYD_STEINBERG:
+                // The error is from the row above, or from this row's earlier
+                // spans of the region. Anything else is stale.
+                if(dither_regions[i].err_y != y && dither_regions[i].err_y != y + 1) {
+                    memset(&dither_err[x+1], 0, num_pix*sizeof(int16_t));
+                }
+                dither_regions[i].err_y = y + 1;
+                convert_fs(px, out, num_pix, &dither_err[x]);
+                break;
+            default:
+                convert_plain(px, out, num_pix);
+                break;
+        }
+        x = span_end;
+    }
+    return row_buff;
+}
+
+/// @brief Converts the flushed area into the shadow framebuffer and collects
+/// the boxes of the area that differ from what the shadow held before
+/// @param rect Flushed area. x and width must be multiples of 4
+/// @param px_map Pixels of the area in LVGL's color format
+/// @param boxes [out] Changed boxes. x and width are multiples of 4, so each
+/// box covers whole 16bit words of the IT8951's image buffer
+/// @return Number of boxes, 0 if nothing changed
+__attribute__((optimize("Ofast")))
+static uint32_t IRAM_ATTR diff_area(const stRectangle_t *rect, const uint8_t *px_map, stRectangle_t boxes[MAX_DIRTY_BOXES]) {
+    const uint32_t row_bytes = rect->width/2;
+    const uint32_t stride = rect->width*LV_COLOR_DEPTH/8;
+    uint32_t cnt = 0;
+    // Byte columns of the box being collected, end exclusive
+    uint32_t first_col = 0, end_col = 0;
+
+    for(uint32_t y=rect->y; y<rect->y+rect->height; y++, px_map+=stride) {
+        const uint8_t *row = convert_row(rect, y, px_map);
+        uint8_t *shadow = &shadow_fb[y][rect->x/2];
+        if(memcmp(row, shadow, row_bytes) == 0) {
+            continue;
+        }
+
+        // Shrink the row to the changed words
+        uint32_t first = 0, end = row_bytes;
+        while(row[first] == shadow[first]) {
+            first++;
+        }
+        while(row[end-1] == shadow[end-1]) {
+            end--;
+        }
+        memcpy(shadow+first, row+first, end-first);
+        first = (rect->x/2 + first) & ~1u;
+        end = (rect->x/2 + end + 1) & ~1u;
+
+        stRectangle_t *box = (cnt > 0) ? &boxes[cnt-1] : NULL;
+        const bool is_near = box && (y - (box->y + box->height)) < DIRTY_BOX_ROW_GAP;
+        if(is_near || cnt == MAX_DIRTY_BOXES) {
+            first_col = min(first_col, first);
+            end_col = (end > end_col) ? end : end_col;
+        } else {
+            box = &boxes[cnt++];
+            box->y = y;
+            first_col = first;
+            end_col = end;
+        }
+        box->x = first_col*2;
+        box->width = (end_col - first_col)*2;
+        box->height = y - box->y + 1;
+    }
+    return cnt;
+}
+
+/// @brief Uploads a box of the shadow framebuffer to the IT8951's image 
+/// buffer. The last row block is left in flight, see display_complete_update()
+/// @param box Box to upload. x and width must be multiples of 4
+/// @param buff Index of the IT8951 frame buffer to upload into
+/// @return True on success
+__attribute__((optimize("Ofast")))
+static bool IRAM_ATTR upload_box(const stRectangle_t *box, const uint32_t buff) {
+    static const stIT8951_ImageInfo_t img_info = {
+        .rotation = DISPLAY_ROTATION,
+        .bpp = IT8951_COLOR_DEPTH_BPP_4BIT,
+        .endianness = IT8951_ENDIANNESS_BIG,
+    };
+    const uint32_t row_bytes = box->width/2;
+    const uint32_t rows_per_block = min(DISPLAY_SPI_MAX_TRANSFER_SIZE/row_bytes, box->height);
+
+    bool status = it8951_update_wait_launched(&it8951_hdlr, last_fill_id) &&
+                  it8951_frame_buffer_set_target(&it8951_hdlr, buff) &&
+                  it8951_load_img_area_begin(&it8951_hdlr, &img_info, box);
+    for(uint32_t row=0, blk=0; row<box->height && status; row+=rows_per_block, blk^=1) {
+        const uint32_t rows = min(rows_per_block, box->height-row);
+
+        // Copying into the buffer the DMA is not reading from
+        int64_t t = esp_timer_get_time();
+        uint8_t *out = bounce_buff[blk];
+        for(uint32_t y=box->y+row; y<box->y+row+rows; y++) {
+            memcpy(out, &shadow_fb[y][box->x/2], row_bytes);
+            out += row_bytes;
+        }
+        flush_timing.copy += esp_timer_get_time() - t;
+
+        // Blocks only until the previous row block is out of the other buffer
+        t = esp_timer_get_time();
+        status = it8951_load_img_area_write_async(&it8951_hdlr, bounce_buff[blk], rows*row_bytes);
+        flush_timing.stall += esp_timer_get_time() - t;
+        flush_timing.bytes += rows*row_bytes;
     }
     return status;
 }
 
-FORCE_INLINE_ATTR void it8951_set_ncs(bool state) {
-    gpio_set_level(ncs, state);
+/// @brief Uploads a two-level box of the shadow framebuffer at 1bpp. The last 
+/// row block is left in flight, see display_complete_update()
+/// @param box Box to upload. x and width must be multiples of 
+/// IT8951_1BPP_ALIGN_PX
+/// @param buff Index of the IT8951 frame buffer to upload into
+/// @param bg Gray level the 1 bits stand for. Any other level is a 0 bit
+/// @return True on success
+__attribute__((optimize("Ofast")))
+static bool IRAM_ATTR upload_box_1bpp(const stRectangle_t *box, const uint32_t buff, const uint8_t bg) {
+    const uint32_t row_bytes = box->width/8;
+    const uint32_t rows_per_block = min(DISPLAY_SPI_MAX_TRANSFER_SIZE/row_bytes, box->height);
+
+    bool status = it8951_update_wait_launched(&it8951_hdlr, last_fill_id) &&
+                  it8951_frame_buffer_set_target(&it8951_hdlr, buff) &&
+                  it8951_load_img_area_1bpp_begin(&it8951_hdlr, box);
+    for(uint32_t row=0, blk=0; row<box->height && status; row+=rows_per_block, blk^=1) {
+        const uint32_t rows = min(rows_per_block, box->height-row);
+
+        // Packing 8 pixels (4 shadow bytes) per byte, the first pixel in the MSB
+        int64_t t = esp_timer_get_time();
+        uint8_t *out = bounce_buff[blk];
+        for(uint32_t y=box->y+row; y<box->y+row+rows; y++) {
+            gray4_to_1bpp(&shadow_fb[y][box->x/2], out, row_bytes, bg);
+            out += row_bytes;
+        }
+        flush_timing.copy += esp_timer_get_time() - t;
+
+        t = esp_timer_get_time();
+        status = it8951_load_img_area_write_async(&it8951_hdlr, bounce_buff[blk], rows*row_bytes);
+        flush_timing.stall += esp_timer_get_time() - t;
+        flush_timing.bytes += rows*row_bytes;
+    }
+    return status;
 }
 
-static SemaphoreHandle_t hrdy_semaphore;
-void IRAM_ATTR hrdy_isr(void *arg) {
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    xSemaphoreGiveFromISR((SemaphoreHandle_t)arg, &xHigherPriorityTaskWoken);
-    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+/// @brief Accumulates the gray-level histogram of a box of the shadow 
+/// framebuffer
+/// @param box Box to take the histogram of. x and width must be even
+/// @param hist [out] Gray-level histogram, accumulated over the calls
+__attribute__((optimize("Ofast")))
+static void IRAM_ATTR box_histogram(const stRectangle_t *box, uint32_t hist[WAVEFORM_GRAY_LEVELS]) {
+    for(uint32_t y=box->y; y<box->y+box->height; y++) {
+        gray4_histogram(&shadow_fb[y][box->x/2], box->width, hist);
+    }
 }
 
-FORCE_INLINE_ATTR void it8951_wait_hrdy(void) {
-    if(gpio_get_level(hrdy) == 0) {
-        // TODO: Using xTaskToNotify may be a quicker option
-        xSemaphoreTake(hrdy_semaphore, portMAX_DELAY);
+/// @brief Re-uploads the stale areas of the front buffer that a display 
+/// update of the area would show, or all of them if area is NULL
+/// @param area Area in the UI's coordinates. A display update of the front 
+/// buffer may be merged with the queued ones it overlaps, so all of the
+/// merged area is checked
+static void refresh_stale_rects(const stRectangle_t *area) {
+    stRectangle_t panel_area;
+    if(area) {
+        panel_area = it8951_rotate_rect(&it8951_hdlr, DISPLAY_ROTATION, area);
+        panel_area = it8951_update_merged_area(&it8951_hdlr, front_buff, &panel_area);
+    }
+    for(uint32_t i=0; i<stale_cnt;) {
+        const stRectangle_t stale = it8951_rotate_rect(&it8951_hdlr, DISPLAY_ROTATION, &stale_rects[i]);
+        if(area && !rectangle_intersects(&stale, &panel_area)) {
+            i++;
+            continue;
+        }
+        // Needs to complete before the bounce buffers are reused
+        upload_box(&stale_rects[i], front_buff);
+        it8951_wait_async(&it8951_hdlr);
+        stale_rects[i] = stale_rects[--stale_cnt];
     }
 }
 
-__attribute__((always_inline, pure, optimize("Ofast"))) 
-static inline uint8_t IRAM_ATTR rgb565_to_gray4(const uint16_t color) {
-    static const uint8_t DRAM_ATTR lut[65536] = { 
-        #include "rgb565_to_gray4.txt" 
-    };
-    return lut[color];
+/// @brief Records an area the front buffer is stale in. Once all the slots 
+/// are taken, it is merged with the stale area that grows the least by it
+static void add_stale_rect(const stRectangle_t *rect) {
+    if(stale_cnt < MAX_STALE_RECTS) {
+        stale_rects[stale_cnt++] = *rect;
+        return;
+    }
+    uint32_t nearest = 0;
+    uint32_t min_growth = UINT32_MAX;
+    for(uint32_t i=0; i<stale_cnt; i++) {
+        const stRectangle_t merged = rectangle_union(&stale_rects[i], rect);
+        const uint32_t growth = (uint32_t)merged.width*merged.height - 
+                                (uint32_t)stale_rects[i].width*stale_rects[i].height;
+        if(growth < min_growth) {
+            min_growth = growth;
+            nearest = i;
+        }
+    }
+    stale_rects[nearest] = rectangle_union(&stale_rects[nearest], rect);
+}
+
+/// @brief Records an area the panel is out of date in, see failed_rect
+static void add_failed_rect(const stRectangle_t *rect) {
+    failed_rect = has_failed_rect ? rectangle_union(&failed_rect, rect) : *rect;
+    has_failed_rect = true;
 }
+
+/// @brief Completes the pixel transfer started by the last display_flush and
+/// updates the screen
+static void display_complete_update(void) {
+    if(!pending_update.active) {
+        return;
+    }
+    pending_update.active = false;
+
+    const int64_t start = esp_timer_get_time();
+    it8951_wait_async(&it8951_hdlr);
+    flush_timing.tail = esp_timer_get_time() - start;
+    // Returns without waiting for the waveform, see display_process()
+    const stRectangle_t panel_rect = it8951_rotate_rect(&it8951_hdlr, DISPLAY_ROTATION, &pending_update.rect);
+    bool status;
+    if(pending_update.is_fill) {
+        status = it8951_fill_rect_async(&it8951_hdlr, &panel_rect, pending_update.mode, pending_update.fg*0x11, &last_fill_id);
+    } else if(pending_update.is_1bpp) {
+        status = it8951_frame_buffer_display_1bpp_async(&it8951_hdlr, pending_update.buff, &panel_rect, 
+                                                        pending_update.mode, pending_update.fg*0x11, 
+                                                        pending_update.bg*0x11, &back_buff_update_id);
+        add_stale_rect(&pending_update.rect);
+    } else if(pending_update.buff != front_buff) {
+        // Once the flip is done, nothing reads the old front buffer anymore
+        status = it8951_frame_buffer_flip(&it8951_hdlr, pending_update.buff, pending_update.mode, &back_buff_update_id);
+        if(status) {
+            back_buff = front_buff;
+            front_buff = pending_update.buff;
+            stale_cnt = 0;
+        }
+    } else {
+        status = it8951_frame_buffer_display_async(&it8951_hdlr, front_buff, &panel_rect, pending_update.mode, NULL);
+    }
+    if(!status) {
+        ESP_LOGE(tag, "Failed to display the image area");
+        add_failed_rect(&pending_update.rect);
+        return;
+    }
+    waveform_record_update(pending_update.mode);
+    ghosting_record_update(&panel_rect, pending_update.mode);
+
+#if DISPLAY_LOG_TIMING
+    // The SPI time is not measured, but derived from the bytes sent and the
+    // clock. Without pipelining, the upload would take copy+SPI time. Whatever
+    // is below that is the overlap of the copying and the DMA transfer
+    const int64_t spi = (flush_timing.bytes*8ull*1000000ull)/DISPLAY_SPI_CLOCK_SPEED_HZ;
+    ESP_LOGD(tag, "Flush %ux%u (mode %d%s): convert+diff %" PRId64 " us, copy %" PRId64 " us, "
+                  "SPI (derived) %" PRId64 " us, stall %" PRId64 " us, flush %" PRId64 " us + tail %" PRId64 " us "
+                  "(serial: %" PRId64 " us)",
+             pending_update.rect.width, pending_update.rect.height, pending_update.mode,
+             pending_update.is_fill ? ", fill" : (pending_update.is_1bpp ? ", 1bpp" : ""), flush_timing.convert, flush_timing.copy, spi, flush_timing.stall, 
+             flush_timing.flush, flush_timing.tail, flush_timing.copy+spi);
+#endif
+}
+
+/// @brief Uploads a box of the shadow framebuffer and sets it as the pending
+/// update. Uniform boxes are filled by the IT8951 instead, and two-level 
+/// boxes are uploaded at 1bpp if possible.
+/// @param box Box to upload. x and width must be multiples of 4
+/// @param buff Index of the IT8951 frame buffer to upload into
+/// @param is_page The box is a whole screen for the back buffer
+/// @return True on success
+static bool upload_update(const stRectangle_t *box, const uint32_t buff, const bool is_page) {
+    uint32_t hist[WAVEFORM_GRAY_LEVELS] = {0};
+    box_histogram(box, hist);
+    uint32_t levels = 0;
+    uint8_t level = 0;
+    for(uint32_t i=0; i<WAVEFORM_GRAY_LEVELS; i++) {
+        levels += (hist[i] != 0);
+        level = hist[i] ? i : level;
+    }
+    // The whole box is redrawn, so the waveform must suit its unchanged pixels
+    // as well
+    pending_update.mode = waveform_select(hist);
+    pending_update.rect = *box;
+    pending_update.buff = buff;
+    diff_stats.boxes++;
+
+    // A uniform box, like a background or a cleared area, costs a FILL_RECT
+    // instead of its pixels. FILL_RECT writes the default image buffer, so 
+    // this is only done while that is the front buffer.
+    pending_update.is_fill = levels == 1 && !is_page && buff == IT8951_FRAME_BUFFER_DEFAULT;
+    if(pending_update.is_fill) {
+        refresh_stale_rects(box);
+        pending_update.is_1bpp = false;
+        pending_update.fg = level;
+        pending_update.active = true;
+        diff_stats.fills++;
+        diff_stats.pixels_filled += box->width*box->height;
+        return true;
+    }
+
+    // The 1bpp box is widened from the shadow to the 1bpp alignment. The 1bpp
+    // loads pass 8 pixels per byte of an 8bpp load, which the IT8951 would 
+    // rotate as single pixels, so these are only used unrotated.
+    const uint32_t x1 = box->x & ~(IT8951_1BPP_ALIGN_PX-1);
+    const uint32_t x2 = (box->x + box->width + IT8951_1BPP_ALIGN_PX-1) & ~(IT8951_1BPP_ALIGN_PX-1);
+    const stRectangle_t mono_box = {x1, box->y, x2-x1, box->height};
+    uint32_t mono_hist[WAVEFORM_GRAY_LEVELS] = {0};
+    levels = WAVEFORM_GRAY_LEVELS;
+    if(has_back_buff && !is_page && DISPLAY_ROTATION == IT8951_ROTATION_MODE_0 && x2 <= DISPLAY_HOR_RES) {
+        box_histogram(&mono_box, mono_hist);
+        levels = 0;
+        for(uint32_t i=0; i<WAVEFORM_GRAY_LEVELS; i++) {
+            levels += (mono_hist[i] != 0);
+        }
+    }
+
+    bool status;
+    pending_update.is_1bpp = levels <= 2;
+    if(pending_update.is_1bpp) {
+        // The most common level is the background
+        uint8_t bg = 0, fg = 0;
+        for(uint32_t i=0; i<WAVEFORM_GRAY_LEVELS; i++) {
+            bg = (mono_hist[i] > mono_hist[bg]) ? i : bg;
+        }
+        fg = bg;
+        for(uint32_t i=0; i<WAVEFORM_GRAY_LEVELS; i++) {
+            fg = (mono_hist[i] != 0 && i != bg) ? i : fg;
+        }
+        // The back buffer's previous 1bpp data must have been taken by its
+        // update, which the IT8951 does when launching it
+        status = it8951_update_wait_launched(&it8951_hdlr, back_buff_update_id) &&
+                 upload_box_1bpp(&mono_box, back_buff, bg);
+        pending_update.rect = mono_box;
+        pending_update.buff = back_buff;
+        pending_update.fg = fg;
+        pending_update.bg = bg;
+        pending_update.mode = waveform_select(mono_hist);
+        diff_stats.boxes_1bpp++;
+    } else {
+        if(is_page) {
+            it8951_update_wait(&it8951_hdlr, back_buff_update_id);
+        } else {
+            refresh_stale_rects(box);
+        }
+        status = upload_box(box, buff);
+    }
+    pending_update.active = status;
+    return status;
+}
+
+#if DISPLAY_LOG_TIMING
+/// @brief Logs how much of the flushed data the shadow framebuffer saved
+static void display_log_diff_stats(void) {
+    const uint64_t saved = diff_stats.bytes_flushed - diff_stats.bytes_sent;
+    ESP_LOGD(tag, "Diff: %" PRIu32 "/%" PRIu32 " flushes skipped, %" PRIu32 "/%" PRIu32 " boxes at 1bpp, "
+                  "%" PRIu32 " filled (%" PRIu64 " px offloaded), %" PRIu64 "/%" PRIu64 " bytes saved "
+                  "(%" PRIu64 "%%)",
+             diff_stats.skipped, diff_stats.flushes, diff_stats.boxes_1bpp, diff_stats.boxes,
+             diff_stats.fills, diff_stats.pixels_filled,
+             saved, diff_stats.bytes_flushed,
+             diff_stats.bytes_flushed ? (saved*100)/diff_stats.bytes_flushed : 0);
+}
+#endif
+
 // TODO: May need to remove the strict timing dependency of the dirty pixel
 // checking by following this: 
 //https://docs.lvgl.io/master/porting/display.html#decoupling-the-display-refresh-timer
 // This way the display can be forced to refresh after a wake-up event
 __attribute__((optimize("Ofast")))
 void IRAM_ATTR display_flush(lv_display_t *disp, const lv_area_t *area, uint8_t *px_map) {
-    static const stIT8951_ImageInfo_t img_info = {
-        .rotation = IT8951_ROTATION_MODE_0,
-        .bpp = IT8951_COLOR_DEPTH_BPP_4BIT,
-        .endianness = IT8951_ENDIANNESS_BIG,
-    };
     const stRectangle_t rect = {
         .x      = area->x1,
         .y      = area->y1,
         .width  = lv_area_get_width(area),
         .height = lv_area_get_height(area)
     };
+    const int64_t start = esp_timer_get_time();
+    last_flush_us = start;
+
+    // Does not touch the SPI, so the previous area's last row block keeps 
+    // streaming out meanwhile. display_rounder() ensures that the width is a 
+    // multiple of 4, so every row packs into whole 16bit words.
+    stRectangle_t boxes[MAX_DIRTY_BOXES];
+    uint32_t cnt = diff_area(&rect, px_map, boxes);
+    const int64_t convert = esp_timer_get_time() - start;
+
+    // The pixels are only read from the shadow from now on, so LVGL can render
+    // the next area into px_map while this one is uploaded. LVGL clears the
+    // last flag in lv_display_flush_ready(), so it is read before.
+    const bool is_last = lv_display_flush_is_last(disp);
+    lv_display_flush_ready(disp);
+
+    // A whole new screen (e.g. a screen load) is uploaded into the back buffer
+    // and flipped in with a single waveform. The back buffer holds an older
+    // screen, so all of it is uploaded, not just the changed boxes.
+    const bool is_page = has_back_buff && cnt > 0 && rect.x == 0 && rect.y == 0 &&
+                         rect.width == DISPLAY_HOR_RES && rect.height == DISPLAY_VER_RES;
+    const uint32_t buff = is_page ? back_buff : front_buff;
+    if(is_page) {
+        boxes[0] = rect;
+        cnt = 1;
+    }
+
+    diff_stats.flushes++;
+    diff_stats.skipped += (cnt == 0);
+    diff_stats.bytes_flushed += (rect.width*rect.height)/2;
+
+    // A page covers the failed area, anything else sends it as another box
+    if(has_failed_rect && !is_page) {
+        if(cnt < MAX_DIRTY_BOXES) {
+            boxes[cnt++] = failed_rect;
+        } else {
+            boxes[cnt-1] = rectangle_union(&boxes[cnt-1], &failed_rect);
+        }
+    }
+    has_failed_rect = false;
+
+    for(uint32_t i=0; i<cnt; i++) {
+        // The previous box's last row block may still be in flight
+        display_complete_update();
+        flush_timing = (typeof(flush_timing)){ .start = start, .convert = convert };
+
+        const bool status = upload_update(&boxes[i], buff, is_page);
+        flush_timing.flush = esp_timer_get_time() - flush_timing.start;
+        diff_stats.bytes_sent += flush_timing.bytes;
+
+        if(!status) {
+            it8951_wait_async(&it8951_hdlr);
+            ESP_LOGE(tag, "Failed to load the image area");
+            add_failed_rect(&boxes[i]);
+        }
+    }
+
+    // LVGL does not flush again after the last area of a refresh, so the 
+    // update must be completed here
+    if(is_last) {
+        display_complete_update();
+#if DISPLAY_LOG_TIMING
+        waveform_log_stats();
+        display_log_diff_stats();
+#endif
+#if IT8951_TRACE_LENGTH > 0
+        // The driver's transactions of this refresh
+        it8951_trace_dump_csv(&it8951_hdlr, stdout);
+        it8951_trace_reset(&it8951_hdlr);
+#endif
+    }
+}
+
+/// @brief Draws a pre-packed asset at (x,y), bypassing LVGL. The asset's rows
+/// are already in the shadow framebuffer's format, so they are copied from the
+/// flash mapping into the shadow and uploaded from there with no conversion.
+/// This is not zero-copy: the shadow must hold the pixels for the diffing of
+/// the next flushes, and the flash cache is not DMA capable, so the SPI is fed
+/// from the internal bounce buffers as with any other update. The two copies
+/// are test_bench's "Asset blit copies", ~0.05 ns/pixel natively against 
+/// ~167 ns/pixel on the SPI, and DISPLAY_LOG_TIMING logs them on the board as
+/// convert and copy. LVGL keeps no copy of the area, so redrawing an object 
+/// over it overwrites it.
+/// @param asset Asset to draw, see assets_find()
+/// @param x X coordinate in the UI's orientation. Must be a multiple of 4
+/// @param y Y coordinate in the UI's orientation
+/// @return True on success
+bool display_blit_asset(const stAsset_t *const asset, const uint16_t x, const uint16_t y) {
+    assert(asset);
+    const stRectangle_t rect = {x, y, asset->width, asset->height};
+    if((x % 4) != 0 || x + asset->width > DISPLAY_HOR_RES || y + asset->height > DISPLAY_VER_RES) {
+        ESP_LOGE(tag, "Asset %s (%ux%u) does not fit at (%u,%u)", asset->name, asset->width, asset->height, x, y);
+        return false;
+    }
+    display_complete_update();
+
+    const int64_t start = esp_timer_get_time();
+    const uint32_t row_bytes = asset->width/2;
+    for(uint32_t i=0; i<asset->height; i++) {
+        memcpy(&shadow_fb[y+i][x/2], asset->pixels + i*row_bytes, row_bytes);
+    }
+    flush_timing = (typeof(flush_timing)){ .start = start, .convert = esp_timer_get_time() - start };
+
+    const bool status = upload_update(&rect, front_buff, false);
+    flush_timing.flush = esp_timer_get_time() - flush_timing.start;
+    if(!status) {
+        it8951_wait_async(&it8951_hdlr);
+        ESP_LOGE(tag, "Failed to load asset %s", asset->name);
+        add_failed_rect(&rect);
+    }
+    display_complete_update();
+    return status;
+}
+
+/// @brief Shows the panel's 16 gray levels as vertical bars with GC16, black
+/// on the left. The levels are filled in as they are, bypassing the gray 
+/// curve, so their reflectance calibrates it, see tools/gray4_curve.py. The 
+/// bars go into the shadow framebuffer and through the update queue like any
+/// flushed area, so display_process() must keep being called to launch them.
+void display_show_gray_wedge(void) {
+    last_flush_us = esp_timer_get_time();
+    const uint16_t bar_width = (DISPLAY_HOR_RES/GRAY4_LEVELS) & ~0b11;
+    for(uint32_t i=0; i<GRAY4_LEVELS; i++) {
+        const stRectangle_t bar = {i*bar_width, 0, bar_width, DISPLAY_VER_RES};
+        for(uint32_t y=0; y<DISPLAY_VER_RES; y++) {
+            memset(&shadow_fb[y][bar.x/2], i*0x11, bar_width/2);
+        }
+        // The previous bar's last row block may still be in flight
+        display_complete_update();
+        flush_timing = (typeof(flush_timing)){ .start = esp_timer_get_time() };
+        const bool status = upload_update(&bar, front_buff, false);
+        // Whatever the content, GC16 shows each level as it is
+        pending_update.mode = IT8951_DISPLAY_MODE_GC16;
+        if(!status) {
+            it8951_wait_async(&it8951_hdlr);
+            ESP_LOGE(tag, "Failed to load the gray bar %" PRIu32, i);
+            add_failed_rect(&bar);
+        }
+    }
+    display_complete_update();
+}
+
+/// @brief Sets the dither of a region of the screen, over the regions set 
+/// before. It applies from the next flush of the region, so the caller 
+/// invalidates it to have it redrawn. Must be called from the LVGL task.
+/// @param area Region in the UI's coordinates, or NULL for the whole screen,
+/// which also drops the regions set before
+/// @param dither Dither of the region
+/// @return True on success, false if there are too many regions
+bool display_set_dither(const lv_area_t *area, const eDisplayDither_t dither) {
+    assert(IsEnum_DisplayDither(dither));
+    if(area == NULL) {
+        dither_cnt = 1;
+        dither_regions[0].dither = dither;
+        dither_regions[0].err_y = UINT32_MAX;
+        return true;
+    }
+    if(dither_cnt == MAX_DITHER_REGIONS) {
+        ESP_LOGE(tag, "No more than %d dither regions", MAX_DITHER_REGIONS);
+        return false;
+    }
+    // Rounded out to whole bytes of the packed rows, and clipped to the screen
+    const int32_t x1 = max(area->x1, 0) & ~1, y1 = max(area->y1, 0);
+    const int32_t x2 = min(area->x2 | 1, DISPLAY_HOR_RES - 1), y2 = min(area->y2, DISPLAY_VER_RES - 1);
+    if(x2 < x1 || y2 < y1) {
+        return true;
+    }
+    dither_regions[dither_cnt++] = (typeof(dither_regions[0])){
+        .rect = {x1, y1, x2 - x1 + 1, y2 - y1 + 1},
+        .dither = dither,
+        .err_y = UINT32_MAX,
+    };
+    return true;
+}
+
+/// @brief Drops the regions of display_set_dither(), leaving the whole 
+/// screen's dither
+void display_clear_dither(void) {
+    dither_cnt = 1;
+}
 
-    // Get the number of pixels needed to display
-    const uint32_t num_pix = rectangle_get_area(&rect);
-    // Convert the RGB565 pixel to GRAY4 and pack them back to the OG array.
-    // *px_map is contained within the draw_buff we defined in main.c. When the 
-    // flush_cb is called, LVGL is done with the processing of this buffer,
-    // therefore we're free to further modify it. Here we map 2 bytes into 4bits
-    uint16_t *color = (uint16_t*)px_map;
-    for(uint32_t i=0; i<num_pix; i++) {
-        // This loop should naturally stay within bounds
-        const uint8_t g4 = rgb565_to_gray4(*color++);
-        const bool odd = i & 0b1;
-        const uint32_t idx = i >> 1;
-        px_map[idx] = odd ? (px_map[idx] | g4) : (g4 << 4);
+/// @brief Cleans the ghosting left behind by the fast waveforms with GC16, on
+/// the tiles that went over their budget
+static void display_cleanup_ghosting(void) {
+    stRectangle_t rects[GHOSTING_MAX_CLEANUP_RECTS];
+    const uint32_t cnt = ghosting_get_cleanup_rects(rects, ARRAY_LENGTH(rects));
+    // The cleanup redraws from the front buffer, which must be up to date
+    refresh_stale_rects(NULL);
+    for(uint32_t i=0; i<cnt; i++) {
+        it8951_frame_buffer_display_async(&it8951_hdlr, front_buff, &rects[i], IT8951_DISPLAY_MODE_GC16, NULL);
+        ghosting_record_update(&rects[i], IT8951_DISPLAY_MODE_GC16);
     }
+    ESP_LOGI(tag, "Cleaned up ghosting in %" PRIu32 " areas", cnt);
+}
 
-    it8951_write_packed_pixels(&it8951_hdlr, &img_info, &rect, px_map, num_pix);
-    it8951_display_area(&it8951_hdlr, &rect, IT8951_DISPLAY_MODE_GC16);
+/// @brief Sends the failed area again from the shadow framebuffer
+static void display_resend_failed_rect(void) {
+    const stRectangle_t rect = failed_rect;
+    has_failed_rect = false;
+    flush_timing = (typeof(flush_timing)){ .start = esp_timer_get_time() };
+    if(!upload_update(&rect, front_buff, false)) {
+        it8951_wait_async(&it8951_hdlr);
+        ESP_LOGE(tag, "Failed to load the image area");
+        add_failed_rect(&rect);
+    }
+    display_complete_update();
+}
 
-    // lv_display_flush_is_last(display) to check if the last block of rendering
+/// @brief Launches the queued display updates as the IT8951's LUT engines 
+/// become available. Once the display is quiet, sends the area that failed 
+/// and cleans up the ghosting. Must be called periodically from the LVGL 
+/// thread.
+void display_process(void) {
+    it8951_update_poll(&it8951_hdlr);
 
-    // This function must be called when the display has been updated
-    lv_disp_flush_ready(disp);
+    const bool is_quiet = (esp_timer_get_time() - last_flush_us) >= GHOSTING_CLEANUP_QUIET_PERIOD_US;
+    if(is_quiet && !pending_update.active && has_failed_rect) {
+        // Counts as a flush, so a failure that persists is retried once per
+        // quiet period
+        last_flush_us = esp_timer_get_time();
+        display_resend_failed_rect();
+    }
+    if(is_quiet && !pending_update.active && ghosting_is_cleanup_due()) {
+        display_cleanup_ghosting();
+    }
 }
 
 __attribute__((optimize("Ofast"))) 
@@ -132,7 +801,10 @@ void IRAM_ATTR display_rounder(lv_event_t *e) {
     // This event is fired when an area on the display is invalidated. To ensure
     // the above alignment requirements are met with no post-processing, we can
     // expand the invalidated area so that x and x+w always land on a 4pixel 
-    // boundary.
+    // boundary. The wider alignment of the 1bpp loads is not needed here, as
+    // display_flush() widens those boxes from the shadow framebuffer. With a
+    // rotated display, the alignment is still in the UI's x, as that is the 
+    // order the pixels are loaded in.
     lv_area_t * area = lv_event_get_param(e);
     area->x1 =   area->x1    & ~0b11;
     // x2 is an inclusive pixel bound!
@@ -140,49 +812,28 @@ void IRAM_ATTR display_rounder(lv_event_t *e) {
 }
 
 void display_init(void) {
-    ESP_ERROR_CHECK(spi_bus_initialize(SPI2_HOST, &(spi_bus_config_t){
-        .miso_io_num = spi_miso,
-        .mosi_io_num = spi_mosi,
-        .sclk_io_num = spi_clk,
-        .quadwp_io_num = -1, // Unused
-        .quadhd_io_num = -1, // Unused
-        .max_transfer_sz = SPI_MAX_TRANSFER_SIZE,
-    }, SPI_DMA_CH_AUTO));
-
-    ESP_ERROR_CHECK(spi_bus_add_device(SPI2_HOST, &(spi_device_interface_config_t){
-        .clock_speed_hz = 24000000,
-        .mode = 0,
-        .spics_io_num = -1, // Controlled externally
-        .queue_size = SPI_QUEUE_SIZE,
-        .pre_cb = NULL,
-        .post_cb = NULL,
-        .flags = 0,
-    }, &spi));
-
-    gpio_config(&(gpio_config_t){
-        .pin_bit_mask = (1ULL << hrdy),
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLDOWN_ENABLE,
-        .intr_type = GPIO_INTR_POSEDGE,
-    });
-    hrdy_semaphore = xSemaphoreCreateBinary();
-    gpio_install_isr_service(0);
-    gpio_isr_handler_add(hrdy, hrdy_isr, (void*)hrdy_semaphore);
-
-    gpio_config(&(gpio_config_t){
-        .pin_bit_mask = (1ULL << ncs),
-        .mode = GPIO_MODE_DEF_OUTPUT,
-    });
-    gpio_set_level(ncs, true);
-    
     it8951_hdlr = (stIT8951_Handler_t) {
-        .spi_transcieve = it8951_transcieve,
-        .set_ncs        = it8951_set_ncs,
-        .wait_hrdy      = it8951_wait_hrdy,
-        .vcom_mv        = INT_MAX,
+        .transport = IT8951_TRANSPORT_FRAMED,
+        .vcom_mv   = INT_MAX,
     };
+#if DISPLAY_LOG_TIMING
+    esp_log_level_set(tag, ESP_LOG_DEBUG);
+    esp_log_level_set("WAVEFORM", ESP_LOG_DEBUG);
+#endif
+    display_spi_init(&it8951_hdlr);
     it8951_init(&it8951_hdlr);
+    if(it8951_hdlr.panel_area.width != DISPLAY_PANEL_WIDTH || it8951_hdlr.panel_area.height != DISPLAY_PANEL_HEIGHT) {
+        ESP_LOGE(tag, "Panel is %ux%u, expected %ux%u", it8951_hdlr.panel_area.width, 
+                 it8951_hdlr.panel_area.height, DISPLAY_PANEL_WIDTH, DISPLAY_PANEL_HEIGHT);
+    }
 
-    // Clear the display to white
-    it8951_fill_rect(&it8951_hdlr, &it8951_hdlr.panel_area, IT8951_DISPLAY_MODE_INIT, 0xF);
+    // Clear the display to white. Queued like the UI's updates, so that the
+    // first ones wait for the INIT waveform rather than start over it
+    it8951_fill_rect_async(&it8951_hdlr, &it8951_hdlr.panel_area, IT8951_DISPLAY_MODE_INIT, 0xFF, &last_fill_id);
+    memset(shadow_fb, 0xFF, sizeof(shadow_fb));
+    has_back_buff = it8951_frame_buffer_alloc(&it8951_hdlr, &back_buff);
+    if(!has_back_buff) {
+        ESP_LOGW(tag, "No SDRAM for a back buffer, screens are updated in place");
+    }
+    ghosting_init(it8951_hdlr.panel_area.width, it8951_hdlr.panel_area.height);
 }
\ No newline at end of file
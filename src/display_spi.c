@@ -0,0 +1,192 @@
+#include "it8951.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "hal/spi_ll.h"
+#include "lvgl.h"
+#include "display.h"
+#include "display_spi.h"
+
+// The SPI and GPIO transport of the IT8951 handler. Kept apart from display.c
+// so that the display's pipeline builds on the host against the simulator.
+
+static spi_device_handle_t spi;
+
+static const gpio_num_t ncs = 34;
+static const gpio_num_t hrdy = 9;
+static const gpio_num_t spi_mosi = 35;
+static const gpio_num_t spi_miso = 37;
+static const gpio_num_t spi_clk = 36;
+
+#define min(a,b)             \
+({                           \
+    __typeof__ (a) _a = (a); \
+    __typeof__ (b) _b = (b); \
+    _a < _b ? _a : _b;       \
+})
+
+// In a single transaction, the maximum amount of bytes we may want to tx is a
+// full image at 4bpp: 1872*1404/2. Therefore an SPI queue size of
+// ceil((1872*1404/2)/32768)=41 can utilize the SPI+DMA fully.
+// TODO: This needs a generic ROUND_UP macro
+#define SPI_QUEUE_SIZE (((DISPLAY_HOR_RES*DISPLAY_VER_RES)/(DISPLAY_SPI_MAX_TRANSFER_SIZE*2ull))+1)
+static_assert(DISPLAY_SPI_MAX_TRANSFER_SIZE <= SPI_LL_DMA_MAX_BIT_LEN/8, "Adjust SPI transfer size");
+
+static inline bool it8951_transcieve(const void *txdata, void *rxdata, size_t len) {
+    // TODO: Could keep the CS active between transmissions! Would allow lower
+    // power consumption .flags = SPI_TRANS_CS_KEEP_ACTIVE
+    // TODO: Is there a speed/power gain by using the .tx_data, .rx_data and
+    // .flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA for len <= 4?
+
+    int32_t bit_size = len*8;
+    uint32_t ptr_off = 0;
+    bool status = true;
+    while(bit_size > 0 && status) {
+        const int32_t bit_to_tx = min(SPI_LL_DMA_MAX_BIT_LEN, bit_size);
+        status = spi_device_polling_transmit(spi, &(spi_transaction_t) {
+            .length = bit_to_tx,
+            .tx_buffer = txdata ? (txdata + ptr_off) : NULL,
+            .rx_buffer = rxdata ? (rxdata + ptr_off) : NULL,
+        }) == ESP_OK;
+        bit_size -= bit_to_tx;
+        ptr_off += bit_to_tx/8;
+    }
+    return status;
+}
+
+// Descriptors of the chunks queued by it8951_spi_transmit_async. They must
+// stay valid until the SPI driver hands them back in it8951_spi_wait_async
+static spi_transaction_t spi_async_trans[SPI_QUEUE_SIZE];
+static uint32_t spi_async_cnt = 0;
+static SemaphoreHandle_t spi_done_semaphore;
+
+// Called from the SPI ISR after each transaction. The last chunk of an
+// asynchronous transfer carries the semaphore to signal the completion with
+static void IRAM_ATTR spi_post_cb(spi_transaction_t *trans) {
+    if(trans->user) {
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        xSemaphoreGiveFromISR((SemaphoreHandle_t)trans->user, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+}
+
+static bool it8951_spi_wait_async(void) {
+    bool status = true;
+    if(spi_async_cnt == 0) {
+        return true;
+    }
+    // Only block on the semaphore if the last chunk made it into the queue
+    if(spi_async_trans[spi_async_cnt-1].user) {
+        xSemaphoreTake(spi_done_semaphore, portMAX_DELAY);
+    }
+    // Hand the descriptors back. These are complete, so this does not block
+    for(uint32_t i=0; i<spi_async_cnt; i++) {
+        spi_transaction_t *trans;
+        status &= spi_device_get_trans_result(spi, &trans, portMAX_DELAY) == ESP_OK;
+    }
+    spi_async_cnt = 0;
+    return status;
+}
+
+static bool it8951_spi_transmit_async(const void *txdata, size_t len) {
+    assert(spi_async_cnt == 0);
+
+    int32_t bit_size = len*8;
+    uint32_t ptr_off = 0;
+    bool status = true;
+    while(bit_size > 0 && status) {
+        assert(spi_async_cnt < SPI_QUEUE_SIZE);
+        const int32_t bit_to_tx = min(SPI_LL_DMA_MAX_BIT_LEN, bit_size);
+        bit_size -= bit_to_tx;
+        spi_async_trans[spi_async_cnt] = (spi_transaction_t) {
+            .length = bit_to_tx,
+            .tx_buffer = txdata + ptr_off,
+            .user = (bit_size == 0) ? spi_done_semaphore : NULL,
+        };
+        status = spi_device_queue_trans(spi, &spi_async_trans[spi_async_cnt], portMAX_DELAY) == ESP_OK;
+        spi_async_cnt += status;
+        ptr_off += bit_to_tx/8;
+    }
+    return status;
+}
+
+FORCE_INLINE_ATTR void it8951_set_ncs(bool state) {
+    gpio_set_level(ncs, state);
+}
+
+static uint32_t it8951_get_time_ms(void) {
+    return (uint32_t)(esp_timer_get_time()/1000);
+}
+
+static uint32_t it8951_get_time_us(void) {
+    return (uint32_t)esp_timer_get_time();
+}
+
+static void it8951_sleep_ms(uint32_t ms) {
+    // Round up, so that at least ms is slept even with a coarse tick
+    vTaskDelay(pdMS_TO_TICKS(ms) + 1);
+}
+
+static SemaphoreHandle_t hrdy_semaphore;
+void IRAM_ATTR hrdy_isr(void *arg) {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    xSemaphoreGiveFromISR((SemaphoreHandle_t)arg, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+FORCE_INLINE_ATTR void it8951_wait_hrdy(void) {
+    if(gpio_get_level(hrdy) == 0) {
+        // TODO: Using xTaskToNotify may be a quicker option
+        xSemaphoreTake(hrdy_semaphore, portMAX_DELAY);
+    }
+}
+
+/// @brief Sets up the SPI bus and the nCS and HRDY GPIOs of the IT8951, and
+/// sets the transport callbacks of the handler
+/// @param hdlr Handler to set the callbacks of. Its other fields are kept
+void display_spi_init(stIT8951_Handler_t *hdlr) {
+    ESP_ERROR_CHECK(spi_bus_initialize(SPI2_HOST, &(spi_bus_config_t){
+        .miso_io_num = spi_miso,
+        .mosi_io_num = spi_mosi,
+        .sclk_io_num = spi_clk,
+        .quadwp_io_num = -1, // Unused
+        .quadhd_io_num = -1, // Unused
+        .max_transfer_sz = DISPLAY_SPI_MAX_TRANSFER_SIZE,
+    }, SPI_DMA_CH_AUTO));
+
+    ESP_ERROR_CHECK(spi_bus_add_device(SPI2_HOST, &(spi_device_interface_config_t){
+        .clock_speed_hz = DISPLAY_SPI_CLOCK_SPEED_HZ,
+        .mode = 0,
+        .spics_io_num = -1, // Controlled externally
+        .queue_size = SPI_QUEUE_SIZE,
+        .pre_cb = NULL,
+        .post_cb = spi_post_cb,
+        .flags = 0,
+    }, &spi));
+
+    gpio_config(&(gpio_config_t){
+        .pin_bit_mask = (1ULL << hrdy),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_POSEDGE,
+    });
+    hrdy_semaphore = xSemaphoreCreateBinary();
+    spi_done_semaphore = xSemaphoreCreateBinary();
+    gpio_install_isr_service(0);
+    gpio_isr_handler_add(hrdy, hrdy_isr, (void*)hrdy_semaphore);
+
+    gpio_config(&(gpio_config_t){
+        .pin_bit_mask = (1ULL << ncs),
+        .mode = GPIO_MODE_DEF_OUTPUT,
+    });
+    gpio_set_level(ncs, true);
+
+    hdlr->spi_transcieve     = it8951_transcieve;
+    hdlr->set_ncs            = it8951_set_ncs;
+    hdlr->wait_hrdy          = it8951_wait_hrdy;
+    hdlr->spi_transmit_async = it8951_spi_transmit_async;
+    hdlr->spi_wait_async     = it8951_spi_wait_async;
+    hdlr->get_time_ms        = it8951_get_time_ms;
+    hdlr->sleep_ms           = it8951_sleep_ms;
+    hdlr->get_time_us        = it8951_get_time_us;
+}
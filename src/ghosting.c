@@ -0,0 +1,121 @@
+#include <string.h>
+#include "esp_log.h"
+#include "ghosting.h"
+
+static const char *tag = "GHOSTING";
+
+// The VB3300-KCA is 1872x1404, i.e. 30x22 tiles
+#define MAX_TILE_COLS (32)
+#define MAX_TILE_ROWS (32)
+
+// Number of fast updates each tile took since its last flashing update
+static uint8_t fast_updates[MAX_TILE_ROWS][MAX_TILE_COLS];
+static uint8_t budget = GHOSTING_DEFAULT_BUDGET;
+static uint16_t width, height;
+static uint32_t cols, rows;
+
+void ghosting_init(uint16_t panel_width, uint16_t panel_height) {
+    width  = panel_width;
+    height = panel_height;
+    cols = (width  + GHOSTING_TILE_SIZE-1)/GHOSTING_TILE_SIZE;
+    rows = (height + GHOSTING_TILE_SIZE-1)/GHOSTING_TILE_SIZE;
+    assert(cols <= MAX_TILE_COLS && rows <= MAX_TILE_ROWS);
+    memset(fast_updates, 0, sizeof(fast_updates));
+}
+
+/// @brief Sets the number of fast updates a tile may take before it is due a
+/// cleanup. 0 disables the cleanups.
+void ghosting_set_budget(uint8_t fast_update_budget) {
+    budget = fast_update_budget;
+}
+
+/// @brief Records an update in the refresh history of the tiles it touches.
+/// Flashing waveforms (INIT, GC16) clear the ghosting of the tiles they fully
+/// cover, every other waveform adds to it.
+/// @param rect Updated area
+/// @param mode Waveform the area was updated with
+void ghosting_record_update(const stRectangle_t *const rect, eIT8951_DisplayMode_t mode) {
+    assert(rect);
+    if(rect->width == 0 || rect->height == 0 || cols == 0) {
+        return;
+    }
+    const bool is_clean = mode == IT8951_DISPLAY_MODE_INIT || mode == IT8951_DISPLAY_MODE_GC16;
+
+    const uint32_t x2 = rect->x + rect->width, y2 = rect->y + rect->height;
+    for(uint32_t r=rect->y/GHOSTING_TILE_SIZE; r<rows && r*GHOSTING_TILE_SIZE<y2; r++) {
+        for(uint32_t c=rect->x/GHOSTING_TILE_SIZE; c<cols && c*GHOSTING_TILE_SIZE<x2; c++) {
+            if(!is_clean) {
+                fast_updates[r][c] += (fast_updates[r][c] < UINT8_MAX);
+                continue;
+            }
+            // A tile at the panel's edge is covered if the rect reaches the edge
+            const uint32_t tx1 = c*GHOSTING_TILE_SIZE, ty1 = r*GHOSTING_TILE_SIZE;
+            const uint32_t tx2 = (tx1+GHOSTING_TILE_SIZE < width)  ? tx1+GHOSTING_TILE_SIZE : width;
+            const uint32_t ty2 = (ty1+GHOSTING_TILE_SIZE < height) ? ty1+GHOSTING_TILE_SIZE : height;
+            if(rect->x <= tx1 && rect->y <= ty1 && x2 >= tx2 && y2 >= ty2) {
+                fast_updates[r][c] = 0;
+            }
+        }
+    }
+}
+
+bool ghosting_is_cleanup_due(void) {
+    if(budget == 0) {
+        return false;
+    }
+    for(uint32_t r=0; r<rows; r++) {
+        for(uint32_t c=0; c<cols; c++) {
+            if(fast_updates[r][c] >= budget) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/// @brief Consolidates the tiles over their budget into as few rectangles as
+/// possible: horizontal runs of tiles are merged first, then the runs of the
+/// consecutive tile rows that span the same columns.
+/// @param rects [out] Rectangles to refresh with GC16
+/// @param max_rects Capacity of rects
+/// @return Number of rectangles written to rects
+uint32_t ghosting_get_cleanup_rects(stRectangle_t *rects, uint32_t max_rects) {
+    assert(rects);
+    uint32_t cnt = 0;
+    if(budget == 0) {
+        return 0;
+    }
+
+    for(uint32_t r=0; r<rows; r++) {
+        for(uint32_t c=0; c<cols; c++) {
+            if(fast_updates[r][c] < budget) {
+                continue;
+            }
+            const uint32_t c1 = c;
+            while(c+1 < cols && fast_updates[r][c+1] >= budget) {
+                c++;
+            }
+            const uint16_t x  = c1*GHOSTING_TILE_SIZE;
+            const uint16_t x2 = ((c+1)*GHOSTING_TILE_SIZE < width) ? (c+1)*GHOSTING_TILE_SIZE : width;
+            const uint16_t y  = r*GHOSTING_TILE_SIZE;
+            const uint16_t y2 = ((r+1)*GHOSTING_TILE_SIZE < height) ? (r+1)*GHOSTING_TILE_SIZE : height;
+
+            // Extend a rect ending in the previous row spanning the same columns
+            bool merged = false;
+            for(uint32_t i=0; i<cnt && !merged; i++) {
+                if(rects[i].x == x && rects[i].width == x2-x && rects[i].y+rects[i].height == y) {
+                    rects[i].height += y2-y;
+                    merged = true;
+                }
+            }
+            if(!merged) {
+                if(cnt == max_rects) {
+                    ESP_LOGW(tag, "Too many cleanup rects, the rest is left for later");
+                    return cnt;
+                }
+                rects[cnt++] = (stRectangle_t){x, y, x2-x, y2-y};
+            }
+        }
+    }
+    return cnt;
+}
@@ -7,6 +7,7 @@
 #include "esp_log.h"
 #include "lvgl.h"
 #include "display.h"
+#include "assets.h"
 #include "ui.h"
 #include "it8951.h"
 #include "esp_spiffs.h"
@@ -26,7 +27,6 @@ SemaphoreHandle_t file_mutex;
 // https://github.com/espressif/arduino-esp32/issues/6762#issuecomment-1182821492)
 // Try to set ESP_CONSOLE_USB_SERIAL_JTAG in the menuconfig (prevents USB mass 
 // storage from working) and set init state of RTS/DTS to 0 at upload
-// TODO: I should reduce the SPIFFS size to allow more flash space for UI elems
 // TODO: Although the label's dynamic text update over BLE works, it leaves a 
 // weird artefact on the display
 
@@ -35,9 +35,10 @@ SemaphoreHandle_t file_mutex;
 void app_main(void) {
     // 1872x1404 E-Ink VB3300-KCA 4bpp display
     // Buffer for LVGL drawing and rendering (ping-pong). Each buffer is a 1/2
-    // frame at 16bit resolution. Before sending the image to the contoller, the 
-    // resolution is reduced to 4bpp grayscale. ~5.01MB buffer in SPIRAM
-    EXT_RAM_BSS_ATTR static uint8_t draw_buff[2][DISPLAY_VER_RES*DISPLAY_HOR_RES];
+    // frame at LV_COLOR_DEPTH, RGB565 or L8. Before sending the image to the 
+    // contoller, the resolution is reduced to 4bpp grayscale. ~5.01MB buffer 
+    // in SPIRAM at 16bit, ~2.51MB with L8
+    EXT_RAM_BSS_ATTR static uint8_t draw_buff[2][DISPLAY_VER_RES*DISPLAY_HOR_RES*LV_COLOR_DEPTH/16];
 
     ESP_LOGI("HA-EINK", "Starting HA E-Ink display...");
     
@@ -57,6 +58,15 @@ void app_main(void) {
     ble_init();
 
     display_init();
+#if DISPLAY_GRAY_WEDGE
+    // Calibration of the gray curve, see tools/gray4_curve.py
+    display_show_gray_wedge();
+    while(true) {
+        display_process();
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+#endif
+    assets_init();
 
     // Set up LVGL
     lv_init();
@@ -77,6 +87,7 @@ void app_main(void) {
         // All UI operations must be called from the thread this funciton is 
         // periodically called from.
         lv_timer_handler();
+        display_process();
 
         ui_update(NULL);
     }
@@ -11,8 +11,10 @@ lv_obj_t * ui_screen_main;
 lv_obj_t * ui_label_message;
 
 ///////////////////// TEST LVGL SETTINGS ////////////////////
-#if LV_COLOR_DEPTH != 16
-    #error "LV_COLOR_DEPTH should be 16bit to match SquareLine Studio's settings"
+// SquareLine Studio exports for 16bit. LVGL converts the RGB565 images to L8
+// while blending them, and the fonts are alpha only, so L8 renders them too.
+#if LV_COLOR_DEPTH != 16 && LV_COLOR_DEPTH != 8
+    #error "LV_COLOR_DEPTH should be 16bit to match SquareLine Studio's settings, or 8bit (L8)"
 #endif
 
 extern volatile bool is_json_modified;
@@ -0,0 +1,62 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "waveform.h"
+
+static const char *tag = "WAVEFORM";
+
+// Number of updates that were driven with each waveform
+static uint32_t mode_count[IT8951_DISPLAY_MODE_DU4+1];
+
+// Gray levels the DU4 waveform can render: 0x0, 0x5, 0xA and 0xF
+#define DU4_LEVELS ((1u << 0x0) | (1u << 0x5) | (1u << 0xA) | (1u << 0xF))
+#define DU_LEVELS  ((1u << 0x0) | (1u << 0xF))
+
+/// @brief Picks the fastest waveform that renders the region's content 
+/// correctly, based on its gray-level histogram:
+/// - DU for pure black and white content
+/// - DU4 for content drawn with the 4 levels DU4 can render
+/// - GL16 for mostly white content, like text on a white background
+/// - GC16 otherwise
+/// @param hist Number of pixels of each gray level in the region
+/// @return Display mode to update the region with
+eIT8951_DisplayMode_t waveform_select(const uint32_t hist[WAVEFORM_GRAY_LEVELS]) {
+    uint32_t levels = 0, total = 0;
+    for(uint32_t g=0; g<WAVEFORM_GRAY_LEVELS; g++) {
+        levels |= (hist[g] != 0) << g;
+        total += hist[g];
+    }
+
+    eIT8951_DisplayMode_t mode;
+    if((levels & ~DU_LEVELS) == 0) {
+        mode = IT8951_DISPLAY_MODE_DU;
+    } else if((levels & ~DU4_LEVELS) == 0) {
+        mode = IT8951_DISPLAY_MODE_DU4;
+    } else if(hist[WAVEFORM_GRAY_LEVELS-1]*100ull >= total*(uint64_t)WAVEFORM_GL16_WHITE_PERCENT) {
+        mode = IT8951_DISPLAY_MODE_GL16;
+    } else {
+        mode = IT8951_DISPLAY_MODE_GC16;
+    }
+    return mode;
+}
+
+/// @brief Counts an update that was driven with the waveform. Only the updates
+/// that were actually sent to the IT8951 are recorded, not every selection.
+/// @param mode Display mode of the update
+void waveform_record_update(eIT8951_DisplayMode_t mode) {
+    assert(IsEnum_IT8951_DisplayMode(mode));
+    mode_count[mode]++;
+}
+
+/// @brief Gets the number of updates recorded with the waveform
+/// @param mode Display mode
+/// @return Number of updates
+uint32_t waveform_get_count(eIT8951_DisplayMode_t mode) {
+    assert(IsEnum_IT8951_DisplayMode(mode));
+    return mode_count[mode];
+}
+
+void waveform_log_stats(void) {
+    ESP_LOGD(tag, "Updates per waveform: DU %" PRIu32 ", DU4 %" PRIu32 ", GL16 %" PRIu32 ", GC16 %" PRIu32,
+             mode_count[IT8951_DISPLAY_MODE_DU], mode_count[IT8951_DISPLAY_MODE_DU4],
+             mode_count[IT8951_DISPLAY_MODE_GL16], mode_count[IT8951_DISPLAY_MODE_GC16]);
+}
@@ -0,0 +1,13 @@
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+// Native stand-in for ESP-IDF's esp_attr.h. There is no IRAM, PSRAM or DMA
+// capable memory on the host, so the placement attributes are no-ops.
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_BSS_ATTR
+#define WORD_ALIGNED_ATTR __attribute__((aligned(4)))
+#define FORCE_INLINE_ATTR static inline __attribute__((always_inline))
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+// Native stand-in for ESP-IDF's esp_log.h, printing to stdout
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+#define esp_log_level_set(tag, level) do { (void)(tag); (void)(level); } while(0)
+
+#define ESP_LOGE(tag, format, ...) printf("E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) printf("W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) printf("I %s: " format "\n", tag, ##__VA_ARGS__)
+// Compiled out, as with the default CONFIG_LOG_MAXIMUM_LEVEL
+#define ESP_LOGD(tag, format, ...) do { if(0) printf(format, ##__VA_ARGS__); (void)(tag); } while(0)
+#define ESP_LOGV(tag, format, ...) do { if(0) printf(format, ##__VA_ARGS__); (void)(tag); } while(0)
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Native stand-in for ESP-IDF's esp_timer.h on the monotonic clock
+
+static inline int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000ll + ts.tv_nsec/1000;
+}
+
+#endif
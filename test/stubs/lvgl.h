@@ -0,0 +1,37 @@
+#ifndef LVGL_H
+#define LVGL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Native stand-in for the parts of LVGL's API display.c uses. The test that
+// links display.c implements the functions, playing LVGL's part of the flush.
+
+#ifndef LV_COLOR_DEPTH
+#define LV_COLOR_DEPTH (16)
+#endif
+
+typedef struct lv_display_t lv_display_t;
+typedef struct lv_event_t lv_event_t;
+
+// The bounds are inclusive
+typedef struct {
+    int32_t x1;
+    int32_t y1;
+    int32_t x2;
+    int32_t y2;
+} lv_area_t;
+
+static inline int32_t lv_area_get_width(const lv_area_t *area) {
+    return area->x2 - area->x1 + 1;
+}
+
+static inline int32_t lv_area_get_height(const lv_area_t *area) {
+    return area->y2 - area->y1 + 1;
+}
+
+void lv_display_flush_ready(lv_display_t *disp);
+bool lv_display_flush_is_last(lv_display_t *disp);
+void *lv_event_get_param(lv_event_t *e);
+
+#endif
@@ -0,0 +1,303 @@
+#include <limits.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include "it8951.h"
+#include "it8951_sim.h"
+#include "gray4.h"
+#include "waveform.h"
+
+static const char *tag = "BENCH";
+
+// Benchmarks of the display pipeline on a full frame of the 10.3" panel. The
+// times are the fastest of BENCH_RUNS runs in ns/pixel. The IT8951 commands
+// and SPI bytes of each kind of update are counted on the simulator and
+// checked against budgets, so a change that sends more fails the suite.
+
+#define BENCH_WIDTH  (1872)
+#define BENCH_HEIGHT (1404)
+#define BENCH_PIXELS (BENCH_WIDTH*BENCH_HEIGHT)
+#define BENCH_RUNS   (5)
+// Bytes per SPI transfer, as the display's bounce buffers
+#define BENCH_BLOCK_BYTES (32768)
+
+// Max IT8951 commands per update, including the register polls of the wait
+// for its waveform. The simulator's clock is virtual, so these are exact.
+#define BUDGET_COMMANDS_PAGE (9)
+#define BUDGET_COMMANDS_BOX  (6)
+#define BUDGET_COMMANDS_1BPP (13)
+#define BUDGET_COMMANDS_FILL (4)
+
+// The LUT the conversion replaced, to compare with
+static const uint8_t lut[65536] = {
+    #include "rgb565_to_gray4.txt"
+};
+
+static uint16_t *rgb565;
+static uint8_t *gray4;
+static uint8_t *gray8;
+static void *out;
+
+void setUp(void) {}
+void tearDown(void) {}
+void suiteSetUp(void) {
+    printf("==[ Benchmarking the display pipeline... ]==\n");
+}
+
+/// @brief Pseudo-random pixels, the worst case for the LUT's cache hits
+static void fill_random(void *data, const uint32_t bytes) {
+    uint32_t state = 0x12345678;
+    for(uint32_t i=0; i<bytes; i++) {
+        state = state*1664525 + 1013904223;
+        ((uint8_t*)data)[i] = state >> 24;
+    }
+}
+
+/// @brief Times a benchmark BENCH_RUNS times
+/// @param name Name of the benchmark in the report
+/// @param run Benchmark to time
+/// @param num_pix Number of pixels one run processes
+/// @return The fastest run [ns/pixel]
+static double bench(const char *name, void (*run)(void), const uint32_t num_pix) {
+    int64_t best_us = INT64_MAX;
+    for(uint32_t i=0; i<BENCH_RUNS; i++) {
+        const int64_t start = esp_timer_get_time();
+        run();
+        const int64_t elapsed_us = esp_timer_get_time() - start;
+        best_us = (elapsed_us < best_us) ? elapsed_us : best_us;
+    }
+    const double ns_per_px = (best_us*1000.0)/num_pix;
+    ESP_LOGI(tag, "%-24s %8.3f ns/pixel (%" PRId64 " us per frame)", name, ns_per_px, best_us);
+    return ns_per_px;
+}
+
+static void run_rgb565_to_gray4(void) {
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_from_rgb565(&rgb565[y*BENCH_WIDTH], &gray4[y*BENCH_WIDTH/2], BENCH_WIDTH);
+    }
+}
+
+static void run_rgb565_to_gray4_lut(void) {
+    for(uint32_t i=0; i<BENCH_PIXELS; i+=2) {
+        gray4[i/2] = (lut[rgb565[i]] << 4) | lut[rgb565[i+1]];
+    }
+}
+
+static void run_rgb565_bayer(void) {
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_dither_bayer_rgb565(&rgb565[y*BENCH_WIDTH], &gray4[y*BENCH_WIDTH/2], BENCH_WIDTH, 0, y);
+    }
+}
+
+// Floyd-Steinberg error carried between the rows
+static int16_t dither_err[BENCH_WIDTH + 1];
+
+static void run_rgb565_fs(void) {
+    memset(dither_err, 0, sizeof(dither_err));
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_dither_fs_rgb565(&rgb565[y*BENCH_WIDTH], &gray4[y*BENCH_WIDTH/2], BENCH_WIDTH, dither_err);
+    }
+}
+
+static void run_l8_to_gray4(void) {
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_from_l8(&gray8[y*BENCH_WIDTH], &gray4[y*BENCH_WIDTH/2], BENCH_WIDTH);
+    }
+}
+
+static void run_l8_bayer(void) {
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_dither_bayer_l8(&gray8[y*BENCH_WIDTH], &gray4[y*BENCH_WIDTH/2], BENCH_WIDTH, 0, y);
+    }
+}
+
+static void run_l8_fs(void) {
+    memset(dither_err, 0, sizeof(dither_err));
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_dither_fs_l8(&gray8[y*BENCH_WIDTH], &gray4[y*BENCH_WIDTH/2], BENCH_WIDTH, dither_err);
+    }
+}
+
+static void run_gray4_to_1bpp(void) {
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        gray4_to_1bpp(&gray4[y*BENCH_WIDTH/2], &((uint8_t*)out)[y*BENCH_WIDTH/8], BENCH_WIDTH/8, 0xF);
+    }
+}
+
+static void run_waveform_select(void) {
+    uint32_t hist[GRAY4_LEVELS] = {0};
+    gray4_histogram(gray4, BENCH_PIXELS, hist);
+    TEST_ASSERT_TRUE(IsEnum_IT8951_DisplayMode(waveform_select(hist)));
+}
+
+static void run_pack_pixels(void) {
+    static const stIT8951_ImageInfo_t img_info = {IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+    static const stRectangle_t rect = {0, 0, BENCH_WIDTH, BENCH_HEIGHT};
+    uint32_t cnt;
+    it8951_pack_pixels(&img_info, &rect, gray8, out, &cnt);
+    TEST_ASSERT_EQUAL(BENCH_PIXELS/4, cnt);
+}
+
+/// @brief The copies of display_blit_asset(): the asset's rows from the flash
+/// mapping into the shadow framebuffer, then from there into the bounce buffer
+/// of each SPI transfer. The bounce buffer is in gray8, so this runs last.
+static void run_asset_copies(void) {
+    const uint32_t row_bytes = BENCH_WIDTH/2;
+    const uint32_t rows_per_block = BENCH_BLOCK_BYTES/row_bytes;
+    for(uint32_t y=0; y<BENCH_HEIGHT; y++) {
+        memcpy((uint8_t*)out + y*row_bytes, gray4 + y*row_bytes, row_bytes);
+    }
+    for(uint32_t row=0; row<BENCH_HEIGHT; row+=rows_per_block) {
+        const uint32_t rows = (BENCH_HEIGHT - row < rows_per_block) ? BENCH_HEIGHT - row : rows_per_block;
+        for(uint32_t y=row; y<row+rows; y++) {
+            memcpy(gray8 + (y - row)*row_bytes, (uint8_t*)out + y*row_bytes, row_bytes);
+        }
+    }
+}
+
+void test_bench_pixels(void) {
+    rgb565 = malloc(BENCH_PIXELS*sizeof(uint16_t));
+    gray4 = malloc(BENCH_PIXELS/2);
+    gray8 = malloc(BENCH_PIXELS);
+    out = malloc(BENCH_PIXELS/2);
+    if(!rgb565 || !gray4 || !gray8 || !out) {
+        free(rgb565); free(gray4); free(gray8); free(out);
+        TEST_IGNORE_MESSAGE("Not enough memory for a full frame");
+    }
+    fill_random(rgb565, BENCH_PIXELS*sizeof(uint16_t));
+    fill_random(gray8, BENCH_PIXELS);
+
+    bench("RGB565 to GRAY4 (LUT)", run_rgb565_to_gray4_lut, BENCH_PIXELS);
+    bench("RGB565 to GRAY4", run_rgb565_to_gray4, BENCH_PIXELS);
+    bench("RGB565 to GRAY4 (Bayer)", run_rgb565_bayer, BENCH_PIXELS);
+    bench("RGB565 to GRAY4 (F-S)", run_rgb565_fs, BENCH_PIXELS);
+    bench("L8 to GRAY4", run_l8_to_gray4, BENCH_PIXELS);
+    bench("L8 to GRAY4 (Bayer)", run_l8_bayer, BENCH_PIXELS);
+    bench("L8 to GRAY4 (F-S)", run_l8_fs, BENCH_PIXELS);
+    bench("GRAY4 to 1bpp", run_gray4_to_1bpp, BENCH_PIXELS);
+    bench("Histogram + waveform", run_waveform_select, BENCH_PIXELS);
+    bench("Pack 8bpp to 4bpp", run_pack_pixels, BENCH_PIXELS);
+    bench("Asset blit copies", run_asset_copies, BENCH_PIXELS);
+
+    free(rgb565);
+    free(gray4);
+    free(gray8);
+    free(out);
+}
+
+static stIT8951_Handler_t hdlr;
+// Virtual time the update being counted started at [ns]
+static uint64_t update_start_ns;
+
+/// @brief Streams an area's pixels in BENCH_BLOCK_BYTES transfers
+static void load_area(const uint8_t *block, const uint32_t row_bytes, const uint32_t height) {
+    const uint32_t rows_per_block = BENCH_BLOCK_BYTES/row_bytes;
+    for(uint32_t row=0; row<height; row+=rows_per_block) {
+        const uint32_t rows = (height - row < rows_per_block) ? height - row : rows_per_block;
+        TEST_ASSERT_TRUE(it8951_load_img_area_write_async(&hdlr, block, rows*row_bytes));
+    }
+    TEST_ASSERT_TRUE(it8951_wait_async(&hdlr));
+}
+
+/// @brief Reports the IT8951 transactions of the update since the last
+/// it8951_sim_reset_stats() and checks them against the budget
+static void report_update(const char *name, const uint32_t budget) {
+    const stIT8951_SimStats_t *const stats = it8951_sim_stats();
+    ESP_LOGI(tag, "%-24s %3lu commands, %4lu SPI transfers, %8llu bytes, %7.2f ms", name,
+             (unsigned long)stats->commands, (unsigned long)stats->spi_transfers,
+             (unsigned long long)stats->spi_bytes, (it8951_sim_time_ns() - update_start_ns)/1e6);
+    TEST_ASSERT_EQUAL(0, stats->protocol_errors);
+    TEST_ASSERT_EQUAL(0, stats->conflicts);
+    TEST_ASSERT_LESS_OR_EQUAL(budget, stats->commands);
+}
+
+/// @brief Starts counting the IT8951 transactions of an update
+static void start_update(void) {
+    it8951_sim_reset_stats();
+    update_start_ns = it8951_sim_time_ns();
+}
+
+void test_bench_commands_per_frame(void) {
+    const stIT8951_SimConfig_t cfg = IT8951_SIM_CONFIG_DEFAULT;
+    static uint8_t block[BENCH_BLOCK_BYTES];
+    if(!it8951_sim_init(&cfg)) {
+        TEST_IGNORE_MESSAGE("Not enough memory for the full panel");
+    }
+    hdlr = (stIT8951_Handler_t){
+        .transport = IT8951_TRANSPORT_FRAMED,
+        .vcom_mv = INT_MAX,
+    };
+    it8951_sim_attach(&hdlr);
+    TEST_ASSERT_TRUE(it8951_init(&hdlr));
+    uint32_t back_buff;
+    TEST_ASSERT_TRUE(it8951_frame_buffer_alloc(&hdlr, &back_buff));
+    memset(block, 0x5A, sizeof(block));
+
+    const stIT8951_ImageInfo_t img_info = {IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+    const stRectangle_t page = {0, 0, BENCH_WIDTH, BENCH_HEIGHT};
+    const stRectangle_t box = {384, 300, 512, 256};
+    uint32_t id;
+
+    // A new screen, uploaded into the back buffer and flipped in
+    const uint32_t front = hdlr.frame_buffers.front;
+    start_update();
+    TEST_ASSERT_TRUE(it8951_frame_buffer_set_target(&hdlr, back_buff));
+    TEST_ASSERT_TRUE(it8951_load_img_area_begin(&hdlr, &img_info, &page));
+    load_area(block, BENCH_WIDTH/2, BENCH_HEIGHT);
+    TEST_ASSERT_TRUE(it8951_frame_buffer_flip(&hdlr, back_buff, IT8951_DISPLAY_MODE_GC16, &id));
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+    report_update("Page (4bpp, flip)", BUDGET_COMMANDS_PAGE);
+    back_buff = front;
+
+    // A partial update of the front buffer
+    start_update();
+    TEST_ASSERT_TRUE(it8951_frame_buffer_set_target(&hdlr, hdlr.frame_buffers.front));
+    TEST_ASSERT_TRUE(it8951_load_img_area_begin(&hdlr, &img_info, &box));
+    load_area(block, box.width/2, box.height);
+    TEST_ASSERT_TRUE(it8951_frame_buffer_display_async(&hdlr, hdlr.frame_buffers.front, &box, IT8951_DISPLAY_MODE_GL16, &id));
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+    report_update("Box (4bpp)", BUDGET_COMMANDS_BOX);
+
+    // A two-level partial update, through the back buffer
+    start_update();
+    TEST_ASSERT_TRUE(it8951_frame_buffer_set_target(&hdlr, back_buff));
+    TEST_ASSERT_TRUE(it8951_load_img_area_1bpp_begin(&hdlr, &box));
+    load_area(block, box.width/8, box.height);
+    TEST_ASSERT_TRUE(it8951_frame_buffer_display_1bpp_async(&hdlr, back_buff, &box, IT8951_DISPLAY_MODE_DU, 0x00, 0xFF, &id));
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+    report_update("Box (1bpp)", BUDGET_COMMANDS_1BPP);
+
+    // A uniform box, filled by the IT8951
+    start_update();
+    TEST_ASSERT_TRUE(it8951_fill_rect_async(&hdlr, &box, IT8951_DISPLAY_MODE_DU, 0xFF, &id));
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+    report_update("Box (fill)", BUDGET_COMMANDS_FILL);
+
+    it8951_sim_deinit();
+}
+
+static int run_tests(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_bench_pixels);
+    RUN_TEST(test_bench_commands_per_frame);
+
+    return UNITY_END();
+}
+
+// This is required for the ESP-IDF framework
+void app_main() {
+    run_tests();
+}
+
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
+}
+#endif
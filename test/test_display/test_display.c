@@ -0,0 +1,246 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "unity.h"
+#include "lvgl.h"
+#include "it8951.h"
+#include "it8951_sim.h"
+#include "display.h"
+#include "display_spi.h"
+#include "gray4.h"
+
+// display.c's flush path on the simulated IT8951. The test plays LVGL's part:
+// it renders RGB565 areas, hands them to display_flush() and checks where the
+// pixels land in the image buffer and on the panel.
+
+#define RGB565_BLACK (0x0000)
+#define RGB565_WHITE (0xFFFF)
+// Stripes of 3 gray levels. Two-level content would go through the 1bpp path
+static const uint16_t stripes[] = {RGB565_BLACK, 0x4208, 0x8410};
+
+// LVGL 9.2's flush state, as far as display.c sees it
+struct lv_display_t {
+    bool flushing;
+    bool flushing_last;
+    uint32_t flush_ready_cnt;
+};
+struct lv_event_t {
+    void *param;
+};
+
+static lv_display_t disp;
+static uint16_t px_map[DISPLAY_HOR_RES*64];
+static stIT8951_Handler_t *display_hdlr;
+
+// The board's SPI and GPIOs are replaced by the simulator
+void display_spi_init(stIT8951_Handler_t *hdlr) {
+    it8951_sim_attach(hdlr);
+    display_hdlr = hdlr;
+}
+
+static bool failing_transmit_async(const void *txdata, size_t len) {
+    return false;
+}
+
+// As in LVGL 9.2, the flush is marked done and the last flag is cleared
+void lv_display_flush_ready(lv_display_t *d) {
+    d->flushing = false;
+    d->flushing_last = false;
+    d->flush_ready_cnt++;
+}
+
+bool lv_display_flush_is_last(lv_display_t *d) {
+    return d->flushing_last;
+}
+
+void *lv_event_get_param(lv_event_t *e) {
+    return e->param;
+}
+
+void setUp(void) {
+    it8951_sim_reset_stats();
+}
+void tearDown(void) {}
+
+/// @brief Hands an area to display_flush(), like LVGL's refresh does. The
+/// columns cycle through the colors.
+static void flush_area(const lv_area_t area, const uint16_t *colors, const uint32_t color_cnt, const bool is_last) {
+    const uint32_t width = lv_area_get_width(&area);
+    const uint32_t num_pix = width*lv_area_get_height(&area);
+    TEST_ASSERT_TRUE(num_pix <= ARRAY_LENGTH(px_map));
+    for(uint32_t i=0; i<num_pix; i++) {
+        px_map[i] = colors[(area.x1 + i % width) % color_cnt];
+    }
+    disp.flushing = true;
+    disp.flushing_last = is_last;
+    const uint32_t flush_ready_cnt = disp.flush_ready_cnt;
+    display_flush(&disp, &area, (uint8_t*)px_map);
+    TEST_ASSERT_EQUAL(flush_ready_cnt + 1, disp.flush_ready_cnt);
+}
+
+/// @brief Gets an image buffer pixel of the default frame buffer
+static uint8_t img_buff_pixel(const uint16_t x, const uint16_t y) {
+    return it8951_sim_sdram()[IT8951_SIM_IMG_BUFF_ADDR + (uint32_t)y*DISPLAY_PANEL_WIDTH + x];
+}
+
+static void assert_sim_clean(void) {
+    const stIT8951_SimStats_t *const stats = it8951_sim_stats();
+    if(stats->protocol_errors) {
+        printf("%s\n", it8951_sim_last_error());
+    }
+    TEST_ASSERT_EQUAL(0, stats->protocol_errors);
+    TEST_ASSERT_EQUAL(0, stats->conflicts);
+}
+
+void test_display_rounder(void) {
+    // The x bounds are widened to whole 4 pixel words
+    lv_area_t area = {5, 10, 6, 20};
+    display_rounder(&(lv_event_t){ .param = &area });
+    TEST_ASSERT_EQUAL(4, area.x1);
+    TEST_ASSERT_EQUAL(7, area.x2);
+    TEST_ASSERT_EQUAL(10, area.y1);
+    TEST_ASSERT_EQUAL(20, area.y2);
+}
+
+void test_display_flush_area(void) {
+    // Only the changed pixels of the area reach the image buffer
+    const lv_area_t area = {200, 100, 263, 131};
+    flush_area(area, stripes, ARRAY_LENGTH(stripes), false);
+    TEST_ASSERT_EQUAL_HEX8(0x00, img_buff_pixel(201, 100));
+    TEST_ASSERT_EQUAL_HEX8(0x00, img_buff_pixel(261, 131));
+    TEST_ASSERT_NOT_EQUAL(0xFF, img_buff_pixel(200, 100));
+    TEST_ASSERT_NOT_EQUAL(0xFF, img_buff_pixel(263, 131));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, img_buff_pixel(199, 100));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, img_buff_pixel(264, 131));
+    TEST_ASSERT_EQUAL(64*32, it8951_sim_stats()->pixels_loaded);
+
+    // An unchanged area is not uploaded again. Being the last area, it still
+    // displays the pending update of the first one
+    it8951_sim_reset_stats();
+    flush_area(area, stripes, ARRAY_LENGTH(stripes), true);
+    TEST_ASSERT_EQUAL(0, it8951_sim_stats()->pixels_loaded);
+    TEST_ASSERT_EQUAL(1, it8951_sim_stats()->updates);
+    assert_sim_clean();
+}
+
+void test_display_flush_last(void) {
+    // A refresh of 3 areas. Each flush displays the previous area's update,
+    // and the last one its own, as LVGL does not flush again after it
+    const lv_area_t areas[] = {
+        {0,   300, 63,  315},
+        {100, 300, 163, 315},
+        {200, 300, 263, 315},
+    };
+    for(uint32_t i=0; i<ARRAY_LENGTH(areas)-1; i++) {
+        flush_area(areas[i], stripes, ARRAY_LENGTH(stripes), false);
+        TEST_ASSERT_EQUAL(i, it8951_sim_stats()->updates);
+    }
+    flush_area(areas[ARRAY_LENGTH(areas)-1], stripes, ARRAY_LENGTH(stripes), true);
+    TEST_ASSERT_EQUAL(ARRAY_LENGTH(areas), it8951_sim_stats()->updates);
+
+    // The last area reaches the panel once its waveform is done
+    it8951_sim_advance_ns(2000000000ull);
+    display_process();
+    TEST_ASSERT_NOT_EQUAL(0xFF, it8951_sim_get_pixel(200, 300));
+    TEST_ASSERT_EQUAL(0xFF, it8951_sim_get_pixel(264, 300));
+    assert_sim_clean();
+}
+
+void test_display_flush_failed(void) {
+    // The area is in the shadow framebuffer, but its pixels do not make it
+    const lv_area_t area = {400, 300, 463, 315};
+    const lv_area_t other = {200, 100, 263, 131};
+    bool (*const transmit_async)(const void*, size_t) = display_hdlr->spi_transmit_async;
+    display_hdlr->spi_transmit_async = failing_transmit_async;
+    flush_area(area, stripes, ARRAY_LENGTH(stripes), true);
+    display_hdlr->spi_transmit_async = transmit_async;
+    TEST_ASSERT_EQUAL_HEX8(0xFF, img_buff_pixel(402, 300));
+
+    // The next refresh sends it again, though neither area changed
+    it8951_sim_reset_stats();
+    flush_area(other, stripes, ARRAY_LENGTH(stripes), true);
+    TEST_ASSERT_EQUAL_HEX8(0x00, img_buff_pixel(402, 300));
+    TEST_ASSERT_EQUAL(64*16, it8951_sim_stats()->pixels_loaded);
+    TEST_ASSERT_EQUAL(1, it8951_sim_stats()->updates);
+
+    // Then it is done with
+    it8951_sim_reset_stats();
+    flush_area(other, stripes, ARRAY_LENGTH(stripes), true);
+    TEST_ASSERT_EQUAL(0, it8951_sim_stats()->pixels_loaded);
+    assert_sim_clean();
+}
+
+void test_display_flush_1bpp_stale(void) {
+    // Black and white text goes to the back buffer at 1bpp, leaving the front
+    // buffer stale there
+    static const uint16_t text[] = {RGB565_BLACK, RGB565_WHITE};
+    const lv_area_t area = {608, 300, 671, 315};
+    flush_area(area, text, ARRAY_LENGTH(text), true);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, img_buff_pixel(608, 300));
+
+    // An update of the front buffer over it uploads it from the shadow first
+    const lv_area_t over = {640, 310, 703, 331};
+    flush_area(over, stripes, ARRAY_LENGTH(stripes), true);
+    TEST_ASSERT_EQUAL_HEX8(0x00, img_buff_pixel(608, 300));
+    TEST_ASSERT_EQUAL_HEX8(0xF0, img_buff_pixel(609, 300));
+    assert_sim_clean();
+}
+
+void test_display_gray_wedge(void) {
+    // The bars are queued like the UI's updates, over the ones in flight
+    display_show_gray_wedge();
+    it8951_sim_advance_ns(5000000000ull);
+    display_process();
+    const uint32_t bar_width = (DISPLAY_HOR_RES/GRAY4_LEVELS) & ~3u;
+    for(uint32_t i=0; i<GRAY4_LEVELS; i++) {
+        TEST_ASSERT_EQUAL_HEX8(i*0x11, img_buff_pixel(i*bar_width + bar_width/2, 200));
+        TEST_ASSERT_EQUAL_HEX8(i*0x11, it8951_sim_get_pixel(i*bar_width + bar_width/2, 200));
+    }
+    assert_sim_clean();
+
+    // The shadow holds the bars, so redrawing the black one sends nothing
+    static const uint16_t black[] = {RGB565_BLACK};
+    it8951_sim_reset_stats();
+    flush_area((lv_area_t){0, 200, 63, 215}, black, ARRAY_LENGTH(black), true);
+    TEST_ASSERT_EQUAL(0, it8951_sim_stats()->pixels_loaded);
+    TEST_ASSERT_EQUAL(0, it8951_sim_stats()->updates);
+}
+
+static int run_tests(void) {
+    UNITY_BEGIN();
+
+    stIT8951_SimConfig_t cfg = IT8951_SIM_CONFIG_DEFAULT;
+    cfg.panel_width  = DISPLAY_PANEL_WIDTH;
+    cfg.panel_height = DISPLAY_PANEL_HEIGHT;
+    if(!it8951_sim_init(&cfg)) {
+        TEST_MESSAGE("Not enough memory for the full panel");
+        return UNITY_END();
+    }
+    display_init();
+    // The clear's INIT waveform is done before the UI's first refresh
+    it8951_sim_advance_ns(5000000000ull);
+    display_process();
+
+    RUN_TEST(test_display_rounder);
+    RUN_TEST(test_display_flush_area);
+    RUN_TEST(test_display_flush_last);
+    RUN_TEST(test_display_flush_failed);
+    RUN_TEST(test_display_flush_1bpp_stale);
+    RUN_TEST(test_display_gray_wedge);
+
+    it8951_sim_deinit();
+    return UNITY_END();
+}
+
+void app_main() {
+    run_tests();
+}
+
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
+}
+#endif
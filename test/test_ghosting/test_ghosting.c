@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "unity.h"
+#include "ghosting.h"
+
+#define PANEL_WIDTH  (1872)
+#define PANEL_HEIGHT (1404)
+#define TILE         GHOSTING_TILE_SIZE
+
+static stRectangle_t rects[GHOSTING_MAX_CLEANUP_RECTS];
+
+void setUp(void) {
+    ghosting_init(PANEL_WIDTH, PANEL_HEIGHT);
+    ghosting_set_budget(3);
+}
+void tearDown(void) {}
+
+static void record_fast_updates(const stRectangle_t rect, const uint32_t count) {
+    for(uint32_t i=0; i<count; i++) {
+        ghosting_record_update(&rect, IT8951_DISPLAY_MODE_DU);
+    }
+}
+
+static void assert_rect(const stRectangle_t expected, const stRectangle_t actual) {
+    TEST_ASSERT_EQUAL(expected.x, actual.x);
+    TEST_ASSERT_EQUAL(expected.y, actual.y);
+    TEST_ASSERT_EQUAL(expected.width, actual.width);
+    TEST_ASSERT_EQUAL(expected.height, actual.height);
+}
+
+void test_ghosting_budget(void) {
+    // A tile is due once it took as many fast updates as the budget
+    record_fast_updates((stRectangle_t){10, 10, 20, 20}, 2);
+    TEST_ASSERT_FALSE(ghosting_is_cleanup_due());
+    TEST_ASSERT_EQUAL(0, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    record_fast_updates((stRectangle_t){10, 10, 20, 20}, 1);
+    TEST_ASSERT_TRUE(ghosting_is_cleanup_due());
+    TEST_ASSERT_EQUAL(1, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    assert_rect((stRectangle_t){0, 0, TILE, TILE}, rects[0]);
+}
+
+void test_ghosting_budget_disabled(void) {
+    // A zero budget disables the cleanups instead of making them always due
+    ghosting_set_budget(0);
+    TEST_ASSERT_FALSE(ghosting_is_cleanup_due());
+    record_fast_updates((stRectangle_t){0, 0, PANEL_WIDTH, PANEL_HEIGHT}, 5);
+    TEST_ASSERT_FALSE(ghosting_is_cleanup_due());
+    TEST_ASSERT_EQUAL(0, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+
+    // The history is kept, so re-enabling picks it up
+    ghosting_set_budget(3);
+    TEST_ASSERT_TRUE(ghosting_is_cleanup_due());
+}
+
+void test_ghosting_flashing_update(void) {
+    record_fast_updates((stRectangle_t){0, 0, 2*TILE, TILE}, 3);
+    TEST_ASSERT_TRUE(ghosting_is_cleanup_due());
+
+    // A GC16 that covers only part of a tile does not clean it
+    ghosting_record_update(&(stRectangle_t){0, 0, TILE+8, TILE}, IT8951_DISPLAY_MODE_GC16);
+    TEST_ASSERT_EQUAL(1, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    assert_rect((stRectangle_t){TILE, 0, TILE, TILE}, rects[0]);
+
+    ghosting_record_update(&(stRectangle_t){0, 0, 2*TILE, TILE}, IT8951_DISPLAY_MODE_GC16);
+    TEST_ASSERT_FALSE(ghosting_is_cleanup_due());
+
+    // The tiles at the panel's edges are clipped to it, and a rect reaching
+    // the edge covers them
+    const stRectangle_t corner = {PANEL_WIDTH - 16, PANEL_HEIGHT - 4, 16, 4};
+    record_fast_updates(corner, 3);
+    TEST_ASSERT_EQUAL(1, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    assert_rect((stRectangle_t){(PANEL_WIDTH/TILE)*TILE, (PANEL_HEIGHT/TILE)*TILE,
+                                PANEL_WIDTH % TILE, PANEL_HEIGHT % TILE}, rects[0]);
+    ghosting_record_update(&(stRectangle_t){(PANEL_WIDTH/TILE)*TILE, (PANEL_HEIGHT/TILE)*TILE,
+                                            PANEL_WIDTH % TILE, PANEL_HEIGHT % TILE}, IT8951_DISPLAY_MODE_GC16);
+    TEST_ASSERT_FALSE(ghosting_is_cleanup_due());
+}
+
+void test_ghosting_consolidation(void) {
+    // A block of tiles is consolidated into a single rect
+    record_fast_updates((stRectangle_t){TILE+5, 2*TILE+5, 2*TILE, 2*TILE}, 3);
+    TEST_ASSERT_EQUAL(1, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    assert_rect((stRectangle_t){TILE, 2*TILE, 3*TILE, 3*TILE}, rects[0]);
+
+    // An L shape takes a rect per distinct run of columns
+    setUp();
+    record_fast_updates((stRectangle_t){0, 0, 2*TILE, TILE}, 3);
+    record_fast_updates((stRectangle_t){0, TILE, TILE, 2*TILE}, 3);
+    TEST_ASSERT_EQUAL(2, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    assert_rect((stRectangle_t){0, 0, 2*TILE, TILE}, rects[0]);
+    assert_rect((stRectangle_t){0, TILE, TILE, 2*TILE}, rects[1]);
+
+    // Runs separated by a clean row are not merged
+    setUp();
+    record_fast_updates((stRectangle_t){0, 0, TILE, TILE}, 3);
+    record_fast_updates((stRectangle_t){0, 2*TILE, TILE, TILE}, 3);
+    TEST_ASSERT_EQUAL(2, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    assert_rect((stRectangle_t){0, 0, TILE, TILE}, rects[0]);
+    assert_rect((stRectangle_t){0, 2*TILE, TILE, TILE}, rects[1]);
+}
+
+void test_ghosting_max_rects(void) {
+    // A checkerboard cannot be consolidated, the rects beyond the capacity
+    // are left for the next cleanup
+    for(uint32_t r=0; r<4; r++) {
+        for(uint32_t c=r%2; c<8; c+=2) {
+            record_fast_updates((stRectangle_t){c*TILE, r*TILE, TILE, TILE}, 3);
+        }
+    }
+    TEST_ASSERT_EQUAL(16, ghosting_get_cleanup_rects(rects, GHOSTING_MAX_CLEANUP_RECTS));
+    TEST_ASSERT_EQUAL(5, ghosting_get_cleanup_rects(rects, 5));
+    assert_rect((stRectangle_t){0, 0, TILE, TILE}, rects[0]);
+    assert_rect((stRectangle_t){TILE, TILE, TILE, TILE}, rects[4]);
+}
+
+static int run_tests(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_ghosting_budget);
+    RUN_TEST(test_ghosting_budget_disabled);
+    RUN_TEST(test_ghosting_flashing_update);
+    RUN_TEST(test_ghosting_consolidation);
+    RUN_TEST(test_ghosting_max_rects);
+
+    return UNITY_END();
+}
+
+void app_main() {
+    run_tests();
+}
+
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
+}
+#endif
@@ -0,0 +1,296 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include "gray4.h"
+
+static const char *tag = "TEST";
+
+// The LUT the firmware used to convert with, the default gray curve
+static const uint8_t lut[65536] = {
+    #include "rgb565_to_gray4.txt"
+};
+
+#define IS_DEFAULT_CURVE (GRAY4_GAMMA == 1.0 && GRAY4_CONTRAST == 1.0 && \
+                          GRAY4_BLACK_POINT == 0.0 && GRAY4_WHITE_POINT == 1.0)
+
+static const uint16_t thresholds[GRAY4_LEVELS - 1] = {
+    GRAY4_THRESHOLD(1), GRAY4_THRESHOLD(2), GRAY4_THRESHOLD(3), GRAY4_THRESHOLD(4), GRAY4_THRESHOLD(5),
+    GRAY4_THRESHOLD(6), GRAY4_THRESHOLD(7), GRAY4_THRESHOLD(8), GRAY4_THRESHOLD(9), GRAY4_THRESHOLD(10),
+    GRAY4_THRESHOLD(11), GRAY4_THRESHOLD(12), GRAY4_THRESHOLD(13), GRAY4_THRESHOLD(14), GRAY4_THRESHOLD(15),
+};
+
+#define CHUNK_PIXELS (1024)
+
+static uint16_t colors[CHUNK_PIXELS + 16] __attribute__((aligned(16)));
+static uint8_t packed[CHUNK_PIXELS/2 + 16];
+
+void setUp(void) {}
+void tearDown(void) {}
+void suiteSetUp(void) {
+    printf("==[ Testing the GRAY4 conversion (gamma %.2f)... ]==\n", GRAY4_GAMMA);
+}
+
+/// @brief The gray level of a color, by the definition of the curve: the 
+/// number of thresholds its luminance reaches
+static uint8_t reference_gray4(const uint16_t color) {
+    const uint32_t r = color >> 11, g = (color >> 5) & 0x3F, b = color & 0x1F;
+    const uint32_t luma = (18837*r + 18197*g + 7182*b)/31;
+    uint8_t level = 0;
+    for(uint32_t k=0; k<GRAY4_LEVELS - 1; k++) {
+        level += luma >= thresholds[k];
+    }
+    return level;
+}
+
+/// @brief Checks the packed conversion of num_pix colors against the curve
+static void assert_matches_curve(const uint16_t *color, const uint8_t *out, const uint32_t num_pix) {
+    for(uint32_t i=0; i<num_pix; i+=2) {
+        const uint8_t expected = (reference_gray4(color[i]) << 4) | reference_gray4(color[i+1]);
+        if(out[i/2] != expected) {
+            printf("0x%04X,0x%04X: 0x%02X instead of 0x%02X\n", color[i], color[i+1], out[i/2], expected);
+        }
+        TEST_ASSERT_EQUAL_HEX8(expected, out[i/2]);
+    }
+}
+
+void test_gray4_every_color(void) {
+    for(uint32_t base=0; base<65536; base+=CHUNK_PIXELS) {
+        for(uint32_t i=0; i<CHUNK_PIXELS; i++) {
+            colors[i] = base + i;
+        }
+        gray4_from_rgb565(colors, packed, CHUNK_PIXELS);
+        assert_matches_curve(colors, packed, CHUNK_PIXELS);
+    }
+}
+
+/// @brief The default curve is the LUT it replaced
+void test_gray4_default_curve(void) {
+    if(!IS_DEFAULT_CURVE) {
+        TEST_IGNORE_MESSAGE("The gray curve is configured");
+    }
+    for(uint32_t color=0; color<65536; color++) {
+        TEST_ASSERT_EQUAL_HEX8(lut[color], reference_gray4(color));
+    }
+}
+
+/// @brief Every curve is monotonic, from black to white
+void test_gray4_curve_monotonic(void) {
+    for(uint32_t k=1; k<GRAY4_LEVELS - 1; k++) {
+        TEST_ASSERT_LESS_OR_EQUAL(thresholds[k], thresholds[k-1]);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(GRAY4_LUMA_MAX + 1, thresholds[GRAY4_LEVELS - 2]);
+}
+
+/// @brief Unaligned pixels of any even count, and no write past the output
+void test_gray4_alignment(void) {
+    for(uint32_t i=0; i<sizeof(colors)/sizeof(colors[0]); i++) {
+        colors[i] = (i*40503u) ^ (i >> 3);
+    }
+    for(uint32_t offset=0; offset<8; offset++) {
+        for(uint32_t num_pix=0; num_pix<=64; num_pix+=2) {
+            memset(packed, 0xA5, sizeof(packed));
+            gray4_from_rgb565(&colors[offset], &packed[1], num_pix);
+            assert_matches_curve(&colors[offset], &packed[1], num_pix);
+            TEST_ASSERT_EQUAL_HEX8(0xA5, packed[0]);
+            TEST_ASSERT_EQUAL_HEX8(0xA5, packed[1 + num_pix/2]);
+        }
+    }
+}
+
+/// @brief L8 is the luminance scaled to 255, converted through the same curve
+void test_gray4_l8(void) {
+    uint8_t lum[256];
+    for(uint32_t i=0; i<256; i++) {
+        lum[i] = i;
+    }
+    gray4_from_l8(lum, packed, 256);
+    for(uint32_t i=0; i<256; i++) {
+        uint8_t expected = 0;
+        for(uint32_t k=0; k<GRAY4_LEVELS - 1; k++) {
+            expected += i*GRAY4_LUMA_MAX >= 255u*thresholds[k];
+        }
+        TEST_ASSERT_EQUAL_HEX8(expected, (i % 2) ? (packed[i/2] & 0xF) : (packed[i/2] >> 4));
+        if(IS_DEFAULT_CURVE) {
+            TEST_ASSERT_EQUAL(i/17, expected);
+        }
+    }
+}
+
+/// @brief Gray level of pixel (x,y) of a packed GRAY4 buffer
+static uint8_t pixel(const uint8_t *buf, const uint32_t stride, const uint32_t x, const uint32_t y) {
+    const uint8_t byte = buf[y*stride + x/2];
+    return (x % 2) ? (byte & 0xF) : (byte >> 4);
+}
+
+/// @brief Sum of the gray levels of a 4x4 tile of a flat L8 value, which the
+/// ordered dither makes the value's fine level, 16*level + fraction
+static uint32_t bayer_tile_sum(const uint8_t value) {
+    uint8_t lum[4], out[2];
+    uint32_t sum = 0;
+    memset(lum, value, sizeof(lum));
+    for(uint32_t y=0; y<4; y++) {
+        gray4_dither_bayer_l8(lum, out, 4, 0, y);
+        sum += (out[0] >> 4) + (out[0] & 0xF) + (out[1] >> 4) + (out[1] & 0xF);
+    }
+    return sum;
+}
+
+void test_gray4_dither_bayer(void) {
+    uint32_t prev = 0;
+    for(uint32_t v=0; v<256; v++) {
+        const uint32_t sum = bayer_tile_sum(v);
+        TEST_ASSERT_GREATER_OR_EQUAL(prev, sum);
+        if(IS_DEFAULT_CURVE) {
+            TEST_ASSERT_EQUAL(16*v/17, sum);
+        }
+        prev = sum;
+    }
+    TEST_ASSERT_EQUAL(0, bayer_tile_sum(0));
+    TEST_ASSERT_EQUAL(16*(GRAY4_LEVELS - 1), bayer_tile_sum(255));
+
+    // Every color lands within a level of its undithered one, and the phase
+    // of the pattern follows x and y
+    for(uint32_t base=0; base<65536; base+=CHUNK_PIXELS) {
+        for(uint32_t i=0; i<CHUNK_PIXELS; i++) {
+            colors[i] = base + i;
+        }
+        gray4_dither_bayer_rgb565(colors, packed, CHUNK_PIXELS, base % 8, base/CHUNK_PIXELS);
+        for(uint32_t i=0; i<CHUNK_PIXELS; i++) {
+            const int32_t diff = pixel(packed, 0, i, 0) - reference_gray4(colors[i]);
+            TEST_ASSERT_INT_WITHIN(1, 0, diff);
+        }
+    }
+    static const uint8_t lum[4] = {128, 128, 128, 128};
+    uint8_t a[2], b[2];
+    gray4_dither_bayer_l8(lum, a, 4, 0, 1);
+    gray4_dither_bayer_l8(lum, b, 4, 4, 5);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(a, b, 2);
+    gray4_dither_bayer_l8(lum, b, 2, 2, 1);
+    TEST_ASSERT_EQUAL_HEX8(a[1], b[0]);
+}
+
+/// @brief Mean gray level of a flat L8 value diffused over 32 rows, x16
+static double fs_mean_x16(const uint8_t value, int16_t err[65]) {
+    uint8_t lum[64], out[32];
+    uint32_t sum = 0;
+    memset(lum, value, sizeof(lum));
+    memset(err, 0, 65*sizeof(int16_t));
+    for(uint32_t y=0; y<32; y++) {
+        gray4_dither_fs_l8(lum, out, 64, err);
+        for(uint32_t i=0; i<64; i++) {
+            sum += pixel(out, 0, i, 0);
+        }
+    }
+    return sum*16.0/(32*64);
+}
+
+void test_gray4_dither_fs(void) {
+    int16_t err[65];
+    for(uint32_t v=0; v<256; v++) {
+        const double mean = fs_mean_x16(v, err);
+        // The error is only lost at the right and bottom edges
+        TEST_ASSERT_DOUBLE_WITHIN(0.25, bayer_tile_sum(v), mean);
+    }
+    TEST_ASSERT_EQUAL_DOUBLE(0.0, fs_mean_x16(0, err));
+    TEST_ASSERT_EQUAL_DOUBLE(16.0*(GRAY4_LEVELS - 1), fs_mean_x16(255, err));
+
+    // err[0] belongs to the pixel before the row, e.g. of another region
+    memset(colors, 0x84, 64*sizeof(uint16_t));
+    memset(err, 0, sizeof(err));
+    err[0] = 1234;
+    for(uint32_t y=0; y<32; y++) {
+        gray4_dither_fs_rgb565(colors, packed, 64, err);
+        for(uint32_t i=0; i<64; i++) {
+            TEST_ASSERT_INT_WITHIN(1, reference_gray4(colors[i]), pixel(packed, 0, i, 0));
+        }
+    }
+    TEST_ASSERT_EQUAL(1234, err[0]);
+}
+
+void test_gray4_to_1bpp(void) {
+    const uint8_t gray[8] = {0xF0, 0x0F, 0xFF, 0x00, 0x5F, 0xF5, 0x55, 0xFF};
+    uint8_t bits[2];
+    gray4_to_1bpp(gray, bits, sizeof(bits), 0xF);
+    TEST_ASSERT_EQUAL_HEX8(0b10011100, bits[0]);
+    TEST_ASSERT_EQUAL_HEX8(0b01100011, bits[1]);
+}
+
+void test_gray4_histogram(void) {
+    const uint8_t gray[4] = {0xF0, 0x0F, 0xFF, 0x12};
+    uint32_t hist[GRAY4_LEVELS] = {0};
+    gray4_histogram(gray, 8, hist);
+    gray4_histogram(gray, 2, hist);
+    TEST_ASSERT_EQUAL(3, hist[0x0]);
+    TEST_ASSERT_EQUAL(5, hist[0xF]);
+    TEST_ASSERT_EQUAL(1, hist[0x1]);
+    TEST_ASSERT_EQUAL(1, hist[0x2]);
+}
+
+/// @brief Times the conversion against the LUT it replaced and against L8,
+/// on a row's worth of pixels
+void test_gray4_benchmark(void) {
+    static const uint32_t iterations = 100;
+    for(uint32_t i=0; i<CHUNK_PIXELS; i++) {
+        colors[i] = (i*40503u) ^ (i >> 3);
+    }
+
+    int64_t start = esp_timer_get_time();
+    for(uint32_t n=0; n<iterations; n++) {
+        for(uint32_t i=0; i<CHUNK_PIXELS; i+=2) {
+            packed[i/2] = (lut[colors[i]] << 4) | lut[colors[i+1]];
+        }
+    }
+    const int64_t lut_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for(uint32_t n=0; n<iterations; n++) {
+        gray4_from_rgb565(colors, packed, CHUNK_PIXELS);
+    }
+    const int64_t conv_us = esp_timer_get_time() - start;
+    assert_matches_curve(colors, packed, CHUNK_PIXELS);
+
+    // The same pixels' bytes as L8
+    start = esp_timer_get_time();
+    for(uint32_t n=0; n<iterations; n++) {
+        gray4_from_l8((const uint8_t*)colors, packed, CHUNK_PIXELS);
+    }
+    const int64_t l8_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(tag, "RGB565 to GRAY4: LUT %" PRId64 " ps/pixel, tables %" PRId64 " ps/pixel. "
+                  "L8 to GRAY4: %" PRId64 " ps/pixel", 
+             (lut_us*1000000)/(iterations*CHUNK_PIXELS),
+             (conv_us*1000000)/(iterations*CHUNK_PIXELS), (l8_us*1000000)/(iterations*CHUNK_PIXELS));
+}
+
+static int run_tests(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_gray4_every_color);
+    RUN_TEST(test_gray4_default_curve);
+    RUN_TEST(test_gray4_curve_monotonic);
+    RUN_TEST(test_gray4_alignment);
+    RUN_TEST(test_gray4_l8);
+    RUN_TEST(test_gray4_dither_bayer);
+    RUN_TEST(test_gray4_dither_fs);
+    RUN_TEST(test_gray4_to_1bpp);
+    RUN_TEST(test_gray4_histogram);
+    RUN_TEST(test_gray4_benchmark);
+
+    return UNITY_END();
+}
+
+// This is required for the ESP-IDF framework
+void app_main() {
+    run_tests();
+}
+
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
+}
+#endif
@@ -1,7 +1,11 @@
+#include <limits.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "unity.h"
 #include "it8951.h"
 #include "test_it8951.h"
@@ -20,9 +24,41 @@ static uint8_t *_txdata;
 static uint16_t *_rxdata;
 static uint32_t _txcount = 0;
 static uint32_t _cnt = 0;
+static uint32_t _hrdy_cnt = 0;
+static uint32_t _async_cnt = 0;
+/// @brief Last (big-endian) word clocked out by the benchmark/async mocks
+static uint16_t _last_word;
+/// @brief Bus events of the basic mocks: '[' and ']' for nCS low and high, 'H'
+/// for an HRDY wait and the word count of every SPI transaction
+static char _bus_log[64];
+static uint32_t _bus_len = 0;
+/// @brief Preamble of the packet in progress and the number of words clocked 
+/// in it so far, for the mocks decoding the packets
+static uint16_t _pkt_preamble = 0;
+static uint32_t _pkt_words = 0;
 
 // TODO: These tests should be rewritten with parametric testing (see Claude) 
 
+static void log_bus(const char event) {
+    if(_bus_len < sizeof(_bus_log)-1) {
+        _bus_log[_bus_len++] = event;
+        _bus_log[_bus_len] = '\0';
+    }
+}
+
+/// @brief Tracks the transaction in the packet the nCS frames
+/// @return Index of the transaction's first word in the packet, 0 being the
+/// preamble
+static uint32_t packet_offset(const void *tx, size_t len) {
+    const uint32_t offset = _pkt_words;
+    if(offset == 0) {
+        TEST_ASSERT_EQUAL(sizeof(uint16_t), len);
+        _pkt_preamble = __builtin_bswap16(*(const uint16_t*)tx);
+    }
+    _pkt_words += len/sizeof(uint16_t);
+    return offset;
+}
+
 static bool mock_spi_transcieve(const void *tx, void *rx, size_t len) {
     // This big-endian buffer is simulateing data returned by the IT8951. Note:
     // the first 4 bytes are dummy and should be ignored by the processing func
@@ -30,6 +66,7 @@ static bool mock_spi_transcieve(const void *tx, void *rx, size_t len) {
     assert(len <= sizeof(rxdata));
 
     _cnt++;
+    log_bus('0' + len/sizeof(uint16_t));
 
     if(!_txdata) {
         ESP_LOGE(tag, "txdata buffer cannot be NULL");
@@ -54,19 +91,31 @@ static bool mock_spi_transcieve(const void *tx, void *rx, size_t len) {
 
 static inline void mock_set_ncs(bool state) {
     ncs = state;
+    _pkt_words = 0;
+    log_bus(state ? ']' : '[');
 }
 
-static inline bool mock_get_hrdy(void) {
-    return true;
+static inline void mock_wait_hrdy(void) {
+    _hrdy_cnt++;
+    log_bus('H');
 }
 
 static stIT8951_Handler_t hdlr = {
     .spi_transcieve = mock_spi_transcieve,
     .set_ncs = mock_set_ncs,
     .vcom_mv = INT_MAX,
-    .get_hrdy = mock_get_hrdy,
+    .wait_hrdy = mock_wait_hrdy,
 };
 
+/// @brief Number of SPI transactions a packet of count words (preamble 
+/// included) is expected to take with the handler's current transport
+static uint32_t expected_transactions(const uint32_t count) {
+    if(count <= 1) {
+        return 0;
+    }
+    return (hdlr.transport == IT8951_TRANSPORT_FRAMED) ? 2 : count;
+}
+
 void setUp(void) {}
 void tearDown(void) {}
 void suiteSetUp(void) {
@@ -82,7 +131,7 @@ void test_send_command(const eIT8951_Command_t cmd, uint8_t *expected_tx) {
         TEST_ASSERT_TRUE(send_command(&hdlr, cmd));
         TEST_ASSERT_TRUE(ncs);
         TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_tx, _txdata, size);
-        TEST_ASSERT_EQUAL(size/2, _cnt);
+        TEST_ASSERT_EQUAL(expected_transactions(size/2), _cnt);
         free(_txdata);
     } else {
         printf("TEST: Insufficient memory!\n");
@@ -103,8 +152,10 @@ void test_write_data(const uint16_t *const data, int32_t count, uint8_t *expecte
         TEST_ASSERT_TRUE(ncs);
         TEST_ASSERT_TRUE(write_data(&hdlr, data, count));
         TEST_ASSERT_TRUE(ncs);
-        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_tx, _txdata, size);
-        TEST_ASSERT_EQUAL(size/2, _cnt);
+        TEST_ASSERT_EQUAL(expected_transactions(size/2), _cnt);
+        if(count != 0){
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_tx, _txdata, size);
+        }
         free(_txdata);
     } else {
         ESP_LOGE(tag, "Insufficient memory!");
@@ -124,12 +175,18 @@ void test_read_data(const int32_t count, uint8_t *expected_tx, uint16_t *expecte
     const size_t size = (2+count)*sizeof(uint16_t);
     _txdata = calloc(size, sizeof(*_txdata));
     _rxdata = calloc(count, sizeof(*_rxdata));
-    _txcount = _cnt =  0;
+    _txcount = _cnt = _hrdy_cnt = 0;
     if(_txdata && (_rxdata || count == 0)) {
         TEST_ASSERT_TRUE(ncs);
         TEST_ASSERT_TRUE(read_data(&hdlr, _rxdata, count));
         TEST_ASSERT_TRUE(ncs);
-        TEST_ASSERT_EQUAL(size/2, _cnt);
+        if(hdlr.transport == IT8951_TRANSPORT_FRAMED) {
+            // The preamble, the dummy word and the data, each after the HRDY
+            TEST_ASSERT_EQUAL((count != 0) ? 3 : 0, _cnt);
+            TEST_ASSERT_EQUAL((count != 0) ? 3 : 0, _hrdy_cnt);
+        } else {
+            TEST_ASSERT_EQUAL(expected_transactions((count != 0) ? size/2 : 0), _cnt);
+        }
         if(count != 0){
             TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_tx, _txdata, size);
             TEST_ASSERT_EQUAL_HEX16_ARRAY(expected_rx, _rxdata, count);
@@ -149,12 +206,604 @@ void test_read_data_multiple_args(void) {
                       (uint16_t[]){0x1234, 0x0000, 0x7FFF, 0x8000, 0xFFFF});
 }
 
+/// @brief Runs the packet and checks its bus events against the expected ones
+static void test_hrdy_placement(bool (*packet)(void), const char *const expected) {
+    _txdata = calloc(32, sizeof(*_txdata));
+    _rxdata = calloc(8, sizeof(*_rxdata));
+    _txcount = _cnt = _bus_len = 0;
+    _bus_log[0] = '\0';
+    TEST_ASSERT_TRUE(_txdata && _rxdata);
+    TEST_ASSERT_TRUE(packet());
+    TEST_ASSERT_EQUAL_STRING(expected, _bus_log);
+    free(_txdata);
+    free(_rxdata);
+}
+static bool hrdy_command(void) { return send_command(&hdlr, IT8951_COMMAND_SYS_RUN); }
+static bool hrdy_write(void)   { return write_data(&hdlr, (uint16_t[]){0x0000, 0x0203, 0x8567}, 3); }
+static bool hrdy_read(void)    { return read_data(&hdlr, _rxdata, 2); }
+static bool hrdy_bytes(void)   { return write_bytes(&hdlr, (uint8_t[]){0x12, 0x34, 0x56, 0x78}, 4); }
+void test_hrdy_placement_multiple_args(void) {
+    // The IT8951 datasheet's SPI timing: HRDY before the packet, then the 
+    // preamble, the HRDY again and only then the data. A read also waits for
+    // the HRDY after its dummy word.
+    test_hrdy_placement(hrdy_command, "H[1H1H]");
+    test_hrdy_placement(hrdy_write,   "H[1H1H1H1H]");
+    test_hrdy_placement(hrdy_read,    "H[1H1H1H1H]");
+    test_hrdy_placement(hrdy_bytes,   "H[1H2]");
+    hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    test_hrdy_placement(hrdy_command, "H[1H1]");
+    test_hrdy_placement(hrdy_write,   "H[1H3]");
+    test_hrdy_placement(hrdy_read,    "H[1H1H2]");
+    test_hrdy_placement(hrdy_bytes,   "H[1H2]");
+    hdlr.transport = IT8951_TRANSPORT_WORD;
+}
+
+void test_framed_transport_multiple_args(void) {
+    hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    test_send_command_multiple_args();
+    test_write_data_multiple_args();
+    test_read_data_multiple_args();
+    hdlr.transport = IT8951_TRANSPORT_WORD;
+}
+
+/// @brief Counts the transactions without logging, so that the timing is not
+/// dominated by the mock itself
+static bool bench_spi_transcieve(const void *tx, void *rx, size_t len) {
+    _cnt++;
+    _txcount += len;
+    memcpy(&_last_word, (const uint8_t*)tx + len - sizeof(_last_word), sizeof(_last_word));
+    if(rx) {
+        memset(rx, 0, len);
+    }
+    return true;
+}
+
+/// @brief Sends FILL_RECT with its 6 arguments in the given transport and 
+/// reports the SPI transactions, HRDY waits and wall time per command
+static void bench_command_args(const eIT8951_Transport_t transport, uint32_t *const transactions, int64_t *const ns_per_cmd) {
+    static const uint32_t iterations = 1000;
+    static const uint16_t args[] = {0, 0, 1872, 1404, 0x1100 | IT8951_DISPLAY_MODE_GC16, 0xF};
+
+    stIT8951_Handler_t bench_hdlr = hdlr;
+    bench_hdlr.spi_transcieve = bench_spi_transcieve;
+    bench_hdlr.transport = transport;
+
+    _txcount = _cnt = _hrdy_cnt = 0;
+    const int64_t start = esp_timer_get_time();
+    for(uint32_t i=0; i<iterations; i++) {
+        TEST_ASSERT_TRUE(send_command(&bench_hdlr, IT8951_COMMAND_FILL_RECT));
+        TEST_ASSERT_TRUE(write_data(&bench_hdlr, args, ARRAY_LENGTH(args)));
+    }
+    const int64_t elapsed_us = esp_timer_get_time() - start;
+
+    *transactions = _cnt/iterations;
+    *ns_per_cmd = (elapsed_us*1000)/iterations;
+    ESP_LOGI(tag, "%s: %lu SPI transactions, %lu HRDY waits, %lu bytes, %" PRId64 " ns per FILL_RECT",
+             (transport == IT8951_TRANSPORT_FRAMED) ? "framed" : "word", 
+             (unsigned long)(_cnt/iterations), (unsigned long)(_hrdy_cnt/iterations), 
+             (unsigned long)(_txcount/iterations), *ns_per_cmd);
+}
+
+void test_benchmark_transport(void) {
+    uint32_t word_cnt, framed_cnt;
+    int64_t word_ns, framed_ns;
+    bench_command_args(IT8951_TRANSPORT_WORD,   &word_cnt,   &word_ns);
+    bench_command_args(IT8951_TRANSPORT_FRAMED, &framed_cnt, &framed_ns);
+    // Command packet (preamble+cmd) + data packet (preamble+6 args)
+    TEST_ASSERT_EQUAL(2+7, word_cnt);
+    // Command and data packets, each as its preamble and its words
+    TEST_ASSERT_EQUAL(2*2, framed_cnt);
+    ESP_LOGI(tag, "Framed transport: %lux fewer transactions, %" PRId64 " ns saved per command",
+             (unsigned long)(word_cnt/framed_cnt), word_ns-framed_ns);
+}
+
+static bool mock_spi_transmit_async(const void *tx, size_t len) {
+    TEST_ASSERT_FALSE(ncs);
+    _async_cnt++;
+    _txcount += len;
+    return true;
+}
+
+static bool mock_spi_wait_async(void) {
+    TEST_ASSERT_FALSE(ncs);
+    _async_cnt--;
+    return true;
+}
+
+void test_write_packed_pixels_async(void) {
+    static const uint8_t pixels[8] = {0};
+    static const stIT8951_ImageInfo_t img_info = {
+        .rotation = IT8951_ROTATION_MODE_0,
+        .bpp = IT8951_COLOR_DEPTH_BPP_4BIT,
+        .endianness = IT8951_ENDIANNESS_BIG,
+    };
+
+    stIT8951_Handler_t async_hdlr = hdlr;
+    async_hdlr.spi_transcieve = bench_spi_transcieve;
+    async_hdlr.spi_transmit_async = mock_spi_transmit_async;
+    async_hdlr.spi_wait_async = mock_spi_wait_async;
+    async_hdlr.panel_area = (stRectangle_t){0, 0, 16, 16};
+    _txcount = _cnt = _async_cnt = 0;
+
+    TEST_ASSERT_TRUE(it8951_write_packed_pixels_async(&async_hdlr, &img_info, &(stRectangle_t){0, 0, 4, 4}, pixels, 16));
+    // The pixels are in flight: nCS is held and LD_IMG_END is not sent yet
+    TEST_ASSERT_FALSE(ncs);
+    TEST_ASSERT_EQUAL(1, _async_cnt);
+    TEST_ASSERT_TRUE(async_hdlr.xfer_pending);
+    TEST_ASSERT_TRUE(async_hdlr.img_load_open);
+
+    TEST_ASSERT_TRUE(it8951_wait_async(&async_hdlr));
+    TEST_ASSERT_TRUE(ncs);
+    TEST_ASSERT_EQUAL(0, _async_cnt);
+    TEST_ASSERT_FALSE(async_hdlr.xfer_pending);
+    TEST_ASSERT_FALSE(async_hdlr.img_load_open);
+    TEST_ASSERT_EQUAL_HEX16(__builtin_bswap16(IT8951_COMMAND_LD_IMG_END), _last_word);
+
+    // A new command must implicitly complete the transfer and the image load
+    TEST_ASSERT_TRUE(it8951_write_packed_pixels_async(&async_hdlr, &img_info, &(stRectangle_t){0, 0, 4, 4}, pixels, 16));
+    TEST_ASSERT_TRUE(send_command(&async_hdlr, IT8951_COMMAND_SYS_RUN));
+    TEST_ASSERT_TRUE(ncs);
+    TEST_ASSERT_EQUAL(0, _async_cnt);
+    TEST_ASSERT_FALSE(async_hdlr.img_load_open);
+}
+
+#if IT8951_TRACE_LENGTH > 0
+// Every HRDY wait takes 5us and every SPI byte 1us
+static uint32_t _now_us = 0;
+static bool trace_spi_transcieve(const void *tx, void *rx, size_t len) {
+    _now_us += len;
+    if(rx) {
+        memset(rx, 0, len);
+    }
+    return true;
+}
+
+static void trace_wait_hrdy(void) {
+    _now_us += 5;
+}
+
+static uint32_t mock_get_time_us(void) {
+    return _now_us;
+}
+
+void test_trace(void) {
+    stIT8951_Handler_t trace_hdlr = hdlr;
+    trace_hdlr.spi_transcieve = trace_spi_transcieve;
+    trace_hdlr.wait_hrdy = trace_wait_hrdy;
+    trace_hdlr.get_time_us = mock_get_time_us;
+    trace_hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    it8951_trace_reset(&trace_hdlr);
+    _now_us = 100;
+
+    // REG_RD: command (4 bytes), register (4 bytes), preamble+dummy+value (6 bytes).
+    // Every packet waits for the HRDY before and after its preamble, the read
+    // also after its dummy word.
+    uint16_t val;
+    TEST_ASSERT_TRUE(send_command(&trace_hdlr, IT8951_COMMAND_REG_RD));
+    TEST_ASSERT_TRUE(write_data(&trace_hdlr, (uint16_t[]){IT8951_REGISTER_LUTAFSR}, 1));
+    TEST_ASSERT_TRUE(read_data(&trace_hdlr, &val, 1));
+    // Time spent outside of the driver is not counted
+    _now_us += 1000;
+    TEST_ASSERT_TRUE(send_command(&trace_hdlr, IT8951_COMMAND_SYS_RUN));
+    TEST_ASSERT_EQUAL(2, it8951_trace_count(&trace_hdlr));
+
+    const stIT8951_TraceEntry_t *entry = &trace_hdlr.trace.entries[0];
+    TEST_ASSERT_EQUAL(100, entry->start_us);
+    TEST_ASSERT_EQUAL_HEX16(IT8951_COMMAND_REG_RD, entry->command);
+    TEST_ASSERT_EQUAL_HEX16(IT8951_REGISTER_LUTAFSR, entry->arg0);
+    TEST_ASSERT_EQUAL(1, entry->arg_count);
+    TEST_ASSERT_EQUAL(14, entry->bytes);
+    TEST_ASSERT_EQUAL(35, entry->hrdy_wait_us);
+    TEST_ASSERT_EQUAL(49, entry->duration_us);
+    TEST_ASSERT_EQUAL(0, entry->failed);
+    TEST_ASSERT_EQUAL(1149, trace_hdlr.trace.entries[1].start_us);
+
+    // The ring keeps the last IT8951_TRACE_LENGTH transactions
+    for(uint32_t i=0; i<IT8951_TRACE_LENGTH; i++) {
+        TEST_ASSERT_TRUE(send_command(&trace_hdlr, IT8951_COMMAND_STANDBY));
+    }
+    TEST_ASSERT_EQUAL(IT8951_TRACE_LENGTH, it8951_trace_count(&trace_hdlr));
+
+    char buff[64*IT8951_TRACE_LENGTH];
+    FILE *out = fmemopen(buff, sizeof(buff), "wb");
+    TEST_ASSERT_TRUE(it8951_trace_dump_binary(&trace_hdlr, out));
+    TEST_ASSERT_EQUAL(sizeof(stIT8951_TraceHeader_t) + IT8951_TRACE_LENGTH*sizeof(stIT8951_TraceEntry_t), ftell(out));
+    fclose(out);
+    stIT8951_TraceHeader_t header;
+    memcpy(&header, buff, sizeof(header));
+    TEST_ASSERT_EQUAL_HEX32(IT8951_TRACE_MAGIC, header.magic);
+    TEST_ASSERT_EQUAL(IT8951_TRACE_LENGTH, header.count);
+    TEST_ASSERT_EQUAL(2, header.dropped);
+    stIT8951_TraceEntry_t first;
+    memcpy(&first, buff + sizeof(header), sizeof(first));
+    TEST_ASSERT_EQUAL_HEX16(IT8951_COMMAND_STANDBY, first.command);
+
+    out = fmemopen(buff, sizeof(buff), "w");
+    TEST_ASSERT_TRUE(it8951_trace_dump_csv(&trace_hdlr, out));
+    fclose(out);
+    static const char csv_header[] = "start_us,command,arg0,args,bytes,hrdy_us,duration_us,failed\n";
+    TEST_ASSERT_EQUAL_STRING_LEN(csv_header, buff, sizeof(csv_header)-1);
+    TEST_ASSERT_NOT_NULL(strstr(buff, ",0x0002,0x0000,0,4,10,14,0\n"));
+
+    it8951_trace_reset(&trace_hdlr);
+    TEST_ASSERT_EQUAL(0, it8951_trace_count(&trace_hdlr));
+}
+#endif
+
+// Minimal model of the IT8951 for the update scheduler tests. It expects the
+// framed transport, i.e. the words of a packet in one SPI transaction after
+// its preamble
+static uint16_t _lut_busy = 0;
+static uint16_t _last_cmd = 0;
+static uint32_t _dpy_cnt = 0;
+static uint16_t _dpy_cmd = 0;
+static uint16_t _dpy_args[7] = {0};
+static uint32_t _dpy_arg_cnt = 0;
+static uint32_t _reg_rd_cnt = 0;
+static uint16_t _up1sr_h = 0;
+static uint16_t _bgvr = 0;
+static uint32_t _now_ms = 0;
+static uint16_t _temperature = 25;
+
+static bool sched_spi_transcieve(const void *tx, void *rx, size_t len) {
+    const uint32_t offset = packet_offset(tx, len);
+    const uint16_t *const words = tx;
+    const uint16_t preamble = _pkt_preamble;
+    if(offset == 0) {
+        return true;
+    } else if(preamble == IT8951_SPI_PREAMBLE_READ_DATA) {
+        // The data of a read follows its dummy word
+        if(offset < 2) {
+            return true;
+        }
+        const uint16_t val = (_last_cmd == IT8951_COMMAND_CMD_TEMPERATURE) ? _temperature : _lut_busy;
+        _reg_rd_cnt += (_last_cmd == IT8951_COMMAND_REG_RD);
+        for(uint32_t i=0; i<len/sizeof(uint16_t); i++) {
+            ((uint16_t*)rx)[i] = __builtin_bswap16(val);
+        }
+    } else if(preamble == IT8951_SPI_PREAMBLE_COMMAND) {
+        _last_cmd = __builtin_bswap16(words[0]);
+    } else if(preamble == IT8951_SPI_PREAMBLE_WRITE_DATA && 
+              (_last_cmd == IT8951_COMMAND_DPY_AREA || _last_cmd == IT8951_COMMAND_DPY_BUF_AREA ||
+               _last_cmd == IT8951_COMMAND_FILL_RECT)) {
+        // Every update gets the next LUT engine
+        _lut_busy |= 1 << (_dpy_cnt++ % IT8951_LUT_ENGINE_COUNT);
+        _dpy_cmd = _last_cmd;
+        _dpy_arg_cnt = len/sizeof(uint16_t);
+        _dpy_arg_cnt = (_dpy_arg_cnt < ARRAY_LENGTH(_dpy_args)) ? _dpy_arg_cnt : ARRAY_LENGTH(_dpy_args);
+        for(uint32_t i=0; i<_dpy_arg_cnt; i++) {
+            _dpy_args[i] = __builtin_bswap16(words[i]);
+        }
+    } else if(preamble == IT8951_SPI_PREAMBLE_WRITE_DATA && _last_cmd == IT8951_COMMAND_REG_WR) {
+        const uint16_t reg = __builtin_bswap16(words[0]);
+        const uint16_t val = __builtin_bswap16(words[1]);
+        _up1sr_h = (reg == IT8951_REGISTER_UP1SR_H) ? val : _up1sr_h;
+        _bgvr    = (reg == IT8951_REGISTER_BGVR)    ? val : _bgvr;
+    }
+    return true;
+}
+
+static uint32_t mock_get_time_ms(void) {
+    return _now_ms;
+}
+
+// Sleeping finishes every waveform
+static void mock_sleep_ms(uint32_t ms) {
+    _now_ms += ms;
+    _lut_busy = 0;
+}
+
+static stIT8951_Handler_t sched_handler(void) {
+    stIT8951_Handler_t sched_hdlr = hdlr;
+    sched_hdlr.spi_transcieve = sched_spi_transcieve;
+    sched_hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    sched_hdlr.get_time_ms = mock_get_time_ms;
+    sched_hdlr.sleep_ms = mock_sleep_ms;
+    sched_hdlr.panel_area = (stRectangle_t){0, 0, 1872, 1404};
+    _lut_busy = _last_cmd = _dpy_cnt = _reg_rd_cnt = _now_ms = _up1sr_h = _bgvr = 0;
+    _temperature = 25;
+    return sched_hdlr;
+}
+
+void test_update_scheduler(void) {
+    stIT8951_Handler_t sched_hdlr = sched_handler();
+    uint32_t id_a, id_b;
+
+    // The first update launches straight away and returns without waiting
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &(stRectangle_t){0, 0, 100, 100}, IT8951_DISPLAY_MODE_GC16, &id_a));
+    TEST_ASSERT_EQUAL(1, _dpy_cnt);
+    TEST_ASSERT_FALSE(it8951_update_is_done(&sched_hdlr, id_a));
+
+    // The second one is queued behind it
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &(stRectangle_t){0, 0, 100, 100}, IT8951_DISPLAY_MODE_DU, &id_b));
+    TEST_ASSERT_EQUAL(1, _dpy_cnt);
+    TEST_ASSERT_NOT_EQUAL(id_a, id_b);
+
+    // No register traffic before the GC16 waveform is expected to finish
+    const uint32_t reg_rd_cnt = _reg_rd_cnt;
+    _now_ms = IT8951_DISPLAY_MODE_DURATION_MS_MAP[IT8951_DISPLAY_MODE_GC16]/2;
+    TEST_ASSERT_TRUE(it8951_update_poll(&sched_hdlr));
+    TEST_ASSERT_EQUAL(reg_rd_cnt, _reg_rd_cnt);
+
+    // Once the LUT engine is idle, the queued update is launched
+    _now_ms = IT8951_DISPLAY_MODE_DURATION_MS_MAP[IT8951_DISPLAY_MODE_GC16];
+    _lut_busy = 0;
+    TEST_ASSERT_TRUE(it8951_update_poll(&sched_hdlr));
+    TEST_ASSERT_TRUE(it8951_update_is_done(&sched_hdlr, id_a));
+    TEST_ASSERT_FALSE(it8951_update_is_done(&sched_hdlr, id_b));
+    TEST_ASSERT_EQUAL(2, _dpy_cnt);
+
+    TEST_ASSERT_TRUE(it8951_update_wait(&sched_hdlr, id_b));
+    TEST_ASSERT_TRUE(it8951_update_is_done(&sched_hdlr, id_b));
+}
+
+void test_update_concurrent_regions(void) {
+    stIT8951_Handler_t sched_hdlr = sched_handler();
+    const stRectangle_t clock    = {0,   0,   200, 100};
+    const stRectangle_t calendar = {400, 400, 300, 200};
+    uint32_t id_clock, id_calendar, id_a, id_b;
+
+    // Disjoint areas run concurrently on separate LUT engines
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &clock, IT8951_DISPLAY_MODE_DU, &id_clock));
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &calendar, IT8951_DISPLAY_MODE_GC16, &id_calendar));
+    TEST_ASSERT_EQUAL(2, _dpy_cnt);
+    TEST_ASSERT_EQUAL_HEX16(0b11, _lut_busy);
+
+    // An update of the clock waits only for the clock's engine...
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &(stRectangle_t){50, 0, 200, 100}, IT8951_DISPLAY_MODE_DU, &id_a));
+    TEST_ASSERT_EQUAL(2, _dpy_cnt);
+    // ...and a still queued overlapping update is merged into it. Only the 
+    // queued updates are, not the running calendar's
+    const stRectangle_t area_b = {100, 50, 200, 100};
+    stRectangle_t area = it8951_update_merged_area(&sched_hdlr, IT8951_FRAME_BUFFER_DEFAULT, &area_b);
+    TEST_ASSERT_EQUAL(50,  area.x);
+    TEST_ASSERT_EQUAL(0,   area.y);
+    TEST_ASSERT_EQUAL(250, area.width);
+    TEST_ASSERT_EQUAL(150, area.height);
+    area = it8951_update_merged_area(&sched_hdlr, IT8951_FRAME_BUFFER_DEFAULT, &calendar);
+    TEST_ASSERT_EQUAL_MEMORY(&calendar, &area, sizeof(area));
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &area_b, IT8951_DISPLAY_MODE_GL16, &id_b));
+    TEST_ASSERT_EQUAL(id_a, id_b);
+    TEST_ASSERT_EQUAL(2, _dpy_cnt);
+
+    // The clock's engine finishes, while the calendar's GC16 is still running
+    _now_ms = IT8951_DISPLAY_MODE_DURATION_MS_MAP[IT8951_DISPLAY_MODE_DU];
+    _lut_busy &= ~0b01;
+    TEST_ASSERT_TRUE(it8951_update_poll(&sched_hdlr));
+    TEST_ASSERT_TRUE(it8951_update_is_done(&sched_hdlr, id_clock));
+    TEST_ASSERT_FALSE(it8951_update_is_done(&sched_hdlr, id_calendar));
+    TEST_ASSERT_EQUAL(3, _dpy_cnt);
+
+    // The merged update covers both areas with the higher fidelity waveform
+    const stIT8951_Update_t *merged = NULL;
+    for(uint32_t i=0; i<IT8951_UPDATE_QUEUE_LENGTH; i++) {
+        if(sched_hdlr.scheduler.updates[i].state != IT8951_UPDATE_STATE_FREE && 
+           sched_hdlr.scheduler.updates[i].id == id_a) {
+            merged = &sched_hdlr.scheduler.updates[i];
+        }
+    }
+    TEST_ASSERT_NOT_NULL(merged);
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_GL16, merged->mode);
+    TEST_ASSERT_EQUAL(50,  merged->rect.x);
+    TEST_ASSERT_EQUAL(0,   merged->rect.y);
+    TEST_ASSERT_EQUAL(250, merged->rect.width);
+    TEST_ASSERT_EQUAL(150, merged->rect.height);
+    TEST_ASSERT_EQUAL_HEX16(0b100, merged->lut_mask);
+}
+
+void test_update_duration_estimate(void) {
+    stIT8951_Handler_t sched_hdlr = sched_handler();
+    const uint32_t nominal = IT8951_DISPLAY_MODE_DURATION_MS_MAP[IT8951_DISPLAY_MODE_GC16];
+
+    TEST_ASSERT_EQUAL(nominal, it8951_update_estimate_duration(&sched_hdlr, IT8951_DISPLAY_MODE_GC16));
+    // The temperature is cached...
+    _temperature = IT8951_NOMINAL_TEMPERATURE_C - 10;
+    TEST_ASSERT_EQUAL(nominal, it8951_update_estimate_duration(&sched_hdlr, IT8951_DISPLAY_MODE_GC16));
+    // ...until it is refreshed, then the waveforms are expected to be longer
+    _now_ms += IT8951_TEMPERATURE_REFRESH_MS;
+    TEST_ASSERT_EQUAL(nominal + (nominal*10*IT8951_DURATION_PERCENT_PER_C)/100, 
+                      it8951_update_estimate_duration(&sched_hdlr, IT8951_DISPLAY_MODE_GC16));
+}
+
+void test_frame_buffer_flip(void) {
+    stIT8951_Handler_t sched_hdlr = sched_handler();
+    const uint32_t base = 0x1236E0;
+    const uint32_t frame_size = 1872*1404;
+    sched_hdlr.frame_buffers = (stIT8951_FrameBuffers_t){ .addr = {base}, .count = 1 };
+
+    // A 1872x1404 panel fits 2 frames in the SDRAM after the default buffer's
+    // offset
+    uint32_t back;
+    TEST_ASSERT_TRUE(it8951_frame_buffer_alloc(&sched_hdlr, &back));
+    TEST_ASSERT_EQUAL(1, back);
+    TEST_ASSERT_EQUAL(base + frame_size, sched_hdlr.frame_buffers.addr[back]);
+    uint32_t extra;
+    TEST_ASSERT_FALSE(it8951_frame_buffer_alloc(&sched_hdlr, &extra));
+    // A smaller SDRAM has no room for the second one
+    stIT8951_Handler_t small_hdlr = sched_hdlr;
+    small_hdlr.frame_buffers = (stIT8951_FrameBuffers_t){ .addr = {base}, .count = 1 };
+    small_hdlr.sdram_size = base + 2*frame_size - 2;
+    TEST_ASSERT_FALSE(it8951_frame_buffer_alloc(&small_hdlr, &extra));
+    small_hdlr.sdram_size = base + 2*frame_size;
+    TEST_ASSERT_TRUE(it8951_frame_buffer_alloc(&small_hdlr, &extra));
+
+    // The image loads are redirected to the back buffer
+    TEST_ASSERT_TRUE(it8951_frame_buffer_set_target(&sched_hdlr, back));
+    TEST_ASSERT_EQUAL(back, sched_hdlr.frame_buffers.target);
+
+    // The flip displays the whole panel from the back buffer's address
+    uint32_t id;
+    TEST_ASSERT_TRUE(it8951_frame_buffer_flip(&sched_hdlr, back, IT8951_DISPLAY_MODE_GC16, &id));
+    TEST_ASSERT_EQUAL(1, _dpy_cnt);
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_DPY_BUF_AREA, _dpy_cmd);
+    TEST_ASSERT_EQUAL(7, _dpy_arg_cnt);
+    const uint16_t expected_args[] = {0, 0, 1872, 1404, IT8951_DISPLAY_MODE_GC16, 
+                                      (uint16_t)(base + frame_size), (uint16_t)((base + frame_size) >> 16)};
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(expected_args, _dpy_args, ARRAY_LENGTH(expected_args));
+    // The old front buffer stays on the panel until the waveform is done
+    TEST_ASSERT_EQUAL(IT8951_FRAME_BUFFER_DEFAULT, sched_hdlr.frame_buffers.front);
+    TEST_ASSERT_TRUE(it8951_update_wait(&sched_hdlr, id));
+    TEST_ASSERT_EQUAL(back, sched_hdlr.frame_buffers.front);
+
+    // Queued updates of different buffers are not merged
+    uint32_t id_a, id_b;
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &(stRectangle_t){0, 0, 100, 100}, IT8951_DISPLAY_MODE_DU, &id_a));
+    TEST_ASSERT_TRUE(it8951_frame_buffer_display_async(&sched_hdlr, back, &(stRectangle_t){0, 0, 100, 100}, IT8951_DISPLAY_MODE_DU, &id_b));
+    TEST_ASSERT_NOT_EQUAL(id_a, id_b);
+    TEST_ASSERT_TRUE(it8951_update_wait(&sched_hdlr, id_b));
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_DPY_BUF_AREA, _dpy_cmd);
+}
+
+void test_update_fill(void) {
+    stIT8951_Handler_t sched_hdlr = sched_handler();
+    const stRectangle_t a = {0, 0, 100, 100};
+    uint32_t fill1, upd, fill2;
+
+    // A fill launches like any other update, with FILL_RECT
+    TEST_ASSERT_TRUE(it8951_fill_rect_async(&sched_hdlr, &a, IT8951_DISPLAY_MODE_DU, 0xFF, &fill1));
+    TEST_ASSERT_EQUAL(1, _dpy_cnt);
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_FILL_RECT, _dpy_cmd);
+    const uint16_t expected_args[] = {0, 0, 100, 100, 0x1100 | IT8951_DISPLAY_MODE_DU, 0xFF};
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(expected_args, _dpy_args, ARRAY_LENGTH(expected_args));
+    TEST_ASSERT_TRUE(it8951_update_is_launched(&sched_hdlr, fill1));
+
+    // Updates of the same area queue up behind it, and a queued fill is not 
+    // merged with them, as it only writes the buffer when it launches
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &a, IT8951_DISPLAY_MODE_GC16, &upd));
+    TEST_ASSERT_TRUE(it8951_fill_rect_async(&sched_hdlr, &a, IT8951_DISPLAY_MODE_DU, 0x00, &fill2));
+    TEST_ASSERT_EQUAL(1, _dpy_cnt);
+    TEST_ASSERT_NOT_EQUAL(upd, fill2);
+    TEST_ASSERT_FALSE(it8951_update_is_launched(&sched_hdlr, upd));
+    TEST_ASSERT_FALSE(it8951_update_is_launched(&sched_hdlr, fill2));
+
+    // Both launch in order, each once the previous one is done
+    TEST_ASSERT_TRUE(it8951_update_wait_launched(&sched_hdlr, fill2));
+    TEST_ASSERT_EQUAL(3, _dpy_cnt);
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_FILL_RECT, _dpy_cmd);
+    TEST_ASSERT_EQUAL(0x00, _dpy_args[5]);
+    TEST_ASSERT_TRUE(it8951_update_is_done(&sched_hdlr, upd));
+    TEST_ASSERT_FALSE(it8951_update_is_done(&sched_hdlr, fill2));
+    TEST_ASSERT_TRUE(it8951_update_wait(&sched_hdlr, fill2));
+
+    // Outside of the panel
+    TEST_ASSERT_FALSE(it8951_fill_rect_async(&sched_hdlr, &(stRectangle_t){1800, 0, 100, 10}, 
+                                             IT8951_DISPLAY_MODE_DU, 0xFF, NULL));
+}
+
+void test_update_1bpp(void) {
+    stIT8951_Handler_t sched_hdlr = sched_handler();
+    sched_hdlr.frame_buffers = (stIT8951_FrameBuffers_t){ .addr = {0x1236E0, 0x1236E0 + 1872*1404}, .count = 2 };
+    uint32_t id_gray, id_mono, id_other;
+
+    // The 1bpp mode is global, so a 1bpp update waits even for disjoint ones
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &(stRectangle_t){0, 0, 64, 64}, IT8951_DISPLAY_MODE_GC16, &id_gray));
+    TEST_ASSERT_TRUE(it8951_frame_buffer_display_1bpp_async(&sched_hdlr, 1, &(stRectangle_t){512, 0, 256, 64}, 
+                                                            IT8951_DISPLAY_MODE_DU, 0x00, 0xFF, &id_mono));
+    TEST_ASSERT_TRUE(it8951_display_area_async(&sched_hdlr, &(stRectangle_t){1024, 0, 64, 64}, IT8951_DISPLAY_MODE_DU, &id_other));
+    TEST_ASSERT_EQUAL(1, _dpy_cnt);
+    TEST_ASSERT_FALSE(_up1sr_h & IT8951_UP1SR_H_1BPP_ENABLE);
+
+    // Launched in the 1bpp mode once the others are done, and nothing else 
+    // runs alongside it
+    _now_ms += IT8951_DISPLAY_MODE_DURATION_MS_MAP[IT8951_DISPLAY_MODE_GC16];
+    _lut_busy = 0;
+    TEST_ASSERT_TRUE(it8951_update_poll(&sched_hdlr));
+    TEST_ASSERT_TRUE(it8951_update_is_done(&sched_hdlr, id_gray));
+    TEST_ASSERT_EQUAL(2, _dpy_cnt);
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_DPY_BUF_AREA, _dpy_cmd);
+    TEST_ASSERT_TRUE(_up1sr_h & IT8951_UP1SR_H_1BPP_ENABLE);
+    TEST_ASSERT_EQUAL_HEX16(0x00FF, _bgvr);
+    TEST_ASSERT_FALSE(it8951_update_is_done(&sched_hdlr, id_other));
+
+    // The 1bpp mode is switched off before the next update
+    TEST_ASSERT_TRUE(it8951_update_wait(&sched_hdlr, id_mono));
+    TEST_ASSERT_FALSE(_up1sr_h & IT8951_UP1SR_H_1BPP_ENABLE);
+    TEST_ASSERT_EQUAL(3, _dpy_cnt);
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_DPY_AREA, _dpy_cmd);
+}
+
+// Minimal model of the IT8951's SDRAM for the memory burst tests. It expects
+// the framed transport for the commands and arguments
+static uint8_t _sdram[64];
+static uint32_t _sdram_addr = 0;
+static uint32_t _sdram_words = 0;
+static uint16_t _sdram_cmd = 0;
+/// @brief The data packets that follow are the raw payload of the burst
+static bool _sdram_raw = false;
+
+static bool sdram_spi_transcieve(const void *tx, void *rx, size_t len) {
+    TEST_ASSERT_FALSE(ncs);
+    const uint32_t offset = packet_offset(tx, len);
+    const uint16_t *const words = tx;
+    if(offset == 0) {
+        return true;
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_COMMAND) {
+        _sdram_cmd = __builtin_bswap16(words[0]);
+        _sdram_raw = false;
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_WRITE_DATA && _sdram_raw) {
+        TEST_ASSERT_EQUAL(IT8951_COMMAND_MEM_BST_WR, _sdram_cmd);
+        TEST_ASSERT_TRUE(_sdram_addr + len <= sizeof(_sdram));
+        memcpy(&_sdram[_sdram_addr], tx, len);
+        _sdram_addr += len;
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_WRITE_DATA) {
+        TEST_ASSERT_EQUAL(4*sizeof(uint16_t), len);
+        _sdram_addr  = __builtin_bswap16(words[0]) | (__builtin_bswap16(words[1]) << 16);
+        _sdram_words = __builtin_bswap16(words[2]) | (__builtin_bswap16(words[3]) << 16);
+        _sdram_raw = (_sdram_cmd == IT8951_COMMAND_MEM_BST_WR);
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_READ_DATA && offset >= 2) {
+        // The payload follows the dummy word
+        TEST_ASSERT_EQUAL(IT8951_COMMAND_MEM_BST_RD_S, _sdram_cmd);
+        TEST_ASSERT_TRUE(_sdram_addr + len <= sizeof(_sdram));
+        memcpy(rx, &_sdram[_sdram_addr], len);
+        _sdram_addr += len;
+    }
+    return true;
+}
+
+void test_mem_burst(void) {
+    stIT8951_Handler_t mem_hdlr = hdlr;
+    mem_hdlr.spi_transcieve = sdram_spi_transcieve;
+    mem_hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    memset(_sdram, 0, sizeof(_sdram));
+    _sdram_raw = false;
+
+    uint8_t data[16];
+    for(uint32_t i=0; i<sizeof(data); i++) {
+        data[i] = i + 1;
+    }
+
+    // A streamed write lands at the given address, chunk after chunk
+    TEST_ASSERT_TRUE(it8951_mem_burst_write_begin(&mem_hdlr, 8, sizeof(data)));
+    TEST_ASSERT_EQUAL(sizeof(data)/2, _sdram_words);
+    TEST_ASSERT_TRUE(it8951_mem_burst_write_chunk(&mem_hdlr, data, 8));
+    TEST_ASSERT_TRUE(it8951_mem_burst_write_chunk(&mem_hdlr, data+8, 8));
+    TEST_ASSERT_TRUE(it8951_mem_burst_end(&mem_hdlr));
+    TEST_ASSERT_EQUAL(IT8951_COMMAND_MEM_BST_END, _sdram_cmd);
+    TEST_ASSERT_TRUE(ncs);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, &_sdram[8], sizeof(data));
+
+    // And reads back the same in one go
+    uint8_t readback[sizeof(data)] = {0};
+    TEST_ASSERT_TRUE(it8951_mem_burst_read(&mem_hdlr, 8, readback, sizeof(readback)));
+    TEST_ASSERT_TRUE(ncs);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, readback, sizeof(data));
+
+    // Or in chunks
+    memset(readback, 0, sizeof(readback));
+    TEST_ASSERT_TRUE(it8951_mem_burst_read_begin(&mem_hdlr, 12, 8));
+    TEST_ASSERT_TRUE(it8951_mem_burst_read_chunk(&mem_hdlr, readback, 4));
+    TEST_ASSERT_TRUE(it8951_mem_burst_read_chunk(&mem_hdlr, readback+4, 4));
+    TEST_ASSERT_TRUE(it8951_mem_burst_end(&mem_hdlr));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data+4, readback, 8);
+}
+
 void test_pack_pixels(eIT8951_ColorDepth_t bpp, stRectangle_t *rect, uint16_t *expected_out, uint32_t count){
     const uint32_t area = rectangle_get_area(rect);
     uint8_t *in_pixels = malloc(area*sizeof(*in_pixels));
     memset(in_pixels, 0x0F, area);
     // TODO: 4 is 16bit/4bpp ->4pix/word
     uint16_t *packed_pixels = malloc((rect->width/4+2)*rect->height*sizeof(uint16_t));
+    TEST_ASSERT_EQUAL(IT8951_COLOR_DEPTH_BPP_4BIT, bpp);
 
     if(packed_pixels && in_pixels) {
         uint32_t cnt;
@@ -204,14 +853,401 @@ void test_pack_pixels_multiple_args(void) {
     test_pack_pixels(IT8951_COLOR_DEPTH_BPP_4BIT, &(stRectangle_t){4, 3, 2, 2}, (uint16_t[]){0x00FF, 0x00FF}, 2);
 }
 
-// This is required for the ESP-IDF framework
-void app_main() {
+void test_pack_pixels_depth(eIT8951_ColorDepth_t bpp, eIT8951_Endianness_t endianness, stRectangle_t *rect, 
+                            const uint8_t *in_pixels, const uint8_t *expected_bytes, uint32_t count) {
+    uint16_t packed_pixels[8];
+    uint32_t cnt;
+    it8951_pack_pixels(&(stIT8951_ImageInfo_t){
+        .endianness = endianness,
+        .bpp = bpp,
+        .rotation = IT8951_ROTATION_MODE_0
+    }, rect, in_pixels, packed_pixels, &cnt);
+    TEST_ASSERT_EQUAL_UINT32(count, cnt);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected_bytes, packed_pixels, count*sizeof(uint16_t));
+}
+
+void test_pack_pixels_depths(void) {
+    static const uint8_t ones[8] = {3, 3, 3, 3, 3, 3, 3, 3};
+    // 2bpp: 8 pixels per word, the 1 pixel offset pushes the last one into a
+    // second word
+    test_pack_pixels_depth(IT8951_COLOR_DEPTH_BPP_2BIT, IT8951_ENDIANNESS_LITTLE, &(stRectangle_t){1, 0, 8, 1}, 
+                           ones, (uint8_t[]){0xFC, 0xFF, 0x03, 0x00}, 2);
+    test_pack_pixels_depth(IT8951_COLOR_DEPTH_BPP_2BIT, IT8951_ENDIANNESS_BIG, &(stRectangle_t){1, 0, 8, 1}, 
+                           ones, (uint8_t[]){0x3F, 0xFF, 0xC0, 0x00}, 2);
+    // 3bpp: the pixels take the top 3 bits of each nibble
+    test_pack_pixels_depth(IT8951_COLOR_DEPTH_BPP_3BIT, IT8951_ENDIANNESS_LITTLE, &(stRectangle_t){0, 0, 2, 1}, 
+                           (uint8_t[]){5, 7}, (uint8_t[]){0xEA, 0x00}, 1);
+    // 4bpp big-endian: the first pixel is the high nibble of the first byte
+    test_pack_pixels_depth(IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG, &(stRectangle_t){0, 0, 4, 2}, 
+                           (uint8_t[]){1, 2, 3, 4, 5, 6, 7, 8}, (uint8_t[]){0x12, 0x34, 0x56, 0x78}, 2);
+    // 8bpp: 2 pixels per word
+    test_pack_pixels_depth(IT8951_COLOR_DEPTH_BPP_8BIT, IT8951_ENDIANNESS_BIG, &(stRectangle_t){1, 0, 2, 1}, 
+                           (uint8_t[]){0x12, 0x34}, (uint8_t[]){0x00, 0x12, 0x34, 0x00}, 2);
+    test_pack_pixels_depth(IT8951_COLOR_DEPTH_BPP_8BIT, IT8951_ENDIANNESS_LITTLE, &(stRectangle_t){0, 0, 2, 1}, 
+                           (uint8_t[]){0x12, 0x34}, (uint8_t[]){0x12, 0x34}, 1);
+}
+
+// Counts the BPP_SETTINGS commands. Expects the framed transport
+static uint32_t _bpp_cmd_cnt = 0;
+static uint16_t _bpp_arg = 0;
+static uint16_t _bpp_last_cmd = 0;
+static bool bpp_spi_transcieve(const void *tx, void *rx, size_t len) {
+    const uint16_t *const words = tx;
+    if(packet_offset(tx, len) != 1) {
+        return true;
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_COMMAND) {
+        _bpp_last_cmd = __builtin_bswap16(words[0]);
+        _bpp_cmd_cnt += (_bpp_last_cmd == IT8951_COMMAND_BPP_SETTINGS);
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_WRITE_DATA && _bpp_last_cmd == IT8951_COMMAND_BPP_SETTINGS) {
+        _bpp_arg = __builtin_bswap16(words[0]);
+    }
+    return true;
+}
+
+void test_write_packed_pixels_bpp_mode(void) {
+    static const uint8_t pixels[16] = {0};
+    stIT8951_Handler_t bpp_hdlr = hdlr;
+    bpp_hdlr.spi_transcieve = bpp_spi_transcieve;
+    bpp_hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    bpp_hdlr.panel_area = (stRectangle_t){0, 0, 16, 16};
+    _bpp_cmd_cnt = 0;
+
+    const stIT8951_ImageInfo_t info_2bpp = {IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_2BIT, IT8951_ENDIANNESS_BIG};
+    const stIT8951_ImageInfo_t info_4bpp = {IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+
+    // The 2bpp mode is switched on once, for the first 2bpp load only
+    TEST_ASSERT_TRUE(it8951_write_packed_pixels(&bpp_hdlr, &info_2bpp, &(stRectangle_t){0, 0, 8, 8}, pixels, 64));
+    TEST_ASSERT_EQUAL(1, _bpp_cmd_cnt);
+    TEST_ASSERT_EQUAL(1, _bpp_arg);
+    TEST_ASSERT_TRUE(it8951_write_packed_pixels(&bpp_hdlr, &info_2bpp, &(stRectangle_t){0, 0, 8, 8}, pixels, 64));
+    TEST_ASSERT_EQUAL(1, _bpp_cmd_cnt);
+
+    // And back off for the other depths
+    TEST_ASSERT_TRUE(it8951_write_packed_pixels(&bpp_hdlr, &info_4bpp, &(stRectangle_t){0, 0, 4, 4}, pixels, 16));
+    TEST_ASSERT_EQUAL(2, _bpp_cmd_cnt);
+    TEST_ASSERT_EQUAL(0, _bpp_arg);
+    TEST_ASSERT_FALSE(bpp_hdlr.is_2bpp_mode);
+}
+
+void test_rotate_rect(void) {
+    stIT8951_Handler_t rot_hdlr = hdlr;
+    rot_hdlr.spi_transcieve = bench_spi_transcieve;
+    rot_hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    rot_hdlr.panel_area = (stRectangle_t){0, 0, 16, 8};
+    const stRectangle_t rect = {1, 2, 3, 4};
+    stRectangle_t out;
+
+    out = it8951_get_image_area(&rot_hdlr, IT8951_ROTATION_MODE_90);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&((stRectangle_t){0, 0, 8, 16}), &out, sizeof(out));
+    out = it8951_get_image_area(&rot_hdlr, IT8951_ROTATION_MODE_180);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&rot_hdlr.panel_area, &out, sizeof(out));
+
+    out = it8951_rotate_rect(&rot_hdlr, IT8951_ROTATION_MODE_0, &rect);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&rect, &out, sizeof(out));
+    out = it8951_rotate_rect(&rot_hdlr, IT8951_ROTATION_MODE_90, &rect);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&((stRectangle_t){10, 1, 4, 3}), &out, sizeof(out));
+    out = it8951_rotate_rect(&rot_hdlr, IT8951_ROTATION_MODE_180, &rect);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&((stRectangle_t){12, 2, 3, 4}), &out, sizeof(out));
+    out = it8951_rotate_rect(&rot_hdlr, IT8951_ROTATION_MODE_270, &rect);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&((stRectangle_t){2, 4, 4, 3}), &out, sizeof(out));
+
+    // The whole rotated image covers the whole panel
+    const stRectangle_t image = it8951_get_image_area(&rot_hdlr, IT8951_ROTATION_MODE_270);
+    out = it8951_rotate_rect(&rot_hdlr, IT8951_ROTATION_MODE_270, &image);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&rot_hdlr.panel_area, &out, sizeof(out));
+
+    // The image loads are bounded by the rotated area
+    const stIT8951_ImageInfo_t info = {IT8951_ROTATION_MODE_90, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+    TEST_ASSERT_TRUE(it8951_load_img_area_begin(&rot_hdlr, &info, &(stRectangle_t){0, 0, 8, 16}));
+    TEST_ASSERT_TRUE(it8951_wait_async(&rot_hdlr));
+    TEST_ASSERT_FALSE(it8951_load_img_area_begin(&rot_hdlr, &info, &(stRectangle_t){0, 0, 16, 8}));
+}
+
+// Panel model of the image loads, one GRAY4 pixel per byte
+#define BMP_PANEL_WIDTH  (1872)
+#define BMP_PANEL_HEIGHT (16)
+static uint8_t _screen[BMP_PANEL_HEIGHT][BMP_PANEL_WIDTH];
+static stRectangle_t _load_rect;
+static uint32_t _load_off = 0;
+static uint32_t _load_cnt = 0;
+static uint16_t _load_cmd = 0;
+static bool _load_raw = false;
+
+/// @brief Decodes the 4bpp (big-endian) image loads into _screen. Expects the
+/// framed transport
+static bool load_spi_transcieve(const void *tx, void *rx, size_t len) {
+    TEST_ASSERT_FALSE(ncs);
+    const uint32_t offset = packet_offset(tx, len);
+    if(offset == 0) {
+        return true;
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_WRITE_DATA && _load_raw) {
+        const uint32_t pad = _load_rect.x % 4;
+        const uint32_t row_bytes = ((pad + _load_rect.width + 3)/4)*2;
+        for(uint32_t i=0; i<len; i++, _load_off++) {
+            const uint32_t row = _load_off/row_bytes;
+            TEST_ASSERT_TRUE(row < _load_rect.height);
+            for(uint32_t n=0; n<2; n++) {
+                const int32_t col = (_load_off % row_bytes)*2 + n - pad;
+                if(col >= 0 && col < _load_rect.width) {
+                    _screen[_load_rect.y + row][_load_rect.x + col] = (((const uint8_t*)tx)[i] >> (n ? 0 : 4)) & 0xF;
+                }
+            }
+        }
+        return true;
+    }
+
+    const uint16_t *const words = tx;
+    if(_pkt_preamble == IT8951_SPI_PREAMBLE_COMMAND) {
+        _load_cmd = __builtin_bswap16(words[0]);
+        _load_raw = false;
+    } else if(_pkt_preamble == IT8951_SPI_PREAMBLE_WRITE_DATA && _load_cmd == IT8951_COMMAND_LD_IMG_AREA) {
+        TEST_ASSERT_EQUAL(5*sizeof(uint16_t), len);
+        const stIT8951_ImageInfo_t *const info = &(stIT8951_ImageInfo_t){IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+        TEST_ASSERT_EQUAL_HEX16(*(const uint16_t*)info, __builtin_bswap16(words[0]));
+        _load_rect = (stRectangle_t){__builtin_bswap16(words[1]), __builtin_bswap16(words[2]), 
+                                     __builtin_bswap16(words[3]), __builtin_bswap16(words[4])};
+        _load_off = 0;
+        _load_cnt++;
+        // The pixels follow in the next data packets
+        _load_raw = true;
+    }
+    return true;
+}
+
+/// @brief GRAY4 level of the test image's pixel
+static uint8_t bmp_test_level(const uint16_t bpp, const uint32_t x, const uint32_t y) {
+    return (bpp == 1) ? (((x + y) & 1) ? 0xF : 0) : ((x*3 + y*5) % 16);
+}
+
+/// @brief Builds a BMP of the test image in memory. Free the returned buffer
+static uint8_t *make_test_bmp(const uint16_t bpp, const int32_t width, const int32_t height, size_t *const size) {
+    const uint32_t rows = (height < 0) ? -height : height;
+    const uint32_t stride = ((width*bpp + 31)/32)*4;
+    const uint32_t palette_cnt = (bpp <= 8) ? (1u << bpp) : 0;
+    const uint32_t offset = 14 + 40 + palette_cnt*4;
+    *size = offset + stride*rows;
+    uint8_t *const bmp = calloc(1, *size);
+    TEST_ASSERT_NOT_NULL(bmp);
+
+    const uint32_t file_size = *size;
+    const uint32_t dib_size = 40;
+    memcpy(bmp, "BM", 2);
+    memcpy(bmp + 2, &file_size, 4);
+    memcpy(bmp + 10, &offset, 4);
+    memcpy(bmp + 14, &dib_size, 4);
+    memcpy(bmp + 18, &width, 4);
+    memcpy(bmp + 22, &height, 4);
+    bmp[26] = 1;
+    memcpy(bmp + 28, &bpp, 2);
+    // Gray ramp palette. The 8bpp one repeats the 16 levels
+    for(uint32_t i=0; i<palette_cnt; i++) {
+        const uint8_t level = (bpp == 1) ? (i ? 0xFF : 0) : (i % 16)*0x11;
+        memset(bmp + 14 + 40 + i*4, level, 3);
+    }
+    for(uint32_t y=0; y<rows; y++) {
+        uint8_t *const row = bmp + offset + ((height < 0) ? y : (rows - 1 - y))*stride;
+        for(uint32_t x=0; x<(uint32_t)width; x++) {
+            const uint8_t level = bmp_test_level(bpp, x, y);
+            switch(bpp) {
+            case 1:  row[x/8] |= (level ? 1 : 0) << (7 - x%8); break;
+            case 4:  row[x/2] |= level << ((x & 1) ? 0 : 4); break;
+            case 8:  row[x] = level + 16*(x % 16); break;
+            default: memset(row + x*3, level*0x11, 3); break;
+            }
+        }
+    }
+    return bmp;
+}
+
+static void test_load_bmp_case(const uint16_t bpp, const int32_t width, const int32_t height, const uint16_t x, const uint16_t y) {
+    stIT8951_Handler_t bmp_hdlr = hdlr;
+    bmp_hdlr.spi_transcieve = load_spi_transcieve;
+    bmp_hdlr.transport = IT8951_TRANSPORT_FRAMED;
+    bmp_hdlr.panel_area = (stRectangle_t){0, 0, BMP_PANEL_WIDTH, BMP_PANEL_HEIGHT};
+    memset(_screen, 0xAA, sizeof(_screen));
+    _load_raw = false;
+    _load_cnt = 0;
+
+    size_t size;
+    uint8_t *const bmp = make_test_bmp(bpp, width, height, &size);
+    FILE *img = fmemopen(bmp, size, "rb");
+    TEST_ASSERT_NOT_NULL(img);
+    TEST_ASSERT_TRUE(it8951_load_bmp_stream(&bmp_hdlr, img, x, y));
+    fclose(img);
+    free(bmp);
+    TEST_ASSERT_TRUE(ncs);
+    TEST_ASSERT_TRUE(_load_cnt > 0);
+
+    // The image lands at (x,y), clipped to the panel, and nothing else changes
+    const uint32_t rows = (height < 0) ? -height : height;
+    for(uint32_t py=0; py<BMP_PANEL_HEIGHT; py++) {
+        for(uint32_t px=0; px<BMP_PANEL_WIDTH; px++) {
+            const bool is_inside = px >= x && px < x + (uint32_t)width && py >= y && py < y + rows;
+            const uint8_t expected = is_inside ? bmp_test_level(bpp, px - x, py - y) : 0xAA;
+            if(_screen[py][px] != expected) {
+                ESP_LOGE(tag, "%ubpp %ldx%ld at (%u,%u): pixel (%lu,%lu)", bpp, (long)width, (long)height, x, y,
+                         (unsigned long)px, (unsigned long)py);
+                TEST_ASSERT_EQUAL_HEX8(expected, _screen[py][px]);
+            }
+        }
+    }
+}
+
+void test_load_bmp(void) {
+    static const uint16_t depths[] = {1, 4, 8, 24};
+    for(uint32_t d=0; d<ARRAY_LENGTH(depths); d++) {
+        for(uint16_t x=0; x<4; x++) {
+            // Odd widths leave partial bytes and row padding, both row orders
+            test_load_bmp_case(depths[d], 5, 3, x, 1);
+            test_load_bmp_case(depths[d], 13, -4, x + 8, 2);
+        }
+        // Wider than the panel and taller than a row block, clipped at the
+        // right and at the bottom
+        test_load_bmp_case(depths[d], BMP_PANEL_WIDTH + 9, BMP_PANEL_HEIGHT, 3, 6);
+        TEST_ASSERT_TRUE(_load_cnt > 1);
+    }
+
+    // Not a BMP
+    static uint8_t junk[64] = "XM";
+    FILE *img = fmemopen(junk, sizeof(junk), "rb");
+    TEST_ASSERT_FALSE(it8951_load_bmp_stream(&hdlr, img, 0, 0));
+    fclose(img);
+}
+
+/// @brief Reference packer, shifting in one pixel at a time. This is the 
+/// packer it8951_pack_pixels used before the word-at-a-time row packing
+static uint32_t ref_pack_pixels(const stIT8951_ImageInfo_t *const img_info, const stRectangle_t *const rect, 
+                                const uint8_t *in, uint16_t *out) {
+    const uint32_t slot_bits = (img_info->bpp == IT8951_COLOR_DEPTH_BPP_2BIT) ? 2 :
+                               (img_info->bpp == IT8951_COLOR_DEPTH_BPP_8BIT) ? 8 : 4;
+    const uint32_t pix_per_word = 16/slot_bits;
+    const uint32_t val_bits = (img_info->bpp == IT8951_COLOR_DEPTH_BPP_3BIT) ? 3 : slot_bits;
+    const bool big_endian = (img_info->endianness == IT8951_ENDIANNESS_BIG);
+    const uint16_t *const out_start = out;
+    for(uint32_t y=0; y<rect->height; y++) {
+        uint32_t slot = rect->x % pix_per_word;
+        uint16_t word = 0;
+        for(uint32_t i=0; i<rect->width; i++) {
+            const uint32_t shift = big_endian ? (16 - (slot+1)*slot_bits) : (slot*slot_bits);
+            word |= (uint16_t)(((*in++ & ((1u << val_bits) - 1)) << (slot_bits - val_bits)) << shift);
+            if(++slot == pix_per_word) {
+                *out++ = big_endian ? __builtin_bswap16(word) : word;
+                word = 0;
+                slot = 0;
+            }
+        }
+        if(slot != 0) {
+            *out++ = big_endian ? __builtin_bswap16(word) : word;
+        }
+    }
+    return out - out_start;
+}
+
+/// @brief Compares the row packers against the reference for random pixels 
+/// over every start offset within a word, and widths covering the partial
+/// head, full interior words and the partial tail
+void test_pack_pixels_equivalence(void) {
+    static const eIT8951_ColorDepth_t depths[] = {
+        IT8951_COLOR_DEPTH_BPP_2BIT, IT8951_COLOR_DEPTH_BPP_3BIT, 
+        IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_COLOR_DEPTH_BPP_8BIT
+    };
+    enum { max_width = 40, max_height = 3, max_words = (max_width/2+2)*max_height };
+    uint8_t in_pixels[max_width*max_height];
+    uint16_t packed[max_words], expected[max_words];
+
+    srand(8951);
+    for(uint32_t d=0; d<ARRAY_LENGTH(depths); d++) {
+        for(uint32_t endianness=IT8951_ENDIANNESS_LITTLE; endianness<=IT8951_ENDIANNESS_BIG; endianness++) {
+            const stIT8951_ImageInfo_t img_info = {IT8951_ROTATION_MODE_0, depths[d], endianness};
+            for(uint16_t x=0; x<16; x++) {
+                for(uint16_t width=1; width<=max_width; width++) {
+                    const stRectangle_t rect = {x, 0, width, 1 + rand() % max_height};
+                    for(uint32_t i=0; i<ARRAY_LENGTH(in_pixels); i++) {
+                        // Full bytes, so that masking the unused bits is checked too
+                        in_pixels[i] = rand();
+                    }
+                    uint32_t cnt;
+                    it8951_pack_pixels(&img_info, &rect, in_pixels, packed, &cnt);
+                    TEST_ASSERT_EQUAL_UINT32(ref_pack_pixels(&img_info, &rect, in_pixels, expected), cnt);
+                    TEST_ASSERT_EQUAL_HEX16_ARRAY(expected, packed, cnt);
+                }
+            }
+        }
+    }
+}
+
+/// @brief Times the reference and the row packers on a full 4bpp panel width
+void test_benchmark_pack_pixels(void) {
+    static const uint32_t iterations = 20;
+    const stRectangle_t rect = {1, 0, 1872, 64};
+    const stIT8951_ImageInfo_t img_info = {IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+    const uint32_t area = rectangle_get_area(&rect);
+    uint8_t *in_pixels = malloc(area);
+    uint16_t *packed = malloc((rect.width/4+2)*rect.height*sizeof(uint16_t));
+    TEST_ASSERT_NOT_NULL(in_pixels);
+    TEST_ASSERT_NOT_NULL(packed);
+    for(uint32_t i=0; i<area; i++) {
+        in_pixels[i] = i;
+    }
+
+    uint32_t cnt;
+    int64_t start = esp_timer_get_time();
+    for(uint32_t i=0; i<iterations; i++) {
+        cnt = ref_pack_pixels(&img_info, &rect, in_pixels, packed);
+    }
+    const int64_t ref_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for(uint32_t i=0; i<iterations; i++) {
+        it8951_pack_pixels(&img_info, &rect, in_pixels, packed, &cnt);
+    }
+    const int64_t row_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(tag, "Pack 4bpp: per pixel %" PRId64 " ps/pixel, per word %" PRId64 " ps/pixel (%lu words)",
+             (ref_us*1000000)/(iterations*area), (row_us*1000000)/(iterations*area), (unsigned long)cnt);
+    free(in_pixels);
+    free(packed);
+}
+
+static int run_tests(void) {
     UNITY_BEGIN();
 
     RUN_TEST(test_send_command_multiple_args);
     RUN_TEST(test_write_data_multiple_args);
     RUN_TEST(test_read_data_multiple_args);
-    //RUN_TEST(test_pack_pixels_multiple_args);
+    RUN_TEST(test_hrdy_placement_multiple_args);
+    RUN_TEST(test_framed_transport_multiple_args);
+    RUN_TEST(test_benchmark_transport);
+    RUN_TEST(test_write_packed_pixels_async);
+#if IT8951_TRACE_LENGTH > 0
+    RUN_TEST(test_trace);
+#endif
+    RUN_TEST(test_update_scheduler);
+    RUN_TEST(test_update_concurrent_regions);
+    RUN_TEST(test_update_duration_estimate);
+    RUN_TEST(test_frame_buffer_flip);
+    RUN_TEST(test_update_1bpp);
+    RUN_TEST(test_update_fill);
+    RUN_TEST(test_mem_burst);
+    RUN_TEST(test_pack_pixels_multiple_args);
+    RUN_TEST(test_pack_pixels_depths);
+    RUN_TEST(test_write_packed_pixels_bpp_mode);
+    RUN_TEST(test_rotate_rect);
+    RUN_TEST(test_load_bmp);
+    RUN_TEST(test_pack_pixels_equivalence);
+    RUN_TEST(test_benchmark_pack_pixels);
+
+    return UNITY_END();
+}
+
+// This is required for the ESP-IDF framework
+void app_main() {
+    run_tests();
+}
 
-    UNITY_END();
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
 }
+#endif
@@ -0,0 +1,315 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "unity.h"
+#include "it8951.h"
+#include "it8951_sim.h"
+
+extern bool it8951_get_vcom(stIT8951_Handler_t *hdlr, int32_t *vcom_mv);
+
+// End-to-end tests of the driver against the simulated IT8951: the pixels
+// are checked where they land in the image buffers and on the panel, rather
+// than as SPI bytes
+
+#define SIM_PANEL_WIDTH  (128)
+#define SIM_PANEL_HEIGHT (64)
+#define SIM_IMG_BUFF     (0x1000)
+
+static const stIT8951_SimConfig_t sim_cfg = {
+    .panel_width   = SIM_PANEL_WIDTH,
+    .panel_height  = SIM_PANEL_HEIGHT,
+    .img_buff_addr = SIM_IMG_BUFF,
+    .sdram_size    = 64*1024,
+    .spi_clock_hz  = 24000000,
+    .command_us    = 10,
+    .temperature   = 25,
+    .vcom_mv       = -1530,
+};
+
+static stIT8951_Handler_t hdlr;
+
+/// @brief Creates a simulator and initialises the driver on it
+static void sim_setup(const stIT8951_SimConfig_t *const cfg, const eIT8951_Transport_t transport) {
+    TEST_ASSERT_TRUE(it8951_sim_init(cfg));
+    hdlr = (stIT8951_Handler_t){
+        .transport = transport,
+        .vcom_mv = INT_MAX,
+    };
+    it8951_sim_attach(&hdlr);
+    TEST_ASSERT_TRUE(it8951_init(&hdlr));
+}
+
+/// @brief The simulator saw no malformed packet and no conflicting updates
+static void assert_sim_clean(void) {
+    const stIT8951_SimStats_t *const stats = it8951_sim_stats();
+    if(stats->protocol_errors) {
+        printf("%s\n", it8951_sim_last_error());
+    }
+    TEST_ASSERT_EQUAL(0, stats->protocol_errors);
+    TEST_ASSERT_EQUAL(0, stats->conflicts);
+}
+
+void setUp(void) {}
+void tearDown(void) {
+    it8951_sim_deinit();
+}
+void suiteSetUp(void) {
+    printf("==[ Testing IT8951 driver on the simulator... ]==\n");
+}
+
+void test_sim_init(void) {
+    static const eIT8951_Transport_t transports[] = {IT8951_TRANSPORT_WORD, IT8951_TRANSPORT_FRAMED};
+    for(uint32_t i=0; i<ARRAY_LENGTH(transports); i++) {
+        sim_setup(&sim_cfg, transports[i]);
+        TEST_ASSERT_EQUAL(SIM_PANEL_WIDTH, hdlr.device_info.panel_width);
+        TEST_ASSERT_EQUAL(SIM_PANEL_HEIGHT, hdlr.device_info.panel_height);
+        TEST_ASSERT_EQUAL_HEX32(SIM_IMG_BUFF, hdlr.device_info.img_buff_addr);
+        int32_t vcom_mv;
+        TEST_ASSERT_TRUE(it8951_get_vcom(&hdlr, &vcom_mv));
+        TEST_ASSERT_EQUAL(-1530, vcom_mv);
+        assert_sim_clean();
+        it8951_sim_deinit();
+    }
+}
+
+/// @brief Packs the pixels with the driver's packer, loads them and checks
+/// the 8bpp values the simulator decoded into the image buffer
+static void check_load_depth(const eIT8951_ColorDepth_t bpp, const eIT8951_Endianness_t endianness) {
+    static const uint32_t val_bits[] = {2, 3, 4, 8};
+    const stIT8951_ImageInfo_t img_info = {IT8951_ROTATION_MODE_0, bpp, endianness};
+    const stRectangle_t rect = {5, 3, 13, 4};
+
+    uint8_t pixels[13*4];
+    for(uint32_t i=0; i<ARRAY_LENGTH(pixels); i++) {
+        pixels[i] = (i*7 + 3) & ((1u << val_bits[bpp]) - 1);
+    }
+    uint16_t words[64];
+    uint32_t word_cnt = 0;
+    it8951_pack_pixels(&img_info, &rect, pixels, words, &word_cnt);
+    TEST_ASSERT_TRUE(it8951_write_packed_pixels(&hdlr, &img_info, &rect, words,
+                                                word_cnt*sizeof(uint16_t)*IT8951_BPP_PER_BYTE_MAP[bpp]));
+
+    const uint8_t *const sdram = it8951_sim_sdram();
+    for(uint32_t y=0; y<rect.height; y++) {
+        for(uint32_t x=0; x<rect.width; x++) {
+            const uint8_t v = pixels[y*rect.width + x];
+            // 2bpp is scaled in the 2bpp mode, the others are MSB aligned
+            const uint8_t expected = (bpp == IT8951_COLOR_DEPTH_BPP_2BIT) ? v*0x55 : v << (8 - val_bits[bpp]);
+            TEST_ASSERT_EQUAL_HEX8(expected, sdram[SIM_IMG_BUFF + (rect.y + y)*SIM_PANEL_WIDTH + rect.x + x]);
+        }
+    }
+    // Nothing is written around the area
+    TEST_ASSERT_EQUAL_HEX8(0xFF, sdram[SIM_IMG_BUFF + rect.y*SIM_PANEL_WIDTH + rect.x - 1]);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, sdram[SIM_IMG_BUFF + rect.y*SIM_PANEL_WIDTH + rect.x + rect.width]);
+    TEST_ASSERT_EQUAL(rect.width*rect.height, it8951_sim_stats()->pixels_loaded);
+}
+
+void test_sim_load_depths(void) {
+    for(eIT8951_ColorDepth_t bpp=IT8951_COLOR_DEPTH_BPP_2BIT; bpp<=IT8951_COLOR_DEPTH_BPP_8BIT; bpp++) {
+        for(eIT8951_Endianness_t e=IT8951_ENDIANNESS_LITTLE; e<=IT8951_ENDIANNESS_BIG; e++) {
+            sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+            it8951_sim_reset_stats();
+            check_load_depth(bpp, e);
+            assert_sim_clean();
+            it8951_sim_deinit();
+        }
+    }
+}
+
+/// @brief Gray level of the rotation test's image pixel
+static uint8_t rotation_test_level(const uint32_t u, const uint32_t v) {
+    return (u*3 + v*5) & 0xF;
+}
+
+void test_sim_rotation(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    // x and width are multiples of 4, so the big-endian rows pack into bytes
+    const stRectangle_t rect = {4, 2, 8, 3};
+    for(eIT8951_RotationMode_t rot=IT8951_ROTATION_MODE_0; rot<=IT8951_ROTATION_MODE_270; rot++) {
+        const stIT8951_ImageInfo_t img_info = {rot, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+        uint8_t packed[8/2*3];
+        for(uint32_t v=0; v<rect.height; v++) {
+            for(uint32_t u=0; u<rect.width; u+=2) {
+                packed[v*rect.width/2 + u/2] = (rotation_test_level(u, v) << 4) | rotation_test_level(u+1, v);
+            }
+        }
+        TEST_ASSERT_TRUE(it8951_load_img_area_begin(&hdlr, &img_info, &rect));
+        TEST_ASSERT_TRUE(it8951_load_img_area_write_async(&hdlr, packed, sizeof(packed)));
+        const stRectangle_t panel_rect = it8951_rotate_rect(&hdlr, rot, &rect);
+        TEST_ASSERT_TRUE(it8951_display_area(&hdlr, &panel_rect, IT8951_DISPLAY_MODE_GC16));
+
+        for(uint32_t v=0; v<rect.height; v++) {
+            for(uint32_t u=0; u<rect.width; u++) {
+                const stRectangle_t px = it8951_rotate_rect(&hdlr, rot, &(stRectangle_t){rect.x+u, rect.y+v, 1, 1});
+                TEST_ASSERT_EQUAL_HEX8(rotation_test_level(u, v)*0x11, it8951_sim_get_pixel(px.x, px.y));
+            }
+        }
+    }
+    assert_sim_clean();
+}
+
+void test_sim_waveforms(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    // A DU update only drives black and white
+    TEST_ASSERT_TRUE(it8951_fill_rect(&hdlr, &(stRectangle_t){0, 0, 8, 8}, IT8951_DISPLAY_MODE_DU, 0x99));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, it8951_sim_get_pixel(0, 0));
+    // DU4 drives 4 levels, GC16 all 16
+    TEST_ASSERT_TRUE(it8951_fill_rect(&hdlr, &(stRectangle_t){8, 0, 8, 8}, IT8951_DISPLAY_MODE_DU4, 0x99));
+    TEST_ASSERT_EQUAL_HEX8(0xAA, it8951_sim_get_pixel(8, 0));
+    TEST_ASSERT_TRUE(it8951_fill_rect(&hdlr, &(stRectangle_t){16, 0, 8, 8}, IT8951_DISPLAY_MODE_GC16, 0x99));
+    TEST_ASSERT_EQUAL_HEX8(0x99, it8951_sim_get_pixel(16, 0));
+    TEST_ASSERT_EQUAL(3, it8951_sim_stats()->updates);
+    TEST_ASSERT_EQUAL(3, it8951_sim_stats()->fills);
+    assert_sim_clean();
+}
+
+void test_sim_scheduler(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    it8951_sim_reset_stats();
+
+    // Overlapping updates must never run at the same time, and the scheduler
+    // must keep up with more updates than LUT engines
+    uint32_t id = IT8951_UPDATE_ID_INVALID;
+    for(uint32_t i=0; i<40; i++) {
+        const stRectangle_t rect = {(i*5) % 120, (i*3) % 56, 8, 8};
+        const eIT8951_DisplayMode_t mode = (i % 3) ? IT8951_DISPLAY_MODE_DU : IT8951_DISPLAY_MODE_GL16;
+        TEST_ASSERT_TRUE(it8951_display_area_async(&hdlr, &rect, mode, &id));
+    }
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+    TEST_ASSERT_TRUE(it8951_update_is_done(&hdlr, id));
+    TEST_ASSERT_TRUE(it8951_sim_stats()->updates > 0 && it8951_sim_stats()->updates <= 40);
+    // The waits are modelled in the virtual time
+    TEST_ASSERT_TRUE(it8951_sim_time_ns() >= 450000000ull);
+    assert_sim_clean();
+}
+
+void test_sim_fill_async(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    uint32_t id;
+    TEST_ASSERT_TRUE(it8951_fill_rect_async(&hdlr, &(stRectangle_t){16, 8, 32, 16}, IT8951_DISPLAY_MODE_GC16, 0x44, &id));
+    // A load into the default buffer must wait for the fill to be launched
+    TEST_ASSERT_TRUE(it8951_update_wait_launched(&hdlr, id));
+    TEST_ASSERT_EQUAL_HEX8(0x44, it8951_sim_sdram()[SIM_IMG_BUFF + 8*SIM_PANEL_WIDTH + 16]);
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+    TEST_ASSERT_EQUAL_HEX8(0x44, it8951_sim_get_pixel(16, 8));
+    TEST_ASSERT_EQUAL_HEX8(0x44, it8951_sim_get_pixel(47, 23));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, it8951_sim_get_pixel(48, 23));
+    TEST_ASSERT_EQUAL(1, it8951_sim_stats()->fills);
+    assert_sim_clean();
+}
+
+void test_sim_1bpp(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    uint32_t buff;
+    TEST_ASSERT_TRUE(it8951_frame_buffer_alloc(&hdlr, &buff));
+    TEST_ASSERT_TRUE(it8951_frame_buffer_set_target(&hdlr, buff));
+
+    // Alternating columns: the 1 bits get the background
+    const stRectangle_t rect = {32, 4, 64, 2};
+    uint8_t bits[64/8*2];
+    memset(bits, 0xAA, sizeof(bits));
+    TEST_ASSERT_TRUE(it8951_load_img_area_1bpp_begin(&hdlr, &rect));
+    TEST_ASSERT_TRUE(it8951_load_img_area_write_async(&hdlr, bits, sizeof(bits)));
+    uint32_t id;
+    TEST_ASSERT_TRUE(it8951_frame_buffer_display_1bpp_async(&hdlr, buff, &rect, IT8951_DISPLAY_MODE_DU, 0x00, 0xFF, &id));
+    TEST_ASSERT_TRUE(it8951_update_wait(&hdlr, id));
+
+    for(uint32_t x=rect.x; x<rect.x + rect.width; x++) {
+        TEST_ASSERT_EQUAL_HEX8((x % 2) ? 0x00 : 0xFF, it8951_sim_get_pixel(x, rect.y + 1));
+    }
+    assert_sim_clean();
+}
+
+void test_sim_mem_burst(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    uint8_t out[32], in[32];
+    for(uint32_t i=0; i<sizeof(out); i++) {
+        out[i] = i*11;
+    }
+    TEST_ASSERT_TRUE(it8951_mem_burst_write(&hdlr, 0x2000, out, sizeof(out)));
+    TEST_ASSERT_TRUE(it8951_mem_burst_read(&hdlr, 0x2000, in, sizeof(in)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(out, in, sizeof(out));
+    assert_sim_clean();
+}
+
+void test_sim_dump_png(void) {
+    sim_setup(&sim_cfg, IT8951_TRANSPORT_FRAMED);
+    TEST_ASSERT_TRUE(it8951_fill_rect(&hdlr, &(stRectangle_t){0, 0, 64, 64}, IT8951_DISPLAY_MODE_GC16, 0x00));
+
+    // Signature, IHDR, one IDAT of stored blocks and IEND
+    const uint32_t raw = SIM_PANEL_HEIGHT*(SIM_PANEL_WIDTH + 1);
+    const uint32_t size = 8 + 25 + 12 + (2 + raw + 5*((raw + 0xFFFE)/0xFFFF) + 4) + 12;
+    uint8_t *const png = malloc(size + 16);
+    TEST_ASSERT_NOT_NULL(png);
+    FILE *out = fmemopen(png, size + 16, "wb");
+    TEST_ASSERT_TRUE(it8951_sim_dump_png(out));
+    TEST_ASSERT_EQUAL(size, ftell(out));
+    fclose(out);
+    TEST_ASSERT_EQUAL_MEMORY("\x89PNG\r\n\x1a\n", png, 8);
+    TEST_ASSERT_EQUAL_MEMORY("IHDR", png + 12, 4);
+    TEST_ASSERT_EQUAL_MEMORY("IEND", png + size - 8, 4);
+    free(png);
+}
+
+/// @brief Loads and shows full screens of the real panel through the driver
+/// and reports the modelled throughput
+void test_sim_throughput(void) {
+    const stIT8951_SimConfig_t cfg = IT8951_SIM_CONFIG_DEFAULT;
+    if(!it8951_sim_init(&cfg)) {
+        TEST_IGNORE_MESSAGE("Not enough memory for the full panel");
+    }
+    it8951_sim_deinit();
+    sim_setup(&cfg, IT8951_TRANSPORT_FRAMED);
+    it8951_sim_reset_stats();
+
+    const stIT8951_ImageInfo_t img_info = {IT8951_ROTATION_MODE_0, IT8951_COLOR_DEPTH_BPP_4BIT, IT8951_ENDIANNESS_BIG};
+    const stRectangle_t rect = {0, 0, cfg.panel_width, cfg.panel_height};
+    // Rows are sent in blocks, like the display's bounce buffers
+    static uint8_t block[16*1872/2];
+    const uint32_t row_bytes = cfg.panel_width/2;
+    const uint32_t rows_per_block = sizeof(block)/row_bytes;
+    for(uint32_t frame=0; frame<2; frame++) {
+        memset(block, frame ? 0x00 : 0x77, sizeof(block));
+        TEST_ASSERT_TRUE(it8951_load_img_area_begin(&hdlr, &img_info, &rect));
+        for(uint32_t row=0; row<rect.height; row+=rows_per_block) {
+            const uint32_t rows = (rect.height - row < rows_per_block) ? rect.height - row : rows_per_block;
+            TEST_ASSERT_TRUE(it8951_load_img_area_write_async(&hdlr, block, rows*row_bytes));
+        }
+        TEST_ASSERT_TRUE(it8951_display_area(&hdlr, &rect, IT8951_DISPLAY_MODE_GC16));
+    }
+    TEST_ASSERT_EQUAL_HEX8(0x00, it8951_sim_get_pixel(cfg.panel_width-1, cfg.panel_height-1));
+    TEST_ASSERT_EQUAL(2ull*cfg.panel_width*cfg.panel_height, it8951_sim_stats()->pixels_loaded);
+    it8951_sim_print_stats(stdout);
+    assert_sim_clean();
+}
+
+static int run_tests(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_sim_init);
+    RUN_TEST(test_sim_load_depths);
+    RUN_TEST(test_sim_rotation);
+    RUN_TEST(test_sim_waveforms);
+    RUN_TEST(test_sim_scheduler);
+    RUN_TEST(test_sim_fill_async);
+    RUN_TEST(test_sim_1bpp);
+    RUN_TEST(test_sim_mem_burst);
+    RUN_TEST(test_sim_dump_png);
+    RUN_TEST(test_sim_throughput);
+
+    return UNITY_END();
+}
+
+// This is required for the ESP-IDF framework
+void app_main() {
+    run_tests();
+}
+
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
+}
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "unity.h"
+#include "waveform.h"
+
+#define WHITE (WAVEFORM_GRAY_LEVELS-1)
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_waveform_select_du(void) {
+    uint32_t hist[WAVEFORM_GRAY_LEVELS] = {0};
+    // An empty region and pure black and white content take DU
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_DU, waveform_select(hist));
+    hist[0] = 100;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_DU, waveform_select(hist));
+    hist[WHITE] = 1;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_DU, waveform_select(hist));
+}
+
+void test_waveform_select_du4(void) {
+    uint32_t hist[WAVEFORM_GRAY_LEVELS] = {0};
+    // Only the levels DU4 renders: 0x0, 0x5, 0xA and 0xF
+    hist[0x0] = 10;
+    hist[0x5] = 10;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_DU4, waveform_select(hist));
+    hist[0xA] = 10;
+    hist[0xF] = 1000;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_DU4, waveform_select(hist));
+}
+
+void test_waveform_select_gl16(void) {
+    uint32_t hist[WAVEFORM_GRAY_LEVELS] = {0};
+    // Text anti-aliased on a white background
+    hist[0x0] = 10;
+    hist[0x7] = 15;
+    hist[WHITE] = 75;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_GL16, waveform_select(hist));
+    // Just below the white share
+    hist[WHITE] = 74;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_GC16, waveform_select(hist));
+}
+
+void test_waveform_select_gc16(void) {
+    uint32_t hist[WAVEFORM_GRAY_LEVELS];
+    // A full gray ramp, e.g. an image
+    for(uint32_t g=0; g<WAVEFORM_GRAY_LEVELS; g++) {
+        hist[g] = 100;
+    }
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_GC16, waveform_select(hist));
+}
+
+void test_waveform_counts(void) {
+    const uint32_t du = waveform_get_count(IT8951_DISPLAY_MODE_DU);
+    const uint32_t gc16 = waveform_get_count(IT8951_DISPLAY_MODE_GC16);
+
+    // Selecting a waveform does not count it, only the updates that were sent
+    uint32_t hist[WAVEFORM_GRAY_LEVELS] = {0};
+    hist[0] = 1;
+    TEST_ASSERT_EQUAL(IT8951_DISPLAY_MODE_DU, waveform_select(hist));
+    TEST_ASSERT_EQUAL(du, waveform_get_count(IT8951_DISPLAY_MODE_DU));
+
+    waveform_record_update(IT8951_DISPLAY_MODE_DU);
+    waveform_record_update(IT8951_DISPLAY_MODE_DU);
+    waveform_record_update(IT8951_DISPLAY_MODE_GC16);
+    TEST_ASSERT_EQUAL(du + 2, waveform_get_count(IT8951_DISPLAY_MODE_DU));
+    TEST_ASSERT_EQUAL(gc16 + 1, waveform_get_count(IT8951_DISPLAY_MODE_GC16));
+}
+
+static int run_tests(void) {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_waveform_select_du);
+    RUN_TEST(test_waveform_select_du4);
+    RUN_TEST(test_waveform_select_gl16);
+    RUN_TEST(test_waveform_select_gc16);
+    RUN_TEST(test_waveform_counts);
+
+    return UNITY_END();
+}
+
+void app_main() {
+    run_tests();
+}
+
+// The native build has no ESP-IDF to call app_main
+#ifndef ESP_PLATFORM
+int main(void) {
+    return run_tests();
+}
+#endif
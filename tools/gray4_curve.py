@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Computes and calibrates the gray curve of lib/gray4/gray4.h.
+
+The firmware maps the luminance of LVGL's RGB565 pixels to the 16 gray levels
+through a curve set at build time by GRAY4_GAMMA, GRAY4_CONTRAST,
+GRAY4_BLACK_POINT and GRAY4_WHITE_POINT. thresholds() is GRAY4_THRESHOLD() of
+the header, so pack_assets.py converts images exactly like the firmware.
+
+Calibration of the VB3300-KCA (see the README):
+ 1. Build with -D DISPLAY_GRAY_WEDGE=1, the panel shows the 16 raw gray levels
+    as bars, black on the left
+ 2. Measure the reflectance of each bar, with a light meter or as the mean of
+    a RAW photo under even light, in any linear unit
+ 3. python tools/gray4_curve.py fit m0 m1 ... m15
+    prints the build_flags whose curve makes the bars' reflectance follow the
+    sRGB decoding of the colors LVGL draws
+
+Usage:
+    python tools/gray4_curve.py thresholds [--gamma G] [--contrast C] ...
+    python tools/gray4_curve.py fit [--target-gamma 2.2] m0 ... m15
+"""
+import argparse
+import math
+import sys
+
+LEVELS = 16
+# The luminance in the 16bit units of the firmware: (18837R + 18197G + 7182B)/31
+LUMA_MAX = 63000
+
+
+def thresholds(gamma=1.0, contrast=1.0, black_point=0.0, white_point=1.0):
+    """Returns the lowest luminance of the gray levels 1..15, GRAY4_THRESHOLD()"""
+    out = []
+    for k in range(1, LEVELS):
+        x1 = 0.5 + (math.pow(k/15.0, gamma) - 0.5)/contrast
+        luma = LUMA_MAX*(black_point + (white_point - black_point)*x1)
+        if x1 <= 0.0 or luma <= 0.0:
+            out.append(0)
+        elif x1 > 1.0 or luma > LUMA_MAX:
+            out.append(LUMA_MAX + 1)
+        else:
+            # The 1e-6 keeps the rounding errors of the identity off the bounds
+            out.append(math.ceil(luma - 1e-6))
+    return out
+
+
+def rgb565_to_gray4(r5, g6, b5, curve):
+    """Maps the RGB565 components to GRAY4 through the curve's thresholds"""
+    luma = (18837*r5 + 18197*g6 + 7182*b5)//31
+    return sum(luma >= t for t in curve)
+
+
+def add_curve_args(parser):
+    """Adds the curve's parameters to the parser, as the build_flags"""
+    parser.add_argument("--gamma", type=float, default=1.0, help="GRAY4_GAMMA")
+    parser.add_argument("--contrast", type=float, default=1.0, help="GRAY4_CONTRAST")
+    parser.add_argument("--black-point", type=float, default=0.0, help="GRAY4_BLACK_POINT")
+    parser.add_argument("--white-point", type=float, default=1.0, help="GRAY4_WHITE_POINT")
+
+
+def curve_from_args(args):
+    return thresholds(args.gamma, args.contrast, args.black_point, args.white_point)
+
+
+def fit(measured, target_gamma):
+    """Fits GRAY4_GAMMA to the reflectances of the 16 gray levels
+
+    The panel's response is modelled as r = (k/15)^p of the normalized
+    reflectance r of level k, fitted in the log domain. With the curve's
+    level/15 = x^(1/GRAY4_GAMMA), a luminance x is shown as x^(p/GRAY4_GAMMA),
+    which is the target's x^target_gamma for GRAY4_GAMMA = p/target_gamma.
+    Returns (GRAY4_GAMMA, p, normalized reflectances).
+    """
+    black, white = measured[0], measured[-1]
+    if white <= black:
+        sys.exit("Level 15 must reflect more than level 0")
+    norm = [(m - black)/(white - black) for m in measured]
+    if any(b < a for a, b in zip(norm, norm[1:])):
+        print("Warning: the reflectances are not monotonic", file=sys.stderr)
+    pairs = [(math.log(k/15.0), math.log(r)) for k, r in enumerate(norm) if 0 < k < LEVELS-1 and r > 0]
+    if not pairs:
+        sys.exit("No usable levels between black and white")
+    p = sum(u*v for u, v in pairs)/sum(u*u for u, _ in pairs)
+    return p/target_gamma, p, norm
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+    thr = sub.add_parser("thresholds", help="Print the curve's thresholds")
+    add_curve_args(thr)
+    cal = sub.add_parser("fit", help="Fit the curve to measured reflectances")
+    cal.add_argument("--target-gamma", type=float, default=2.2,
+                     help="Decoding gamma of the UI's colors (default: 2.2, sRGB)")
+    cal.add_argument("measured", type=float, nargs=LEVELS,
+                     help="Reflectance of the gray levels 0 to 15")
+    args = parser.parse_args()
+
+    if args.command == "thresholds":
+        curve = curve_from_args(args)
+        for k, t in enumerate(curve, 1):
+            print("%2u: %5u (%.3f)" % (k, t, t/LUMA_MAX))
+        return
+
+    gamma, p, norm = fit(args.measured, args.target_gamma)
+    print("Panel response: (level/15)^%.3f" % p)
+    for k, r in enumerate(norm):
+        print("%2u: %.3f (model %.3f)" % (k, r, math.pow(k/15.0, p)))
+    print("build_flags:\n    -D GRAY4_GAMMA=%.3f" % gamma)
+    print("pack_assets.py: --gamma %.3f" % gamma)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Packs images into the asset partition image read by src/assets.c.
+
+Each image is converted to the 16 gray levels of the panel with the same
+RGB565 -> GRAY4 mapping the firmware applies to LVGL's output, so a packed
+asset looks the same as when LVGL draws it. The gray curve options must match
+the GRAY4_* build_flags, see tools/gray4_curve.py. The pixels are packed 4bpp
+in the IT8951's big-endian wire format, the first pixel in the high nibble,
+and the width is padded to a multiple of 4 pixels. display_blit_asset()
+uploads these rows as they are.
+
+Layout (little-endian), see inc/assets.h:
+    header:  magic "IT8A" (u32), version (u16), count (u16)
+    entries: name (24 bytes, NUL padded), width (u16), height (u16),
+             offset (u32), size (u32)
+    pixels:  4 byte aligned, at the offsets of the entries
+
+Usage:
+    python tools/pack_assets.py -o assets.bin assets/*.png
+    parttool.py write_partition --partition-name assets --input assets.bin
+
+Requires Pillow.
+"""
+import argparse
+import os
+import struct
+import sys
+
+from PIL import Image
+
+import gray4_curve
+
+MAGIC = 0x41385449
+VERSION = 1
+NAME_LEN = 24
+HEADER = struct.Struct("<IHH")
+ENTRY = struct.Struct("<%dsHHII" % NAME_LEN)
+# Size of the assets partition in partitions.csv
+DEFAULT_PARTITION_SIZE = 0x180000
+
+
+def rgb_to_gray4(r, g, b, curve):
+    """Truncates to RGB565 and maps to GRAY4 exactly like the firmware"""
+    return gray4_curve.rgb565_to_gray4(r >> 3, g >> 2, b >> 3, curve)
+
+
+def pack_image(path, fill, curve):
+    """Returns (width, height, packed pixels) of the image, padded to 4 px"""
+    img = Image.open(path).convert("RGBA")
+    # Transparent pixels are blended onto the padding's gray level
+    background = Image.new("RGBA", img.size, (fill*0x11,)*3 + (0xFF,))
+    img = Image.alpha_composite(background, img).convert("RGB")
+
+    width, height = img.size
+    padded = (width + 3) & ~3
+    lut = {}
+    out = bytearray()
+    pixels = img.load()
+    for y in range(height):
+        row = []
+        for x in range(width):
+            rgb = pixels[x, y]
+            if rgb not in lut:
+                lut[rgb] = rgb_to_gray4(*rgb, curve)
+            row.append(lut[rgb])
+        row.extend([fill]*(padded - width))
+        for i in range(0, padded, 2):
+            out.append((row[i] << 4) | row[i+1])
+    return padded, height, bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("images", nargs="+", help="Images to pack. The asset "
+                        "is named after the file name without the extension")
+    parser.add_argument("-o", "--output", required=True, help="Partition image")
+    parser.add_argument("--fill", type=lambda v: int(v, 0), default=0xF,
+                        help="Gray level of the padding and of the "
+                        "transparent pixels (default: 0xF, white)")
+    parser.add_argument("--partition-size", type=lambda v: int(v, 0),
+                        default=DEFAULT_PARTITION_SIZE)
+    gray4_curve.add_curve_args(parser)
+    args = parser.parse_args()
+    curve = gray4_curve.curve_from_args(args)
+
+    names = [os.path.splitext(os.path.basename(p))[0] for p in args.images]
+    for name in names:
+        if len(name.encode()) >= NAME_LEN:
+            sys.exit("Asset name '%s' is longer than %d bytes" % (name, NAME_LEN-1))
+    if len(set(names)) != len(names):
+        sys.exit("Asset names must be unique")
+
+    offset = HEADER.size + ENTRY.size*len(names)
+    entries, blobs = [], []
+    for name, path in zip(names, args.images):
+        offset = (offset + 3) & ~3
+        width, height, pixels = pack_image(path, args.fill, curve)
+        entries.append(ENTRY.pack(name.encode(), width, height, offset, len(pixels)))
+        blobs.append((offset, pixels))
+        print("%-*s %4ux%-4u %7u bytes @ 0x%06x" % (NAME_LEN, name, width, height, len(pixels), offset))
+        offset += len(pixels)
+
+    if offset > args.partition_size:
+        sys.exit("The assets take %u bytes, the partition is only %u" % (offset, args.partition_size))
+
+    image = bytearray(HEADER.pack(MAGIC, VERSION, len(entries)) + b"".join(entries))
+    for blob_offset, pixels in blobs:
+        image.extend(b"\xFF"*(blob_offset - len(image)))
+        image.extend(pixels)
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print("%u assets, %u/%u bytes" % (len(entries), len(image), args.partition_size))
+
+
+if __name__ == "__main__":
+    main()